@@ -0,0 +1,130 @@
+// Compares the old ftw()-based directory enumeration with Crawler.
+//
+// Usage: bench_crawl [existing directory]
+//        bench_crawl [depth] [fanout] [files per directory]
+//
+// Without an existing directory, a tree is generated under /tmp first (and
+// removed afterwards).
+
+#include <helpers.hpp>
+
+#include <ftw.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+
+    std::vector<std::string> ftw_paths;
+
+    int ftw_callback(const char *fpath, const struct stat *sb, int typeflag)
+    {
+        (void) sb;
+        if (typeflag == FTW_D) ftw_paths.push_back(fpath);
+        return 0;
+    }
+
+    std::size_t with_ftw(const std::string &root)
+    {
+        ftw_paths.clear();
+        ftw(root.c_str(), ftw_callback, 256);
+        return ftw_paths.size();
+    }
+
+    std::size_t with_crawler(const std::string &root, unsigned threads)
+    {
+        return Watch::enumerateSubdirectories(root, nullptr, threads).size();
+    }
+
+    std::size_t generate(const std::string &dir, int depth, int fanout,
+                         int files)
+    {
+        std::size_t made = 1;
+
+        for (int i = 0; i < files; ++i) {
+            std::string file = dir + "/file" + std::to_string(i);
+            int fd = open(file.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC, 0644);
+            if (fd >= 0) close(fd);
+        }
+
+        if (depth == 0) return made;
+
+        for (int i = 0; i < fanout; ++i) {
+            std::string sub = dir + "/dir" + std::to_string(i);
+            mkdir(sub.c_str(), 0755);
+            made += generate(sub, depth - 1, fanout, files);
+        }
+
+        return made;
+    }
+
+    template <class F>
+    void time(const char *label, F f)
+    {
+        using namespace std::chrono;
+
+        double best = 1e9;
+        std::size_t found = 0;
+
+        for (int i = 0; i < 3; ++i) {
+            auto start = steady_clock::now();
+            found = f();
+            best = std::min(best, duration<double>(
+                        steady_clock::now() - start).count());
+        }
+
+        printf("%-20s %10zu directories %10.3f ms\n",
+               label, found, best * 1000);
+    }
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::string root;
+    bool generated = false;
+
+    struct stat sb;
+    if (argc > 1 && stat(argv[1], &sb) == 0 && S_ISDIR(sb.st_mode)) {
+        root = argv[1];
+    } else {
+        const int depth = (argc > 1) ? atoi(argv[1]) : 4;
+        const int fanout = (argc > 2) ? atoi(argv[2]) : 8;
+        const int files = (argc > 3) ? atoi(argv[3]) : 4;
+
+        char dir[] = "/tmp/watchdog-bench-crawl-XXXXXX";
+        if (mkdtemp(dir) == nullptr) {
+            perror("mkdtemp");
+            return 1;
+        }
+        root = dir;
+        generated = true;
+
+        printf("Generated %zu directories in %s\n",
+               generate(root, depth, fanout, files), dir);
+    }
+
+    const unsigned cores = std::thread::hardware_concurrency();
+
+    time("ftw", [&] { return with_ftw(root); });
+    time("Crawler, 1 thread", [&] { return with_crawler(root, 1); });
+    if (cores > 1) {
+        std::string label = "Crawler, " + std::to_string(cores) + " threads";
+        time(label.c_str(), [&] { return with_crawler(root, cores); });
+    }
+
+    if (generated) {
+        nftw(root.c_str(), [](const char *fpath, const struct stat *,
+                              int, struct FTW *) {
+                return remove(fpath);
+            }, 64, FTW_DEPTH | FTW_PHYS);
+    }
+
+    return 0;
+}
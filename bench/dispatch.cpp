@@ -0,0 +1,195 @@
+// Measures how fast Sentry can hand events to callbacks, without the kernel
+// getting in the way: we build a read() buffer by hand and feed it straight
+// into dispatch.
+//
+// Batch callbacks are handed a whole buffer at a time, and Static has its
+// handler fixed at compile time (see handlers.hpp).
+//
+// Each case is run once with a single callback, and once more with a pile of
+// narrow callbacks registered for events that never show up.
+//
+// Usage: bench_dispatch [events] [extra callbacks]
+
+#include <watchdog.hpp>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace {
+
+    // Count every heap allocation so we can report allocations per event
+    std::atomic<std::size_t> allocations{0};
+
+    std::vector<char> make_buffer(int wd, std::size_t count)
+    {
+        // Long enough that std::string can't keep it inline
+        const std::string name = "some-file-with-a-long-name.txt";
+        const std::size_t len = (name.size() + 1 + 3) & ~std::size_t(3);
+        const std::size_t stride = sizeof(Watch::Event) + len;
+
+        std::vector<char> buffer(stride * count, 0);
+        for (std::size_t i = 0; i < count; ++i) {
+            auto *ev = reinterpret_cast<Watch::Event*>(&buffer[i * stride]);
+            ev->wd = wd;
+            ev->mask = (i % 2) ? Watch::On::Modify : Watch::On::Close_Write;
+            ev->cookie = 0;
+            ev->len = len;
+            memcpy(ev->name, name.c_str(), name.size());
+        }
+
+        return buffer;
+    }
+
+    template <class Watcher>
+    void run(const char *label, Watcher &watcher, std::vector<char> &buffer,
+             std::size_t per_buffer, std::size_t events)
+    {
+        using namespace std::chrono;
+
+        const std::size_t rounds = events / per_buffer;
+
+        // Warm up the caches (and the CPU clock) first
+        for (std::size_t i = 0; i < rounds / 10; ++i) {
+            watcher.feed(buffer.data(), buffer.size());
+        }
+
+        const std::size_t before = allocations.load();
+        const auto start = steady_clock::now();
+
+        for (std::size_t i = 0; i < rounds; ++i) {
+            watcher.feed(buffer.data(), buffer.size());
+        }
+
+        const double seconds = duration<double>(
+                steady_clock::now() - start).count();
+        const std::size_t allocated = allocations.load() - before;
+        const std::size_t total = rounds * per_buffer;
+
+        printf("%-12s %12.0f events/s %8.3f allocations/event\n",
+               label, total / seconds, double(allocated) / total);
+    }
+
+} // namespace
+
+// Kept out of line, or GCC sees free() on what new returned once they're
+// inlined, and complains
+__attribute__((noinline)) void *operator new(std::size_t size)
+{
+    ++allocations;
+    if (void *p = malloc(size)) return p;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p,
+                                               std::size_t) noexcept
+{
+    free(p);
+}
+
+int main(int argc, char *argv[])
+{
+    const std::size_t events = (argc > 1) ? strtoull(argv[1], nullptr, 10)
+                                          : 10000000;
+    const std::size_t extra = (argc > 2) ? strtoull(argv[2], nullptr, 10)
+                                         : 32;
+    const std::size_t per_buffer = 1024;
+
+    char dir[] = "/tmp/watchdog-bench-dispatch-XXXXXX";
+    if (mkdtemp(dir) == nullptr) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::string trigger = std::string(dir) + "/trigger";
+
+    std::size_t seen = 0;
+    int wd = -1;
+
+    Watch::Dog with_copies(dir);
+    with_copies.add_callback([&](Watch::Event *ev, std::string path) {
+            seen += path.size();
+            wd = ev->wd;
+        }, Watch::On::Modify | Watch::On::Close_Write | Watch::On::Create);
+
+    Watch::Dog with_views(dir);
+    with_views.add_callback([&](const Watch::Event_View &ev) {
+            seen += ev.path.size() + ev.name.size();
+        }, Watch::On::Modify | Watch::On::Close_Write | Watch::On::Create);
+
+    Watch::Dog with_batches(dir);
+    with_batches.add_batch_callback([&](const Watch::Event_Batch &batch) {
+            for (const auto &ev : batch) {
+                seen += ev.path.size() + ev.name.size();
+            }
+        }, Watch::On::Modify | Watch::On::Close_Write | Watch::On::Create);
+
+    auto handlers = Watch::make_handlers(
+            Watch::handle<Watch::On::Modify | Watch::On::Close_Write
+                          | Watch::On::Create>(
+                [&seen](const Watch::Event_View &ev) {
+                    seen += ev.path.size() + ev.name.size();
+                }));
+    Watch::Static_Sentry<Watch::Normally, decltype(handlers), Watch::Small>
+        with_handlers(dir, handlers);
+
+    // Every watcher only has one watch, so they agree on the wd. Get a
+    // real event through to find out what it is.
+    std::ofstream(trigger.c_str()).put('x');
+    with_copies.run_once(std::chrono::milliseconds(1000));
+    with_views.run_once(std::chrono::milliseconds(1000));
+    with_batches.run_once(std::chrono::milliseconds(1000));
+    with_handlers.run_once(std::chrono::milliseconds(1000));
+
+    if (wd < 0) {
+        fprintf(stderr, "Never saw an event for %s\n", trigger.c_str());
+        return 1;
+    }
+
+    auto buffer = make_buffer(wd, per_buffer);
+
+    printf("Dispatching %zu events\n", events);
+    run("Callback", with_copies, buffer, per_buffer, events);
+    run("View", with_views, buffer, per_buffer, events);
+    run("Batch", with_batches, buffer, per_buffer, events);
+    run("Static", with_handlers, buffer, per_buffer, events);
+
+    const Watch::FlagBearer never[] = {
+        Watch::On::Access, Watch::On::Attributes, Watch::On::Open,
+        Watch::On::Delete, Watch::On::Move, Watch::On::Moved_From,
+    };
+    for (std::size_t i = 0; i < extra; ++i) {
+        const auto flags = never[i % (sizeof(never) / sizeof(never[0]))];
+        with_copies.add_callback([&](Watch::Event*, std::string) {
+                ++seen;
+            }, flags);
+        with_views.add_callback([&](const Watch::Event_View&) {
+                ++seen;
+            }, flags);
+        with_batches.add_batch_callback([&](const Watch::Event_Batch&) {
+                ++seen;
+            }, flags);
+    }
+
+    printf("With %zu more callbacks that never match\n", extra);
+    run("Callback", with_copies, buffer, per_buffer, events);
+    run("View", with_views, buffer, per_buffer, events);
+    run("Batch", with_batches, buffer, per_buffer, events);
+
+    unlink(trigger.c_str());
+    rmdir(dir);
+
+    return seen == 0;
+}
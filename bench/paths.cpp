@@ -0,0 +1,124 @@
+// Compares how much memory each storage policy needs per watched directory,
+// and how fast they can turn a wd back into a path.
+//
+// Paths are made up to look like a deep monorepo: lots of directories, lots
+// of shared prefixes, and the same few names over and over.
+//
+// Usage: bench_paths [directories]
+
+#include <path_tree.hpp>
+#include <storage_policies.hpp>
+
+#include <malloc.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace {
+
+    // Count every live heap byte, so we can see what each policy really
+    // costs once it's done growing
+    std::atomic<std::size_t> allocated{0};
+
+    std::vector<std::string> make_paths(std::size_t count)
+    {
+        const char *names[] = {
+            "src", "test", "lib", "include", "internal", "util", "proto",
+            "generated", "components", "v1", "v2", "common", "impl", "tools",
+        };
+        const std::size_t kinds = sizeof(names) / sizeof(names[0]);
+
+        std::vector<std::string> paths;
+        paths.reserve(count);
+        paths.push_back("/home/someone/work/monorepo");
+
+        // Breadth first, so every parent comes before its children
+        for (std::size_t i = 0; paths.size() < count; ++i) {
+            for (std::size_t j = 0; j < 8 && paths.size() < count; ++j) {
+                std::string name = names[(i * 7 + j) % kinds];
+                if (j >= kinds / 2) name += "_" + std::to_string(j);
+                paths.push_back(paths[i] + "/" + name);
+            }
+        }
+
+        return paths;
+    }
+
+    template <class Container>
+    void run(const char *label, const std::vector<std::string> &paths)
+    {
+        using namespace std::chrono;
+
+        const std::size_t before = allocated.load();
+        Container wds;
+        for (std::size_t i = 0; i < paths.size(); ++i) {
+            wds.add(int(i + 1), paths[i]);
+        }
+        const std::size_t bytes = allocated.load() - before;
+
+        std::size_t total = 0;
+        const std::size_t lookups = 4 * paths.size();
+        const auto start = steady_clock::now();
+        for (std::size_t i = 0; i < lookups; ++i) {
+            // Jump around, so the last lookup doesn't help
+            total += wds.find(int((i * 7919) % paths.size() + 1)).size();
+        }
+        const double seconds = duration<double>(
+                steady_clock::now() - start).count();
+
+        printf("%-8s %8.1f bytes/directory %12.0f finds/s\n", label,
+               double(bytes) / paths.size(), lookups / seconds);
+
+        if (total == 0) printf("(nothing found?)\n");
+    }
+
+} // namespace
+
+void *operator new(std::size_t size)
+{
+    if (void *p = malloc(size)) {
+        allocated += malloc_usable_size(p);
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+// Kept out of line, or GCC sees free() on memory from operator new and
+// complains
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    if (p) allocated -= malloc_usable_size(p);
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, std::size_t) noexcept
+{
+    if (p) allocated -= malloc_usable_size(p);
+    free(p);
+}
+
+int main(int argc, char *argv[])
+{
+    const std::size_t count = (argc > 1) ? strtoull(argv[1], nullptr, 10)
+                                         : 1000000;
+
+    const auto paths = make_paths(count);
+
+    std::size_t bytes = 0;
+    for (const auto &path : paths) bytes += path.size();
+    printf("%zu directories, %.1f bytes of path each\n",
+           paths.size(), double(bytes) / paths.size());
+
+    // Small searches linearly, so it would take all day
+    if (paths.size() <= 20000) run<Watch::Small>("Small", paths);
+    run<Watch::Large>("Large", paths);
+    run<Watch::Flat>("Flat", paths);
+    run<Watch::Compact>("Compact", paths);
+
+    return 0;
+}
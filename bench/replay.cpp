@@ -0,0 +1,124 @@
+// How fast recorded events go through dispatch and into callbacks, with
+// the filesystem and the kernel out of the picture. Replays a log made by
+// Sentry::record() as fast as it can, a few times over.
+//
+// Usage: bench_replay [log] [rounds]
+//
+// Without a log, records one first: a few thousand files created,
+// written, renamed and deleted across a small tree under /tmp, along with
+// some directories moving about.
+
+#include <watchdog.hpp>
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+namespace {
+
+    using Pen = Watch::Sentry<Watch::Recursively, Watch::Flags::Add,
+                              Watch::Flat>;
+
+    void remove_tree(const std::string &root)
+    {
+        nftw(root.c_str(), [](const char *fpath, const struct stat *,
+                              int, struct FTW *) {
+                return remove(fpath);
+            }, 64, FTW_DEPTH | FTW_PHYS);
+    }
+
+    void touch(const std::string &path)
+    {
+        const int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC,
+                            0644);
+        if (fd < 0) return;
+        if (write(fd, "x", 1) < 0) {}
+        close(fd);
+    }
+
+    void record(const std::string &path)
+    {
+        char dir[] = "/tmp/watchdog-bench-replay-XXXXXX";
+        if (mkdtemp(dir) == nullptr) {
+            perror("mkdtemp");
+            exit(1);
+        }
+        const std::string root = dir;
+
+        for (int i = 0; i < 8; ++i) {
+            mkdir((root + "/d" + std::to_string(i)).c_str(), 0755);
+        }
+
+        {
+            Watch::Event_Log log(path);
+            Pen pen(root);
+            pen.record(log);
+            pen.add_callback([](const Watch::Event_View&) {},
+                             Watch::On::All);
+
+            for (int round = 0; round < 20; ++round) {
+                const std::string sub = root + "/d"
+                                        + std::to_string(round % 8);
+
+                for (int i = 0; i < 200; ++i) {
+                    const std::string file = sub + "/f" + std::to_string(i);
+                    touch(file);
+                    rename(file.c_str(), (file + ".moved").c_str());
+                    unlink((file + ".moved").c_str());
+                }
+
+                // Something for the recursive side to chew on
+                const std::string made = sub + "/new" + std::to_string(round);
+                mkdir(made.c_str(), 0755);
+                touch(made + "/inside");
+                rename(made.c_str(), (made + ".moved").c_str());
+
+                while (pen.run_once(std::chrono::milliseconds(0))) {}
+            }
+        }
+
+        remove_tree(root);
+    }
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::string path = (argc > 1) ? argv[1] : "";
+    const int rounds = (argc > 2) ? atoi(argv[2]) : 10;
+
+    const bool made = path.empty();
+    if (made) {
+        path = "/tmp/watchdog-bench-replay.log";
+        record(path);
+    }
+
+    Watch::Event_Log_Reader log(path);
+    printf("%s\n", log.root().c_str());
+
+    for (int round = 0; round < rounds; ++round) {
+        std::size_t called = 0;
+
+        Pen pen(log);
+        pen.add_callback([&called](const Watch::Event_View&) {
+                ++called;
+            }, Watch::On::All);
+
+        const auto start = std::chrono::steady_clock::now();
+        const std::size_t events = pen.replay(log);
+        const double seconds = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count();
+
+        printf("  %zu events, %zu calls in %8.3f ms, %10.0f events/s\n",
+               events, called, seconds * 1e3, double(events) / seconds);
+    }
+
+    if (made) unlink(path.c_str());
+    return 0;
+}
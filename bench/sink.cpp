@@ -0,0 +1,135 @@
+// How fast events can be written out, the way src/main.cpp used to do it
+// (get_names(), join_paths() and iostreams) and with Event_Sink, as JSON
+// lines and as TSV. Writes batches of views made by hand, so neither the
+// kernel nor dispatch gets in the way.
+//
+// Usage: bench_sink [events] [output]
+//
+// Writes to /dev/null unless told otherwise.
+
+#include <watchdog.hpp>
+#include <sink.hpp>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace {
+
+    // Count every heap allocation so we can report allocations per event
+    std::atomic<std::size_t> allocations{0};
+
+    const std::size_t per_batch = 256;
+
+    template <class Write>
+    void run(const char *label, std::size_t events,
+             const std::vector<Watch::Event_View> &views, Write write)
+    {
+        using namespace std::chrono;
+
+        const Watch::Event_Batch batch(views.data(), views.size());
+        const std::size_t rounds = events / per_batch;
+
+        // Warm up first
+        for (std::size_t i = 0; i < rounds / 10; ++i) write(batch);
+
+        const std::size_t before = allocations.load();
+        const auto start = steady_clock::now();
+
+        for (std::size_t i = 0; i < rounds; ++i) write(batch);
+
+        const double seconds = duration<double>(
+                steady_clock::now() - start).count();
+        const std::size_t allocated = allocations.load() - before;
+        const std::size_t total = rounds * per_batch;
+
+        printf("%-12s %12.0f events/s %8.3f allocations/event\n",
+               label, total / seconds, double(allocated) / total);
+    }
+
+} // namespace
+
+void *operator new(std::size_t size)
+{
+    ++allocations;
+    if (void *p = malloc(size)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    free(p);
+}
+
+int main(int argc, char *argv[])
+{
+    const std::size_t events = (argc > 1) ? strtoull(argv[1], nullptr, 10)
+                                          : 2000000;
+    const char *output = (argc > 2) ? argv[2] : "/dev/null";
+
+    const int fd = open(output, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                        0644);
+    if (fd < 0) {
+        perror(output);
+        return 1;
+    }
+
+    const std::string dir = "/home/someone/projects/watchdog/src/deeper";
+    std::vector<std::string> names;
+    for (std::size_t i = 0; i < per_batch; ++i) {
+        names.push_back("some-file-" + std::to_string(i) + ".txt");
+    }
+
+    std::vector<Watch::Event_View> views;
+    for (std::size_t i = 0; i < per_batch; ++i) {
+        const uint32_t mask = (i % 3 == 0)
+            ? (Watch::On::Create | Watch::Reply::Is_Directory)
+            : Watch::On::Modify;
+        views.push_back(Watch::Event_View{ 1, mask, 0, names[i], dir });
+    }
+
+    printf("Writing %zu events to %s\n", events, output);
+
+    {
+        std::ofstream out(output);
+        run("iostream", events, views,
+            [&out](const Watch::Event_Batch &batch) {
+                for (const auto &ev : batch) {
+                    auto flags = Watch::Flags::get_names(ev.mask,
+                            Watch::Flags::Names::All);
+                    out << Watch::join_paths(std::string(ev.path),
+                                             std::string(ev.name)) << "\n";
+                    for (const auto &name : flags) out << name << "\n";
+                }
+                out.flush();
+            });
+    }
+
+    Watch::Sink_Options options;
+    {
+        Watch::Event_Sink sink(fd, options);
+        run("JSON lines", events, views, sink.batch_callback());
+    }
+
+    options.format = Watch::Sink_Format::TSV;
+    {
+        Watch::Event_Sink sink(fd, options);
+        run("TSV", events, views, sink.batch_callback());
+    }
+
+    close(fd);
+    return 0;
+}
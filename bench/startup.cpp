@@ -0,0 +1,154 @@
+// How long it takes a Watch::Pen to get going on a big tree: crawling it,
+// then registering a few callbacks, either one at a time or held and
+// attached in one pass. Then the same, leaving everything below the top two
+// levels to be watched in the background.
+//
+// Usage: bench_startup [directories...]
+//
+// Generates a tree of each size under /tmp (10000 and 100000 directories by
+// default), and removes it afterwards. Sizes over the inotify watch limit
+// (fs.inotify.max_user_watches) are skipped.
+
+#include <watchdog.hpp>
+
+#include <ftw.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+    using Pen = Watch::Sentry<Watch::Recursively, Watch::Flags::Add,
+                              Watch::Flat>;
+
+    // Breadth first, so the tree stays shallow
+    void generate(const std::string &root, std::size_t directories)
+    {
+        std::deque<std::string> parents(1, root);
+        std::size_t made = 1;
+
+        while (made < directories) {
+            const std::string parent = parents.front();
+            parents.pop_front();
+
+            for (int i = 0; i < 16 && made < directories; ++i, ++made) {
+                std::string sub = parent + "/d" + std::to_string(i);
+                mkdir(sub.c_str(), 0755);
+                parents.push_back(sub);
+            }
+        }
+    }
+
+    void remove_tree(const std::string &root)
+    {
+        nftw(root.c_str(), [](const char *fpath, const struct stat *,
+                              int, struct FTW *) {
+                return remove(fpath);
+            }, 64, FTW_DEPTH | FTW_PHYS);
+    }
+
+    std::size_t watch_limit()
+    {
+        std::ifstream in("/proc/sys/fs/inotify/max_user_watches");
+        std::size_t limit = SIZE_MAX;
+        in >> limit;
+        return limit;
+    }
+
+    double ms_since(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+    }
+
+    // A few callbacks that each want something different, as most
+    // programs have
+    template <class Register>
+    void add_callbacks(Register reg)
+    {
+        reg(Watch::On::Create);
+        reg(Watch::On::Modify);
+        reg(Watch::On::Delete);
+        reg(Watch::On::Move);
+        reg(Watch::On::Modify);
+    }
+
+    void measure(const std::string &root, bool hold, bool lazy = false)
+    {
+        Watch::Attach_Options attach;
+        if (lazy) attach.hot_depth = 2;
+
+        auto start = std::chrono::steady_clock::now();
+        Pen pen(root, Watch::Ignore_Rules(), attach);
+        const double crawl = ms_since(start);
+
+        start = std::chrono::steady_clock::now();
+        if (hold) pen.hold_watches();
+        add_callbacks([&pen](Watch::FlagBearer flags) {
+                pen.add_callback([](const Watch::Event_View&) {}, flags);
+            });
+        if (hold) pen.attach_watches();
+        const double attach_ms = ms_since(start);
+
+        if (!lazy) {
+            printf("  %-10s crawl %10.1f ms   callbacks %10.1f ms\n",
+                   hold ? "held" : "one by one", crawl, attach_ms);
+            return;
+        }
+
+        auto attached = pen.attached();
+        while (attached.wait_for(std::chrono::seconds(0))
+                != std::future_status::ready) {
+            pen.run_once(std::chrono::milliseconds(10));
+        }
+        const double rest = ms_since(start);
+
+        printf("  %-10s crawl %10.1f ms   callbacks %10.1f ms   "
+               "the rest %10.1f ms\n", "lazy", crawl, attach_ms, rest);
+    }
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::size_t> sizes;
+    for (int i = 1; i < argc; ++i) sizes.push_back(strtoul(argv[i], 0, 10));
+    if (sizes.empty()) sizes = { 10000, 100000 };
+
+    const std::size_t limit = watch_limit();
+
+    for (const std::size_t size : sizes) {
+        if (size > limit) {
+            printf("%zu directories: skipped, over the watch limit of %zu\n",
+                   size, limit);
+            continue;
+        }
+
+        char dir[] = "/tmp/watchdog-bench-startup-XXXXXX";
+        if (mkdtemp(dir) == nullptr) {
+            perror("mkdtemp");
+            return 1;
+        }
+
+        generate(dir, size);
+        printf("%zu directories\n", size);
+
+        try {
+            measure(dir, false);
+            measure(dir, true);
+            measure(dir, true, true);
+        } catch (const Watch::Exception &e) {
+            printf("  failed: %s\n", e.what());
+        }
+
+        remove_tree(dir);
+    }
+
+    return 0;
+}
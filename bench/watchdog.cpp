@@ -0,0 +1,480 @@
+// End to end: builds a tree on tmpfs, watches it, and has a few threads
+// create, modify, rename and delete files in it while we listen. For each
+// kind of Sentry (Dog and Pen, each with Small and Large containers) it
+// measures
+//
+//   construct   how long the crawl and attaching every watch take, and
+//               how much resident memory that costs
+//   latency     how long after a change its event is handed to a callback,
+//               with the churn paced at `rate` changes per second per thread
+//   throughput  events per second with the churn going flat out, until the
+//               time is up or the kernel's queue overflows
+//
+// Dog only watches the root, so that's where its churn happens. Pen churns
+// all over the tree.
+//
+// Results are printed one JSON object per line, so they can be collected
+// and compared between runs.
+//
+// Usage: watchdog_bench [name=value...]
+//
+//   root=/dev/shm  where to build the tree (falls back to /tmp)
+//   depth=3        levels of directories below the root
+//   fanout=8       subdirectories in each directory
+//   files=4        files in each directory
+//   threads=2      threads making changes
+//   rate=2000      changes per second per thread while measuring latency
+//   seconds=2      how long each latency and throughput run lasts
+
+#include <watchdog.hpp>
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Config {
+        std::string root = "/dev/shm";
+        std::size_t depth = 3;
+        std::size_t fanout = 8;
+        std::size_t files = 4;
+        std::size_t threads = 2;
+        std::size_t rate = 2000;
+        double seconds = 2;
+    };
+
+    // Each change is four operations on one file: create it, write to it,
+    // rename it, and delete it
+    enum Op { Created, Modified, Renamed, Deleted, ops };
+
+    int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                Clock::now().time_since_epoch()).count();
+    }
+
+    // In kilobytes, from /proc
+    std::size_t status_kb(const char *field)
+    {
+        std::ifstream in("/proc/self/status");
+        std::string line;
+        const std::size_t length = strlen(field);
+
+        while (std::getline(in, line)) {
+            if (line.compare(0, length, field) == 0) {
+                return strtoul(line.c_str() + length + 1, nullptr, 10);
+            }
+        }
+        return 0;
+    }
+
+    void remove_tree(const std::string &root)
+    {
+        nftw(root.c_str(), [](const char *fpath, const struct stat *,
+                              int, struct FTW *) {
+                return remove(fpath);
+            }, 64, FTW_DEPTH | FTW_PHYS);
+    }
+
+    // Returns every directory made, root first
+    std::vector<std::string> generate(const std::string &root,
+                                      const Config &config)
+    {
+        std::vector<std::string> dirs(1, root);
+        std::size_t level_start = 0;
+
+        for (std::size_t level = 0; level < config.depth; ++level) {
+            const std::size_t level_end = dirs.size();
+            for (std::size_t i = level_start; i < level_end; ++i) {
+                for (std::size_t j = 0; j < config.fanout; ++j) {
+                    std::string sub = dirs[i] + "/d" + std::to_string(j);
+                    mkdir(sub.c_str(), 0755);
+                    dirs.push_back(std::move(sub));
+                }
+            }
+            level_start = level_end;
+        }
+
+        for (const auto &dir : dirs) {
+            for (std::size_t j = 0; j < config.files; ++j) {
+                std::ofstream(dir + "/f" + std::to_string(j)) << "x";
+            }
+        }
+
+        return dirs;
+    }
+
+    // When each operation started, by thread. Written by the thread doing
+    // it, and read by the one handling its event.
+    class Stamps {
+        public:
+            Stamps(std::size_t threads, std::size_t changes)
+                : changes_(changes)
+            {
+                for (std::size_t i = 0; i < threads; ++i) {
+                    stamps_.emplace_back(
+                            new std::atomic<int64_t>[changes * ops]());
+                }
+            }
+
+            std::size_t changes() const
+            {
+                return changes_;
+            }
+
+            void mark(std::size_t thread, std::size_t change, Op op)
+            {
+                stamps_[thread][change * ops + op].store(
+                        now_ns(), std::memory_order_release);
+            }
+
+            int64_t when(std::size_t thread, std::size_t change, Op op) const
+            {
+                if (thread >= stamps_.size() || change >= changes_) return 0;
+                return stamps_[thread][change * ops + op].load(
+                        std::memory_order_acquire);
+            }
+
+        private:
+            std::size_t changes_;
+            std::vector< std::unique_ptr<std::atomic<int64_t>[]> > stamps_;
+    };
+
+    // Files are named c<thread>_<change> until renamed to r<thread>_<change>
+    std::string name_of(char prefix, std::size_t thread, std::size_t change)
+    {
+        return prefix + std::to_string(thread) + "_" + std::to_string(change);
+    }
+
+    bool parse_name(std::string_view name, char &prefix, std::size_t &thread,
+                    std::size_t &change)
+    {
+        if (name.size() < 4) return false;
+
+        const std::string copy(name);
+        char *end = nullptr;
+        prefix = copy[0];
+        thread = strtoul(copy.c_str() + 1, &end, 10);
+        if (*end != '_') return false;
+        change = strtoul(end + 1, &end, 10);
+        return *end == '\0';
+    }
+
+    void churn(std::size_t thread, const std::vector<std::string> &dirs,
+               Stamps *stamps, std::size_t rate, Clock::time_point until,
+               std::atomic<bool> &stop)
+    {
+        const auto interval = rate
+            ? std::chrono::nanoseconds(1000000000 / rate)
+            : std::chrono::nanoseconds(0);
+        auto next = Clock::now();
+
+        for (std::size_t change = 0; !stop.load(); ++change) {
+            if (Clock::now() >= until) break;
+            if (stamps && change >= stamps->changes()) break;
+
+            const std::string &dir = dirs[(change * 7 + thread) % dirs.size()];
+            const std::string from = dir + "/" + name_of('c', thread, change);
+            const std::string to = dir + "/" + name_of('r', thread, change);
+
+            if (stamps) stamps->mark(thread, change, Created);
+            int fd = open(from.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC, 0644);
+            if (fd < 0) continue;
+
+            if (stamps) stamps->mark(thread, change, Modified);
+            if (write(fd, "churn", 5) < 0) {}
+            close(fd);
+
+            if (stamps) stamps->mark(thread, change, Renamed);
+            rename(from.c_str(), to.c_str());
+
+            if (stamps) stamps->mark(thread, change, Deleted);
+            unlink(to.c_str());
+
+            if (interval.count()) {
+                next += interval;
+                std::this_thread::sleep_until(next);
+            }
+        }
+    }
+
+    int64_t percentile(const std::vector<int64_t> &sorted, double q)
+    {
+        if (sorted.empty()) return 0;
+        std::size_t at = std::size_t(q * double(sorted.size() - 1) + 0.5);
+        return sorted[std::min(at, sorted.size() - 1)];
+    }
+
+    template <class Sentry_>
+    class Run {
+        public:
+            Run(const char *sentry, const char *container,
+                const Config &config, const std::string &root,
+                const std::vector<std::string> &dirs)
+                : sentry_(sentry), container_(container), config_(config),
+                  root_(root)
+            {
+                // Dog only hears about the root
+                if (std::string(sentry) == "Dog") {
+                    churn_dirs_.push_back(root);
+                } else {
+                    churn_dirs_ = dirs;
+                }
+                directories_ = dirs.size();
+            }
+
+            void construct()
+            {
+                const std::size_t rss = status_kb("VmRSS:");
+                const auto start = Clock::now();
+
+                {
+                    Sentry_ watcher(root_);
+                    watcher.add_callback([](const Watch::Event_View&) {},
+                                         Watch::On::All);
+                    const double ms = ms_since(start);
+                    const std::size_t grown = status_kb("VmRSS:") - rss;
+
+                    printf("{%s,\"bench\":\"construct\",\"ms\":%.3f,"
+                           "\"rss_kb\":%zu,\"rss_growth_kb\":%zu}\n",
+                           common_().c_str(), ms, status_kb("VmRSS:"),
+                           grown);
+                }
+            }
+
+            void latency()
+            {
+                const std::size_t changes = std::size_t(
+                        config_.seconds * double(config_.rate)) + 1;
+                Stamps stamps(config_.threads, changes);
+
+                std::vector<int64_t> by_op[ops];
+                std::size_t events = 0;
+
+                Sentry_ watcher(root_);
+                watcher.add_callback([&](const Watch::Event_View &ev) {
+                        const int64_t now = now_ns();
+                        ++events;
+
+                        char prefix;
+                        std::size_t thread, change;
+                        if (!parse_name(ev.name, prefix, thread, change)) {
+                            return;
+                        }
+
+                        Op op;
+                        if (ev.mask & IN_CREATE) op = Created;
+                        else if (ev.mask & IN_MODIFY) op = Modified;
+                        else if (ev.mask & IN_MOVED_TO) op = Renamed;
+                        else if (ev.mask & IN_DELETE) op = Deleted;
+                        else return;
+
+                        const int64_t then = stamps.when(thread, change, op);
+                        if (then != 0) by_op[op].push_back(now - then);
+                    }, flags_);
+
+                bool overflowed = drive_(watcher, &stamps, config_.rate);
+
+                static const char *names[ops] = {
+                    "create", "modify", "rename", "delete"
+                };
+
+                std::vector<int64_t> all;
+                for (int op = 0; op < ops; ++op) {
+                    all.insert(all.end(), by_op[op].begin(), by_op[op].end());
+                }
+
+                for (int op = -1; op < ops; ++op) {
+                    std::vector<int64_t> &got = (op < 0) ? all : by_op[op];
+                    std::sort(got.begin(), got.end());
+
+                    printf("{%s,\"bench\":\"latency\",\"op\":\"%s\","
+                           "\"rate\":%zu,\"events\":%zu,\"samples\":%zu,"
+                           "\"overflowed\":%s,\"p50_us\":%.1f,"
+                           "\"p90_us\":%.1f,\"p99_us\":%.1f,"
+                           "\"p999_us\":%.1f,\"max_us\":%.1f}\n",
+                           common_().c_str(), (op < 0) ? "all" : names[op],
+                           config_.rate * config_.threads, events,
+                           got.size(), overflowed ? "true" : "false",
+                           percentile(got, 0.5) / 1e3,
+                           percentile(got, 0.9) / 1e3,
+                           percentile(got, 0.99) / 1e3,
+                           percentile(got, 0.999) / 1e3,
+                           got.empty() ? 0.0 : got.back() / 1e3);
+                }
+            }
+
+            void throughput()
+            {
+                std::size_t events = 0;
+
+                Sentry_ watcher(root_);
+                watcher.add_callback([&events](const Watch::Event_View&) {
+                        ++events;
+                    }, flags_);
+
+                const auto start = Clock::now();
+                const bool overflowed = drive_(watcher, nullptr, 0);
+                const double seconds = ms_since(start) / 1e3;
+
+                printf("{%s,\"bench\":\"throughput\",\"events\":%zu,"
+                       "\"seconds\":%.3f,\"events_per_s\":%.0f,"
+                       "\"overflowed\":%s,\"rss_kb\":%zu}\n",
+                       common_().c_str(), events, seconds,
+                       double(events) / seconds,
+                       overflowed ? "true" : "false", status_kb("VmRSS:"));
+            }
+
+        private:
+            static double ms_since(Clock::time_point start)
+            {
+                return std::chrono::duration<double, std::milli>(
+                        Clock::now() - start).count();
+            }
+
+            std::string common_() const
+            {
+                char out[256];
+                snprintf(out, sizeof(out), "\"sentry\":\"%s\","
+                         "\"container\":\"%s\",\"directories\":%zu,"
+                         "\"files\":%zu,\"threads\":%zu",
+                         sentry_, container_, directories_,
+                         directories_ * config_.files, config_.threads);
+                return out;
+            }
+
+            // Listens while the churn threads run. Returns whether the
+            // kernel's queue overflowed before they were done.
+            bool drive_(Sentry_ &watcher, Stamps *stamps, std::size_t rate)
+            {
+                std::atomic<bool> stop{false};
+                const auto until = Clock::now()
+                    + std::chrono::duration_cast<Clock::duration>(
+                            std::chrono::duration<double>(config_.seconds));
+
+                std::vector<std::thread> threads;
+                for (std::size_t i = 0; i < config_.threads; ++i) {
+                    threads.emplace_back(churn, i, std::cref(churn_dirs_),
+                                         stamps, rate, until,
+                                         std::ref(stop));
+                }
+
+                bool overflowed = false;
+                try {
+                    watcher.run_until(until);
+                    // Whatever is still queued
+                    while (watcher.run_once(std::chrono::milliseconds(50))) {}
+                } catch (const Watch::Exception &) {
+                    overflowed = true;
+                }
+
+                stop = true;
+                for (auto &thread : threads) thread.join();
+
+                return overflowed;
+            }
+
+            static constexpr uint32_t flags_ = IN_CREATE | IN_MODIFY
+                | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE;
+
+            const char *sentry_;
+            const char *container_;
+            const Config &config_;
+            std::string root_;
+            std::vector<std::string> churn_dirs_;
+            std::size_t directories_ = 0;
+    };
+
+    template <Watch::Recurse R, class Container>
+    void run(const char *sentry, const char *container, const Config &config,
+             const std::string &root, const std::vector<std::string> &dirs)
+    {
+        using Sentry_ = Watch::Sentry<R, Watch::Flags::Add, Container>;
+
+        try {
+            Run<Sentry_> bench(sentry, container, config, root, dirs);
+            bench.construct();
+            bench.latency();
+            bench.throughput();
+        } catch (const Watch::Exception &e) {
+            printf("{\"sentry\":\"%s\",\"container\":\"%s\","
+                   "\"error\":\"%s\"}\n", sentry, container, e.what());
+        }
+        fflush(stdout);
+    }
+
+    bool parse(int argc, char *argv[], Config &config)
+    {
+        for (int i = 1; i < argc; ++i) {
+            const char *eq = strchr(argv[i], '=');
+            if (eq == nullptr) return false;
+
+            const std::string name(argv[i], eq - argv[i]);
+            const char *value = eq + 1;
+
+            if (name == "root") config.root = value;
+            else if (name == "depth") config.depth = strtoul(value, 0, 10);
+            else if (name == "fanout") config.fanout = strtoul(value, 0, 10);
+            else if (name == "files") config.files = strtoul(value, 0, 10);
+            else if (name == "threads") config.threads = strtoul(value, 0, 10);
+            else if (name == "rate") config.rate = strtoul(value, 0, 10);
+            else if (name == "seconds") config.seconds = strtod(value, 0);
+            else return false;
+        }
+
+        if (config.threads == 0) config.threads = 1;
+        if (config.rate == 0) config.rate = 1;
+        return true;
+    }
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Config config;
+    if (!parse(argc, argv, config)) {
+        fprintf(stderr, "Usage: %s [root=DIR] [depth=N] [fanout=N] "
+                "[files=N] [threads=N] [rate=N] [seconds=S]\n", argv[0]);
+        return 2;
+    }
+
+    struct stat sb;
+    if (stat(config.root.c_str(), &sb) != 0 || !S_ISDIR(sb.st_mode)) {
+        config.root = "/tmp";
+    }
+
+    std::string dir = config.root + "/watchdog-bench-XXXXXX";
+    if (mkdtemp(&dir[0]) == nullptr) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    const std::vector<std::string> dirs = generate(dir, config);
+
+    run<Watch::Normally, Watch::Small>("Dog", "Small", config, dir, dirs);
+    run<Watch::Normally, Watch::Large>("Dog", "Large", config, dir, dirs);
+    run<Watch::Recursively, Watch::Small>("Pen", "Small", config, dir, dirs);
+    run<Watch::Recursively, Watch::Large>("Pen", "Large", config, dir, dirs);
+
+    printf("{\"bench\":\"peak\",\"rss_kb\":%zu}\n", status_kb("VmHWM:"));
+
+    remove_tree(dir);
+    return 0;
+}
@@ -0,0 +1,247 @@
+#ifndef WATCHDOG_BUFFER_POOL_H
+#define WATCHDOG_BUFFER_POOL_H
+
+#include <limits.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+
+#include <cstddef>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace Watch {
+
+    struct Buffer_Pool_Stats {
+        // Buffers handed out, and how many of those were recycled
+        std::size_t leased = 0;
+        std::size_t reused = 0;
+        // Bytes handed out right now, and sitting in the pool
+        std::size_t outstanding = 0;
+        std::size_t cached = 0;
+    };
+
+    // Read buffers, shared between any number of watchers. Sizes are
+    // rounded up to powers of two, and each size keeps a few buffers around
+    // for the next watcher that wants one, so watchers only hold on to a
+    // buffer while they're actually reading.
+    class Buffer_Pool {
+        public:
+            // Handed back to the pool when it goes away
+            class Lease {
+                public:
+                    Lease() = default;
+
+                    Lease(Lease &&other) noexcept
+                        : pool_(other.pool_), data_(other.data_),
+                          size_(other.size_)
+                    {
+                        other.pool_ = nullptr;
+                        other.data_ = nullptr;
+                        other.size_ = 0;
+                    }
+
+                    Lease& operator=(Lease &&other) noexcept
+                    {
+                        if (this != &other) {
+                            release();
+                            std::swap(pool_, other.pool_);
+                            std::swap(data_, other.data_);
+                            std::swap(size_, other.size_);
+                        }
+                        return *this;
+                    }
+
+                    Lease(const Lease &src) = delete;
+                    Lease& operator=(const Lease &src) = delete;
+
+                    ~Lease()
+                    {
+                        release();
+                    }
+
+                    char *data() const { return data_; }
+                    std::size_t size() const { return size_; }
+                    explicit operator bool() const { return data_; }
+
+                    void release()
+                    {
+                        if (pool_) pool_->give_back(data_, size_);
+                        pool_ = nullptr;
+                        data_ = nullptr;
+                        size_ = 0;
+                    }
+
+                private:
+                    friend class Buffer_Pool;
+
+                    Lease(Buffer_Pool *pool, char *data, std::size_t size)
+                        : pool_(pool), data_(data), size_(size)
+                    {}
+
+                    Buffer_Pool *pool_ = nullptr;
+                    char *data_ = nullptr;
+                    std::size_t size_ = 0;
+            };
+
+            // Don't allow assignment or copying
+            Buffer_Pool(const Buffer_Pool &src) = delete;
+            Buffer_Pool& operator=(const Buffer_Pool &src) = delete;
+
+            // How many buffers of each size to keep around
+            explicit Buffer_Pool(std::size_t keep = 4)
+                : keep_(keep)
+            {}
+
+            ~Buffer_Pool()
+            {
+                for (auto &buffers : free_) {
+                    for (char *buffer : buffers) delete[] buffer;
+                }
+            }
+
+            // The one everybody shares unless told otherwise
+            static Buffer_Pool &shared()
+            {
+                static Buffer_Pool pool;
+                return pool;
+            }
+
+            // At least `size` bytes, and never less than enough for the
+            // biggest single event
+            Lease lease(std::size_t size)
+            {
+                const std::size_t cls = size_class(size);
+                const std::size_t bytes = smallest << cls;
+
+                char *buffer = nullptr;
+                {
+                    std::lock_guard<std::mutex> lock(m_);
+                    ++stats_.leased;
+                    stats_.outstanding += bytes;
+
+                    if (!free_[cls].empty()) {
+                        buffer = free_[cls].back();
+                        free_[cls].pop_back();
+                        stats_.cached -= bytes;
+                        ++stats_.reused;
+                    }
+                }
+
+                if (buffer == nullptr) buffer = new char[bytes];
+
+                return Lease(this, buffer, bytes);
+            }
+
+            Buffer_Pool_Stats stats() const
+            {
+                std::lock_guard<std::mutex> lock(m_);
+                return stats_;
+            }
+
+            // Sizes are powers of two from here up to `largest`
+            enum : std::size_t {
+                smallest = 4096,
+                largest = std::size_t(4) << 20,
+                classes = 11,
+            };
+
+            static std::size_t round_up(std::size_t size)
+            {
+                return std::size_t(smallest) << size_class(size);
+            }
+
+        private:
+            static std::size_t size_class(std::size_t size)
+            {
+                std::size_t cls = 0;
+                while (cls + 1 < classes && (smallest << cls) < size) ++cls;
+                return cls;
+            }
+
+            void give_back(char *buffer, std::size_t bytes)
+            {
+                const std::size_t cls = size_class(bytes);
+
+                {
+                    std::lock_guard<std::mutex> lock(m_);
+                    stats_.outstanding -= bytes;
+
+                    if (free_[cls].size() < keep_) {
+                        free_[cls].push_back(buffer);
+                        stats_.cached += bytes;
+                        return;
+                    }
+                }
+
+                delete[] buffer;
+            }
+
+            std::size_t keep_;
+
+            mutable std::mutex m_;
+            std::vector<char*> free_[classes];
+            Buffer_Pool_Stats stats_;
+    };
+
+    // Picks how much to read() next. Starts from what the kernel says is
+    // waiting (FIONREAD), and otherwise from a moving average of recent
+    // reads, so that busy watchers get big buffers and fewer syscalls while
+    // quiet ones stick to small ones.
+    class Read_Sizer {
+        public:
+            Read_Sizer(std::size_t smallest = Buffer_Pool::smallest,
+                       std::size_t largest = 256 * 1024)
+            {
+                limits(smallest, largest);
+            }
+
+            void limits(std::size_t smallest, std::size_t largest)
+            {
+                // Anything less and read() can refuse to return an event
+                const std::size_t one = sizeof(inotify_event) + NAME_MAX + 1;
+
+                smallest_ = std::max(smallest, one);
+                largest_ = std::max(largest, smallest_);
+            }
+
+            // How much to ask for, given what's waiting on `fd`. 0 if the
+            // kernel says there's nothing.
+            std::size_t want(int fd) const
+            {
+                int pending = 0;
+                if (ioctl(fd, FIONREAD, &pending) < 0) pending = -1;
+                if (pending == 0) return 0;
+
+                // Room for what's there, or for a typical burst if we
+                // couldn't find out
+                std::size_t size = (pending > 0)
+                    ? std::size_t(pending)
+                    : 2 * average_;
+                size = std::max(size, 2 * average_);
+
+                return std::min(std::max(size, smallest_), largest_);
+            }
+
+            void observe(std::size_t bytes)
+            {
+                // An eighth of the way to the latest read each time
+                average_ = average_ - average_ / 8 + bytes / 8;
+            }
+
+            std::size_t average() const
+            {
+                return average_;
+            }
+
+        private:
+            std::size_t smallest_;
+            std::size_t largest_;
+            std::size_t average_ = 0;
+    };
+
+} // namespace Watch
+
+#endif
@@ -0,0 +1,384 @@
+#ifndef WATCHDOG_COALESCE_H
+#define WATCHDOG_COALESCE_H
+
+#include <limits.h>
+#include <sys/inotify.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <exceptions.hpp>
+#include <poller.hpp>
+
+namespace Watch {
+
+    struct Coalesce_Options {
+        // Hand over a merged event once nothing new has happened to its
+        // file for this long...
+        std::chrono::milliseconds quiet{50};
+        // ...or once it has been held this long, whichever comes first
+        std::chrono::milliseconds max_latency{500};
+        // Most files we'll hold events for at once. Past that, events go
+        // straight through.
+        std::size_t capacity = 4096;
+        // Which events may be held and merged. Everything else goes straight
+        // through (after whatever we were holding for the same file).
+        // Close_Write ends a burst, so it's merged and handed over at once.
+        uint32_t mergeable = IN_CREATE | IN_MODIFY | IN_ATTRIB | IN_ACCESS
+                           | IN_OPEN | IN_CLOSE_NOWRITE | IN_CLOSE_WRITE;
+    };
+
+    struct Coalesce_Stats {
+        // Raw events we were given
+        std::size_t received = 0;
+        // Raw events that were folded into one we were already holding
+        std::size_t collapsed = 0;
+        // Merged events handed over
+        std::size_t flushed = 0;
+        // Events handed over untouched
+        std::size_t passed = 0;
+        // Events that went straight through because we were full
+        std::size_t full = 0;
+    };
+
+    // Holds on to bursts of events about the same file, OR-ing their masks
+    // together, and hands over one event per burst.
+    //
+    // Files are looked up in a fixed size open addressing table, and the
+    // deadlines live on a timer wheel, so nothing is allocated once we're
+    // set up and nothing costs more than the events it's handling.
+    class Coalescer {
+        public:
+            explicit Coalescer(const Coalesce_Options &options)
+                : options_(options), origin_(Clock::now())
+            {
+                if (options_.capacity == 0) {
+                    throw Exception("Coalescer needs room for something");
+                }
+
+                // Ticks small enough to hit the quiet window reasonably well
+                tick_ = std::max<Clock::duration>(
+                        std::chrono::milliseconds(1), options_.quiet / 8);
+
+                entries_.resize(options_.capacity);
+                for (std::size_t i = entries_.size(); i > 0; --i) {
+                    free_.push_back(static_cast<uint32_t>(i - 1));
+                }
+
+                std::size_t slots = 1;
+                while (slots < options_.capacity * 2) slots <<= 1;
+                table_.assign(slots, none);
+
+                wheel_.assign(wheel_slots, none);
+            }
+
+            // emit(Event*) is called for everything that's ready to go,
+            // which may or may not include `ev`
+            template <class Emit>
+            void push(inotify_event *ev, Clock::time_point now, Emit emit)
+            {
+                ++stats_.received;
+
+                const std::size_t length = strnlen(ev->name, ev->len);
+                const uint64_t hash = hash_of(ev->wd, ev->name, length);
+                std::size_t slot = find(ev->wd, ev->name, length, hash);
+                const uint32_t held = table_[slot];
+
+                const bool mergeable = (ev->mask & options_.mergeable)
+                    && (ev->mask & ~options_.mergeable) == 0;
+
+                if (!mergeable) {
+                    // Don't let anything get ahead of what we're holding
+                    if (ev->mask & (IN_IGNORED | IN_Q_OVERFLOW)) {
+                        flush_matching(ev->wd,
+                                (ev->mask & IN_Q_OVERFLOW) != 0, emit);
+                    } else if (held != none) {
+                        flush(held, emit);
+                    }
+
+                    ++stats_.passed;
+                    emit(ev);
+                    return;
+                }
+
+                if (held != none) {
+                    Entry &entry = entries_[held];
+                    entry.mask |= ev->mask;
+                    ++stats_.collapsed;
+
+                    if (ev->mask & IN_CLOSE_WRITE) {
+                        flush(held, emit);
+                    } else {
+                        schedule(held, now);
+                    }
+                    return;
+                }
+
+                // Nothing to merge a lone Close_Write with
+                if ((ev->mask & IN_CLOSE_WRITE) || free_.empty()) {
+                    if (!(ev->mask & IN_CLOSE_WRITE)) ++stats_.full;
+                    ++stats_.passed;
+                    emit(ev);
+                    return;
+                }
+
+                const uint32_t index = free_.back();
+                free_.pop_back();
+
+                Entry &entry = entries_[index];
+                entry.wd = ev->wd;
+                entry.mask = ev->mask;
+                entry.cookie = ev->cookie;
+                entry.length = static_cast<uint16_t>(length);
+                entry.hash = hash;
+                entry.first = now;
+                memcpy(entry.name, ev->name, length);
+                entry.name[length] = '\0';
+
+                table_[slot] = index;
+                schedule(index, now);
+            }
+
+            // Hand over everything whose time has come
+            template <class Emit>
+            void expire(Clock::time_point now, Emit emit)
+            {
+                const int64_t now_tick = ticks(now);
+                if (now_tick < current_tick_) return;
+
+                // No need to go around more than once
+                const int64_t last = std::min<int64_t>(now_tick,
+                        current_tick_ + wheel_slots - 1);
+
+                for (int64_t t = current_tick_; t <= last; ++t) {
+                    uint32_t i = wheel_[t & (wheel_slots - 1)];
+                    while (i != none) {
+                        const uint32_t next = entries_[i].next;
+                        if (entries_[i].due_tick <= now_tick) flush(i, emit);
+                        i = next;
+                    }
+                }
+
+                current_tick_ = now_tick + 1;
+            }
+
+            // Hand over everything we're holding
+            template <class Emit>
+            void flush_all(Emit emit)
+            {
+                for (uint32_t i = 0; i < entries_.size(); ++i) {
+                    if (entries_[i].held) flush(i, emit);
+                }
+            }
+
+            // When expire() next needs to be called, or
+            // Clock::time_point::max() if we're not holding anything
+            Clock::time_point next_deadline() const
+            {
+                if (free_.size() == entries_.size()) {
+                    return Clock::time_point::max();
+                }
+
+                int64_t soonest = current_tick_ + wheel_slots;
+                for (int64_t t = current_tick_;
+                        t < current_tick_ + wheel_slots; ++t) {
+                    for (uint32_t i = wheel_[t & (wheel_slots - 1)];
+                            i != none; i = entries_[i].next) {
+                        soonest = std::min(soonest, entries_[i].due_tick);
+                    }
+                    if (soonest <= t) break;
+                }
+
+                return origin_ + tick_ * soonest;
+            }
+
+            std::size_t held() const
+            {
+                return entries_.size() - free_.size();
+            }
+
+            const Coalesce_Stats &stats() const
+            {
+                return stats_;
+            }
+
+        private:
+            enum : uint32_t { none = UINT32_MAX };
+            enum : int64_t { wheel_slots = 256 };
+
+            struct Entry {
+                int wd = -1;
+                uint32_t mask = 0;
+                uint32_t cookie = 0;
+                uint16_t length = 0;
+                bool held = false;
+                uint64_t hash = 0;
+                Clock::time_point first;
+                int64_t due_tick = 0;
+                // Neighbors in the same wheel slot
+                uint32_t prev = none;
+                uint32_t next = none;
+                char name[NAME_MAX + 1];
+            };
+
+            static uint64_t hash_of(int wd, const char *name,
+                                    std::size_t length)
+            {
+                // FNV-1a
+                uint64_t hash = 14695981039346656037ull
+                              ^ static_cast<uint32_t>(wd);
+                for (std::size_t i = 0; i < length; ++i) {
+                    hash = (hash ^ static_cast<unsigned char>(name[i]))
+                         * 1099511628211ull;
+                }
+                return hash;
+            }
+
+            // Either the slot holding this file, or the empty slot where it
+            // would go
+            std::size_t find(int wd, const char *name, std::size_t length,
+                             uint64_t hash) const
+            {
+                const std::size_t mask = table_.size() - 1;
+
+                for (std::size_t i = hash & mask; ; i = (i + 1) & mask) {
+                    const uint32_t index = table_[i];
+                    if (index == none) return i;
+
+                    const Entry &entry = entries_[index];
+                    if (entry.hash == hash && entry.wd == wd
+                            && entry.length == length
+                            && memcmp(entry.name, name, length) == 0) {
+                        return i;
+                    }
+                }
+            }
+
+            int64_t ticks(Clock::time_point when) const
+            {
+                return (when - origin_) / tick_;
+            }
+
+            void schedule(uint32_t index, Clock::time_point now)
+            {
+                Entry &entry = entries_[index];
+                if (entry.held) unlink(index);
+
+                const Clock::time_point due = std::min(
+                        now + options_.quiet,
+                        entry.first + options_.max_latency);
+
+                // Round up, and never into a slot we've already been past
+                entry.due_tick = std::max(
+                        ticks(due + tick_ - Clock::duration(1)),
+                        current_tick_);
+                entry.held = true;
+
+                uint32_t &head = wheel_[entry.due_tick & (wheel_slots - 1)];
+                entry.prev = none;
+                entry.next = head;
+                if (head != none) entries_[head].prev = index;
+                head = index;
+            }
+
+            void unlink(uint32_t index)
+            {
+                Entry &entry = entries_[index];
+
+                if (entry.prev != none) {
+                    entries_[entry.prev].next = entry.next;
+                } else {
+                    wheel_[entry.due_tick & (wheel_slots - 1)] = entry.next;
+                }
+                if (entry.next != none) entries_[entry.next].prev = entry.prev;
+            }
+
+            // Backward shift deletion, like Flat
+            void remove(uint32_t index)
+            {
+                const Entry &entry = entries_[index];
+                const std::size_t mask = table_.size() - 1;
+
+                std::size_t hole = find(entry.wd, entry.name, entry.length,
+                                        entry.hash);
+
+                for (std::size_t i = (hole + 1) & mask;
+                        table_[i] != none;
+                        i = (i + 1) & mask) {
+                    const std::size_t home = entries_[table_[i]].hash & mask;
+
+                    // Leave it alone if its home is cyclically in (hole, i]
+                    bool stays = (hole < i)
+                        ? (hole < home && home <= i)
+                        : (hole < home || home <= i);
+                    if (stays) continue;
+
+                    table_[hole] = table_[i];
+                    hole = i;
+                }
+
+                table_[hole] = none;
+            }
+
+            template <class Emit>
+            void flush(uint32_t index, Emit emit)
+            {
+                Entry &entry = entries_[index];
+
+                unlink(index);
+                remove(index);
+                entry.held = false;
+                free_.push_back(index);
+
+                // Laid out just like the kernel would have
+                auto *ev = reinterpret_cast<inotify_event*>(scratch_);
+                const std::size_t len = entry.length
+                    ? (entry.length + 1 + 3) & ~std::size_t(3)
+                    : 0;
+                ev->wd = entry.wd;
+                ev->mask = entry.mask;
+                ev->cookie = entry.cookie;
+                ev->len = static_cast<uint32_t>(len);
+                memset(ev->name, 0, len);
+                memcpy(ev->name, entry.name, entry.length);
+
+                ++stats_.flushed;
+                emit(ev);
+            }
+
+            // Everything for one wd, or everything at all
+            template <class Emit>
+            void flush_matching(int wd, bool everything, Emit emit)
+            {
+                for (uint32_t i = 0; i < entries_.size(); ++i) {
+                    if (entries_[i].held
+                            && (everything || entries_[i].wd == wd)) {
+                        flush(i, emit);
+                    }
+                }
+            }
+
+            Coalesce_Options options_;
+            Coalesce_Stats stats_;
+
+            std::vector<Entry> entries_;
+            std::vector<uint32_t> free_;
+            std::vector<uint32_t> table_;
+
+            std::vector<uint32_t> wheel_;
+            Clock::time_point origin_;
+            Clock::duration tick_;
+            // The next tick expire() hasn't looked at yet
+            int64_t current_tick_ = 0;
+
+            alignas(inotify_event)
+                char scratch_[sizeof(inotify_event) + NAME_MAX + 1 + 3];
+    };
+
+} // namespace Watch
+
+#endif
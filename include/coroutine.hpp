@@ -0,0 +1,370 @@
+#ifndef WATCHDOG_COROUTINE_H
+#define WATCHDOG_COROUTINE_H
+
+// Only with a compiler doing C++20 coroutines. Watchdog itself is C++17, so
+// everything here (and `Sentry::next_batch()` and `Sentry::events()`) is
+// left out otherwise.
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define WATCHDOG_COROUTINES true
+#else
+#define WATCHDOG_COROUTINES false
+#endif
+
+#if WATCHDOG_COROUTINES
+
+#include <poll.h>
+
+#include <cstddef>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <event_batch.hpp>
+#include <event_view.hpp>
+#include <exceptions.hpp>
+
+namespace Watch {
+
+    // A coroutine that doesn't start until it's awaited (or `start()`ed),
+    // and resumes whoever awaited it when it's done
+    template <class T = void>
+    class Task;
+
+    namespace Coroutine_Detail {
+
+        template <class Promise>
+        struct Final {
+            bool await_ready() noexcept { return false; }
+
+            std::coroutine_handle<> await_suspend(
+                    std::coroutine_handle<Promise> done) noexcept
+            {
+                auto next = done.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        struct Promise_Base {
+            std::coroutine_handle<> continuation;
+            std::exception_ptr error;
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+
+            void unhandled_exception()
+            {
+                error = std::current_exception();
+            }
+        };
+
+        template <class T>
+        struct Promise : Promise_Base {
+            std::optional<T> value;
+
+            Task<T> get_return_object();
+            Final<Promise> final_suspend() noexcept { return {}; }
+
+            template <class U>
+            void return_value(U &&u)
+            {
+                value.emplace(std::forward<U>(u));
+            }
+
+            T take()
+            {
+                if (error) std::rethrow_exception(error);
+                return std::move(*value);
+            }
+        };
+
+        template <>
+        struct Promise<void> : Promise_Base {
+            Task<void> get_return_object();
+            Final<Promise> final_suspend() noexcept { return {}; }
+
+            void return_void() {}
+
+            void take()
+            {
+                if (error) std::rethrow_exception(error);
+            }
+        };
+
+    } // namespace Coroutine_Detail
+
+    template <class T>
+    class Task {
+        public:
+            using promise_type = Coroutine_Detail::Promise<T>;
+
+            Task(const Task &src) = delete;
+            Task& operator=(const Task &src) = delete;
+
+            Task(Task &&other) noexcept
+                : handle_(std::exchange(other.handle_, nullptr))
+            {}
+
+            Task& operator=(Task &&other) noexcept
+            {
+                if (this != &other) {
+                    if (handle_) handle_.destroy();
+                    handle_ = std::exchange(other.handle_, nullptr);
+                }
+                return *this;
+            }
+
+            ~Task()
+            {
+                if (handle_) handle_.destroy();
+            }
+
+            // Run it from the top, when nobody is going to await it. Keep
+            // the Task around until it's `done()`.
+            void start()
+            {
+                handle_.resume();
+            }
+
+            bool done() const
+            {
+                return handle_.done();
+            }
+
+            // What it returned (or threw), once it's done
+            T get()
+            {
+                return handle_.promise().take();
+            }
+
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            std::coroutine_handle<> await_suspend(
+                    std::coroutine_handle<> waiting) noexcept
+            {
+                handle_.promise().continuation = waiting;
+                return handle_;
+            }
+
+            T await_resume()
+            {
+                return handle_.promise().take();
+            }
+
+        private:
+            friend promise_type;
+
+            explicit Task(std::coroutine_handle<promise_type> handle)
+                : handle_(handle)
+            {}
+
+            std::coroutine_handle<promise_type> handle_;
+    };
+
+    namespace Coroutine_Detail {
+
+        template <class T>
+        Task<T> Promise<T>::get_return_object()
+        {
+            return Task<T>(
+                    std::coroutine_handle<Promise<T>>::from_promise(*this));
+        }
+
+        inline Task<void> Promise<void>::get_return_object()
+        {
+            return Task<void>(
+                    std::coroutine_handle<Promise<void>>::from_promise(*this));
+        }
+
+    } // namespace Coroutine_Detail
+
+    // Suspends until `fd` is readable, as told by the scheduler, which is
+    // anything with
+    //
+    //   void wait_readable(int fd, std::coroutine_handle<> waiting);
+    //
+    // that resumes `waiting` (on whatever thread it likes) once `fd` can be
+    // read from. Poll_Scheduler is the simplest one there is.
+    template <class Scheduler>
+    struct Readable {
+        int fd;
+        Scheduler &scheduler;
+
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend(std::coroutine_handle<> waiting)
+        {
+            scheduler.wait_readable(fd, waiting);
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    // Waits for descriptors with poll(), and resumes whoever was waiting
+    // for them on the thread calling `run_once()`
+    class Poll_Scheduler {
+        public:
+            void wait_readable(int fd, std::coroutine_handle<> waiting)
+            {
+                waiting_.emplace_back(fd, waiting);
+            }
+
+            // Waits up to `timeout_ms` (forever if negative) for anything
+            // to become readable, and resumes everyone waiting for it.
+            // False if nobody was waiting for anything.
+            bool run_once(int timeout_ms = -1)
+            {
+                if (waiting_.empty()) return false;
+
+                fds_.clear();
+                for (const auto &waiting : waiting_) {
+                    fds_.push_back(pollfd{ waiting.first, POLLIN, 0 });
+                }
+
+                const int ready = poll(fds_.data(), fds_.size(), timeout_ms);
+                if (ready < 0) {
+                    if (errno == EINTR) return true;
+                    throw Exception("Failed to poll");
+                }
+
+                // Resuming may add more, so take everyone ready out first
+                ready_.clear();
+                std::size_t kept = 0;
+                for (std::size_t i = 0; i < waiting_.size(); ++i) {
+                    if (fds_[i].revents) {
+                        ready_.push_back(waiting_[i].second);
+                    } else {
+                        waiting_[kept++] = waiting_[i];
+                    }
+                }
+                waiting_.resize(kept);
+
+                for (auto handle : ready_) handle.resume();
+
+                return true;
+            }
+
+            // Until nobody is waiting for anything
+            void run()
+            {
+                while (run_once()) {}
+            }
+
+        private:
+            std::vector< std::pair<int, std::coroutine_handle<>> > waiting_;
+            std::vector<pollfd> fds_;
+            std::vector< std::coroutine_handle<> > ready_;
+    };
+
+    // Copies of the events in batches handed to it, until cleared. What
+    // `Sentry::next_batch()` hands back points in here.
+    class Batch_Copy {
+        public:
+            void clear()
+            {
+                records_.clear();
+                text_.clear();
+                views_.clear();
+            }
+
+            bool empty() const
+            {
+                return records_.empty();
+            }
+
+            void take(const Event_Batch &batch, uint32_t mask)
+            {
+                for (const auto &ev : batch) {
+                    if ((ev.mask & mask) == 0) continue;
+
+                    Record record{ ev.wd, ev.mask, ev.cookie,
+                                   text_.size(), ev.name.size(),
+                                   text_.size() + ev.name.size(),
+                                   ev.path.size() };
+                    text_.append(ev.name);
+                    text_.append(ev.path);
+                    records_.push_back(record);
+                }
+            }
+
+            Event_Batch batch()
+            {
+                // Only now that text_ has stopped moving
+                views_.clear();
+                for (const auto &record : records_) {
+                    views_.push_back(Event_View{
+                            record.wd, record.mask, record.cookie,
+                            std::string_view(&text_[record.name],
+                                             record.name_length),
+                            std::string_view(&text_[record.path],
+                                             record.path_length) });
+                }
+
+                return Event_Batch(views_.data(), views_.size());
+            }
+
+        private:
+            struct Record {
+                int wd;
+                uint32_t mask;
+                uint32_t cookie;
+                std::size_t name;
+                std::size_t name_length;
+                std::size_t path;
+                std::size_t path_length;
+            };
+
+            std::vector<Record> records_;
+            std::string text_;
+            std::vector<Event_View> views_;
+    };
+
+    // Every event from a Sentry, one at a time, read as they're asked for:
+    //
+    //   auto events = sentry.events(scheduler);
+    //   while (true) {
+    //       const Event_View *ev = co_await events.next();
+    //       ...
+    //   }
+    //
+    // Each view is good until the next one is asked for.
+    template <class Sentry_, class Scheduler>
+    class Event_Stream {
+        public:
+            Event_Stream(Sentry_ &sentry, Scheduler &scheduler,
+                         FlagBearer flags)
+                : sentry_(sentry), scheduler_(scheduler), flags_(flags)
+            {}
+
+            // Never null; a pointer only because Task can't hold a
+            // reference
+            Task<const Event_View*> next()
+            {
+                while (at_ == batch_.size()) {
+                    batch_ = co_await sentry_.next_batch(scheduler_, flags_);
+                    at_ = 0;
+                }
+
+                co_return &batch_[at_++];
+            }
+
+        private:
+            Sentry_ &sentry_;
+            Scheduler &scheduler_;
+            FlagBearer flags_;
+
+            Event_Batch batch_{ nullptr, 0 };
+            std::size_t at_ = 0;
+    };
+
+} // namespace Watch
+
+#endif
+
+#endif
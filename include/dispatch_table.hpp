@@ -0,0 +1,126 @@
+#ifndef WATCHDOG_DISPATCH_TABLE_H
+#define WATCHDOG_DISPATCH_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <watchdog_common.hpp>
+
+namespace Watch {
+
+    // Handlers indexed by the event bits they care about, so that finding
+    // the handlers for an event costs about as much as calling them.
+    //
+    // Nearly every event has exactly one bit set that anybody registered
+    // for, and those go straight to a per-bit list. Anything else gets
+    // worked out the first time we see it and remembered.
+    //
+    // Matching is safe from several threads at once (workers dispatch
+    // through here), as long as nobody's adding handlers at the time.
+    template <class Handler>
+    class Dispatch_Table {
+        public:
+            void add(FlagBearer flags, Handler handler)
+            {
+                handlers_.push_back(std::make_pair(flags, std::move(handler)));
+                const Handler *added = &handlers_.back().second;
+
+                for (unsigned bit = 0; bit < bits; ++bit) {
+                    if (flags & (FlagBearer(1) << bit)) {
+                        by_bit_[bit].push_back(added);
+                    }
+                }
+
+                registered_ |= static_cast<uint32_t>(flags);
+                combined_.clear();
+            }
+
+            // Calls f(handler) for every handler whose flags overlap `mask`,
+            // in the order they were added
+            template <class F>
+            void for_each_match(uint32_t mask, F f)
+            {
+                const uint32_t relevant = mask & registered_;
+
+                if (relevant == 0) return;
+
+                // Only one bit set
+                if ((relevant & (relevant - 1)) == 0) {
+                    for (const Handler *handler
+                            : by_bit_[__builtin_ctz(relevant)]) {
+                        f(*handler);
+                    }
+                    return;
+                }
+
+                for (const Handler *handler : combine(relevant)) {
+                    f(*handler);
+                }
+            }
+
+            bool empty() const
+            {
+                return handlers_.empty();
+            }
+
+            std::size_t size() const
+            {
+                return handlers_.size();
+            }
+
+            // Union of every handler's flags
+            uint32_t registered() const
+            {
+                return registered_;
+            }
+
+        private:
+            static const unsigned bits = 32;
+
+            // For when more than one relevant bit is set. What's already
+            // been worked out stays put while more is added, since
+            // unordered_map never moves its elements.
+            const std::vector<const Handler*> &combine(uint32_t relevant)
+            {
+                {
+                    std::shared_lock<std::shared_mutex> lock(combined_m_);
+                    auto it = combined_.find(relevant);
+                    if (it != combined_.end()) return it->second;
+                }
+
+                std::unique_lock<std::shared_mutex> lock(combined_m_);
+
+                // Somebody else may have got here first
+                auto it = combined_.find(relevant);
+                if (it != combined_.end()) return it->second;
+
+                std::vector<const Handler*> &matches = combined_[relevant];
+                for (const auto &handler : handlers_) {
+                    if (handler.first & relevant) {
+                        matches.push_back(&handler.second);
+                    }
+                }
+
+                return matches;
+            }
+
+            // A deque, so that adding handlers never moves the old ones
+            std::deque< std::pair<FlagBearer, Handler> > handlers_;
+
+            std::vector<const Handler*> by_bit_[bits];
+            std::unordered_map< uint32_t, std::vector<const Handler*> >
+                combined_;
+            std::shared_mutex combined_m_;
+
+            uint32_t registered_ = 0;
+    };
+
+} // namespace Watch
+
+#endif
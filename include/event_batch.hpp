@@ -0,0 +1,180 @@
+#ifndef WATCHDOG_EVENT_BATCH_H
+#define WATCHDOG_EVENT_BATCH_H
+
+#include <sys/inotify.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <event_view.hpp>
+#include <watchdog_common.hpp>
+
+namespace Watch {
+
+    // Every event from one read(), in order, as one contiguous range. Like
+    // Event_View, nothing in here is good after the callback returns.
+    class Event_Batch {
+        public:
+            Event_Batch(const Event_View *first, std::size_t count)
+                : first_(first), count_(count)
+            {}
+
+            const Event_View *begin() const { return first_; }
+            const Event_View *end() const { return first_ + count_; }
+
+            const Event_View &operator[](std::size_t i) const
+            {
+                return first_[i];
+            }
+
+            std::size_t size() const { return count_; }
+            bool empty() const { return count_ == 0; }
+
+        private:
+            const Event_View *first_;
+            std::size_t count_;
+    };
+
+    using Batch_Callback = std::function<void(const Event_Batch&)>;
+
+    // Collects events as they're dispatched and hands them to every batch
+    // callback in one go. The names and paths are copied as they come in,
+    // since the buffers they point into may be gone (or reused) before the
+    // batch is delivered. All of the storage is reused from one batch to the
+    // next, so once it has grown big enough nothing gets allocated.
+    class Batcher {
+        public:
+            void add(FlagBearer flags, Batch_Callback cb)
+            {
+                callbacks_.emplace_back(flags, std::move(cb));
+                mask_ |= flags;
+            }
+
+            bool empty() const
+            {
+                return callbacks_.empty();
+            }
+
+            // Whether anyone wants to hear about this event at all
+            bool wants(uint32_t mask) const
+            {
+                return (mask & mask_) != 0;
+            }
+
+            void collect(const inotify_event *ev, const std::string &path)
+            {
+                Record record;
+                record.wd = ev->wd;
+                record.mask = ev->mask;
+                record.cookie = ev->cookie;
+
+                // Runs of events from the same directory are the norm, so
+                // only copy the path when it changes
+                if (records_.empty() || path.size() != last_path_.second
+                        || path.compare(0, path.size(),
+                                        &text_[last_path_.first],
+                                        last_path_.second) != 0) {
+                    last_path_ = { text_.size(), path.size() };
+                    text_ += path;
+                }
+                record.path = last_path_;
+
+                const std::size_t length = strnlen(ev->name, ev->len);
+                record.name = { text_.size(), length };
+                text_.append(ev->name, length);
+
+                records_.push_back(record);
+                seen_ |= ev->mask;
+            }
+
+            // Call everyone who wants some part of what we've collected
+            void deliver()
+            {
+                if (records_.empty()) return;
+
+                // Only now that text_ has stopped moving
+                views_.clear();
+                for (const auto &record : records_) {
+                    views_.push_back(Event_View{
+                            record.wd, record.mask, record.cookie,
+                            std::string_view(&text_[record.name.first],
+                                             record.name.second),
+                            std::string_view(&text_[record.path.first],
+                                             record.path.second) });
+                }
+
+                // Ready for the next batch once everyone's done with this
+                // one, even if someone throws
+                struct Reset {
+                    Batcher &batcher;
+                    ~Reset()
+                    {
+                        batcher.records_.clear();
+                        batcher.text_.clear();
+                    }
+                } reset{*this};
+
+                const uint32_t seen = seen_;
+                seen_ = 0;
+
+                for (const auto &callback : callbacks_) {
+                    const FlagBearer flags = callback.first;
+
+                    // Nothing in here for them
+                    if ((flags & seen) == 0) continue;
+
+                    std::size_t matching = 0;
+                    for (const auto &view : views_) {
+                        if (view.mask & flags) ++matching;
+                    }
+
+                    if (matching == 0) continue;
+
+                    if (matching == views_.size()) {
+                        callback.second(Event_Batch(views_.data(),
+                                                    views_.size()));
+                        continue;
+                    }
+
+                    filtered_.clear();
+                    for (const auto &view : views_) {
+                        if (view.mask & flags) filtered_.push_back(view);
+                    }
+                    callback.second(Event_Batch(filtered_.data(),
+                                                filtered_.size()));
+                }
+            }
+
+        private:
+            // Offset and length in text_
+            using Span = std::pair<std::size_t, std::size_t>;
+
+            struct Record {
+                int wd;
+                uint32_t mask;
+                uint32_t cookie;
+                Span name;
+                Span path;
+            };
+
+            std::vector< std::pair<FlagBearer, Batch_Callback> > callbacks_;
+            FlagBearer mask_ = 0;
+
+            std::vector<Record> records_;
+            std::string text_;
+            Span last_path_;
+            // Every bit set in this batch
+            uint32_t seen_ = 0;
+
+            std::vector<Event_View> views_;
+            std::vector<Event_View> filtered_;
+    };
+
+} // namespace Watch
+
+#endif
@@ -0,0 +1,451 @@
+#ifndef WATCHDOG_EVENT_LOG_H
+#define WATCHDOG_EVENT_LOG_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <exceptions.hpp>
+
+namespace Watch {
+
+    // A log is a header followed by records, each of which is a
+    // Log_Record followed by `length` bytes, padded to 8.
+    //
+    //   Root    the directory being watched
+    //   Batch   what one read() returned, exactly as it was
+    //   Watch   a directory watched: its wd, then its path
+    //   Made    events we made up, laid out like Batch
+    //   Adopt   everything one new directory brought with it: how many
+    //           directories were watched, each as a wd, a length and a path
+    //           (padded to 4), then the events made up for what was in them
+    //
+    // Timestamps are nanoseconds since the log was opened. Everything is in
+    // the byte order of whoever wrote it.
+    enum class Log_Kind : uint32_t {
+        Root = 1,
+        Batch,
+        Watch,
+        Made,
+        Adopt
+    };
+
+    struct Log_Record {
+        Log_Kind kind;
+        uint32_t length;
+        int64_t ns;
+    };
+
+    // One record, pointing into the mapped log
+    struct Log_Entry {
+        Log_Kind kind;
+        int64_t ns;
+        char *data;
+        std::size_t length;
+    };
+
+    namespace Log_Format {
+        static const char magic[8] = { 'W', 'D', 'O', 'G', 'L', 'O', 'G', 1 };
+
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t reserved;
+        };
+
+        enum : uint32_t { version = 1 };
+
+        inline std::size_t padded(std::size_t n, std::size_t to)
+        {
+            return (n + to - 1) & ~(to - 1);
+        }
+    } // namespace Log_Format
+
+    // Appends to a log, buffering as it goes. Belongs to one Sentry's
+    // reading thread (see `Sentry::record()`).
+    class Event_Log {
+        public:
+            // Don't allow assignment or copying
+            Event_Log(const Event_Log &src) = delete;
+            Event_Log& operator=(const Event_Log &src) = delete;
+
+            // Replaces whatever was at `path`
+            explicit Event_Log(const std::string &path)
+                : start_(std::chrono::steady_clock::now())
+            {
+                fd_ = open(path.c_str(),
+                           O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                if (fd_ < 0) {
+                    throw Exception("Failed to open event log " + path);
+                }
+
+                Log_Format::Header header;
+                memcpy(header.magic, Log_Format::magic, sizeof(header.magic));
+                header.version = Log_Format::version;
+                header.reserved = 0;
+                append_(&header, sizeof(header));
+            }
+
+            ~Event_Log()
+            {
+                // Nowhere to report it
+                try {
+                    flush();
+                } catch (const Exception&) {}
+
+                close(fd_);
+            }
+
+            void root(const std::string &path)
+            {
+                record_(Log_Kind::Root, path.size());
+                append_(path.data(), path.size());
+                pad_(path.size());
+            }
+
+            void batch(const char *buffer, std::size_t length)
+            {
+                record_(Log_Kind::Batch, length);
+                append_(buffer, length);
+                pad_(length);
+            }
+
+            void watch(int wd, const std::string &path)
+            {
+                const int32_t wd_ = wd;
+                const std::size_t length = sizeof(wd_) + path.size();
+
+                record_(Log_Kind::Watch, length);
+                append_(&wd_, sizeof(wd_));
+                append_(path.data(), path.size());
+                pad_(length);
+            }
+
+            void made(const char *events, std::size_t length)
+            {
+                record_(Log_Kind::Made, length);
+                append_(events, length);
+                pad_(length);
+            }
+
+            void adopt(const std::vector< std::pair<int, std::string> > &dirs,
+                       const char *events, std::size_t events_length)
+            {
+                std::size_t length = sizeof(uint32_t);
+                for (const auto &dir : dirs) {
+                    length += sizeof(int32_t) + sizeof(uint32_t)
+                            + Log_Format::padded(dir.second.size(), 4);
+                }
+                length += events_length;
+
+                record_(Log_Kind::Adopt, length);
+
+                const uint32_t count = dirs.size();
+                append_(&count, sizeof(count));
+
+                static const char zeros[4] = {};
+                for (const auto &dir : dirs) {
+                    const int32_t wd = dir.first;
+                    const uint32_t size = dir.second.size();
+                    append_(&wd, sizeof(wd));
+                    append_(&size, sizeof(size));
+                    append_(dir.second.data(), size);
+                    append_(zeros, Log_Format::padded(size, 4) - size);
+                }
+
+                append_(events, events_length);
+                pad_(length);
+            }
+
+            // Write out whatever is buffered
+            void flush()
+            {
+                std::size_t done = 0;
+                while (done < buffer_.size()) {
+                    const ssize_t wrote = write(fd_, buffer_.data() + done,
+                                                buffer_.size() - done);
+                    if (wrote < 0) {
+                        if (errno == EINTR) continue;
+                        throw Exception("Failed to write event log");
+                    }
+                    done += wrote;
+                }
+                buffer_.clear();
+            }
+
+        private:
+            enum : std::size_t { flush_at = 1 << 16 };
+
+            void record_(Log_Kind kind, std::size_t length)
+            {
+                if (length > UINT32_MAX) {
+                    throw Exception("Event log record too large");
+                }
+
+                Log_Record record;
+                record.kind = kind;
+                record.length = length;
+                record.ns = std::chrono::duration_cast<
+                    std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - start_)
+                    .count();
+
+                append_(&record, sizeof(record));
+            }
+
+            void append_(const void *data, std::size_t length)
+            {
+                const char *bytes = static_cast<const char*>(data);
+                buffer_.insert(buffer_.end(), bytes, bytes + length);
+            }
+
+            void pad_(std::size_t length)
+            {
+                static const char zeros[8] = {};
+                append_(zeros, Log_Format::padded(length, 8) - length);
+
+                if (buffer_.size() >= flush_at) flush();
+            }
+
+            int fd_;
+            std::chrono::steady_clock::time_point start_;
+            std::vector<char> buffer_;
+    };
+
+    // A log mapped into memory, for `Sentry::replay()`. Mapped privately,
+    // so callbacks can scribble on events without changing the file.
+    class Event_Log_Reader {
+        public:
+            // Don't allow assignment or copying
+            Event_Log_Reader(const Event_Log_Reader &src) = delete;
+            Event_Log_Reader& operator=(const Event_Log_Reader &src) = delete;
+
+            explicit Event_Log_Reader(const std::string &path)
+            {
+                const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd < 0) {
+                    throw Exception("Failed to open event log " + path);
+                }
+
+                struct stat sb;
+                if (fstat(fd, &sb) < 0) {
+                    close(fd);
+                    throw Exception("Failed to read event log " + path);
+                }
+                size_ = sb.st_size;
+
+                if (size_ < sizeof(Log_Format::Header)) {
+                    close(fd);
+                    throw Exception("Not an event log: " + path);
+                }
+
+                void *mapped = mmap(nullptr, size_, PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE, fd, 0);
+                close(fd);
+                if (mapped == MAP_FAILED) {
+                    throw Exception("Failed to map event log " + path);
+                }
+                data_ = static_cast<char*>(mapped);
+
+                Log_Format::Header header;
+                memcpy(&header, data_, sizeof(header));
+                if (memcmp(header.magic, Log_Format::magic,
+                           sizeof(header.magic)) != 0
+                        || header.version != Log_Format::version) {
+                    munmap(data_, size_);
+                    throw Exception("Not an event log: " + path);
+                }
+
+                try {
+                    Cursor cursor = this->cursor();
+                    Log_Entry entry;
+                    if (cursor.next(entry) && entry.kind == Log_Kind::Root) {
+                        root_.assign(entry.data, entry.length);
+                    }
+                } catch (...) {
+                    munmap(data_, size_);
+                    throw;
+                }
+            }
+
+            ~Event_Log_Reader()
+            {
+                munmap(data_, size_);
+            }
+
+            // The directory that was being watched
+            const std::string &root() const
+            {
+                return root_;
+            }
+
+            // Walks the records in order. A record cut short (because
+            // whoever wrote it never got to finish) ends the log. One whose
+            // insides don't fit in it throws once `next()` gets to it.
+            // `peek()` only looks at the kind and length.
+            class Cursor {
+                public:
+                    Cursor(char *at, char *end) : at_(at), end_(end) {}
+
+                    bool peek(Log_Entry &entry) const
+                    {
+                        if (std::size_t(end_ - at_) < sizeof(Log_Record)) {
+                            return false;
+                        }
+
+                        Log_Record record;
+                        memcpy(&record, at_, sizeof(record));
+                        if (std::size_t(end_ - at_) - sizeof(record)
+                                < record.length) {
+                            return false;
+                        }
+
+                        entry.kind = record.kind;
+                        entry.ns = record.ns;
+                        entry.data = at_ + sizeof(record);
+                        entry.length = record.length;
+                        return true;
+                    }
+
+                    bool next(Log_Entry &entry)
+                    {
+                        if (!peek(entry)) return false;
+                        check(entry);
+
+                        const std::size_t step = sizeof(Log_Record)
+                            + Log_Format::padded(entry.length, 8);
+                        at_ = (std::size_t(end_ - at_) < step) ? end_
+                                                               : at_ + step;
+                        return true;
+                    }
+
+                private:
+                    char *at_;
+                    char *end_;
+            };
+
+            Cursor cursor() const
+            {
+                return Cursor(data_ + sizeof(Log_Format::Header),
+                              data_ + size_);
+            }
+
+            // Calls f(wd, path) for every directory in an Adopt record, and
+            // returns where the events made up for them start
+            template <class F>
+            static std::pair<char*, std::size_t> adopted(
+                    const Log_Entry &entry, F f)
+            {
+                return walk_adopted(entry,
+                        [&f](int wd, const char *path, std::size_t size) {
+                            f(wd, std::string(path, size));
+                        });
+            }
+
+            // What a Watch record says
+            static std::pair<int, std::string> watched(const Log_Entry &entry)
+            {
+                if (entry.length < sizeof(int32_t)) corrupt();
+
+                int32_t wd;
+                memcpy(&wd, entry.data, sizeof(wd));
+                return std::make_pair(int(wd),
+                        std::string(entry.data + sizeof(wd),
+                                    entry.length - sizeof(wd)));
+            }
+
+        private:
+            [[noreturn]] static void corrupt()
+            {
+                throw Exception("Corrupt event log");
+            }
+
+            // Throws unless everything the record says is in it fits, so
+            // nothing reading it can wander off the end of the mapping
+            static void check(const Log_Entry &entry)
+            {
+                switch (entry.kind) {
+                    case Log_Kind::Batch:
+                    case Log_Kind::Made:
+                        check_events(entry.data, entry.length);
+                        break;
+                    case Log_Kind::Watch:
+                        if (entry.length < sizeof(int32_t)) corrupt();
+                        break;
+                    case Log_Kind::Adopt: {
+                        auto made = walk_adopted(entry,
+                                [](int, const char*, std::size_t) {});
+                        check_events(made.first, made.second);
+                        break;
+                    }
+                    case Log_Kind::Root:
+                        break;
+                }
+            }
+
+            // Events laid out the way read() returns them, each of which
+            // has to end by the end
+            static void check_events(const char *at, std::size_t length)
+            {
+                for (std::size_t i = 0; i < length; ) {
+                    inotify_event ev;
+                    if (length - i < sizeof(ev)) corrupt();
+
+                    memcpy(&ev, at + i, sizeof(ev));
+                    i += sizeof(ev);
+                    if (length - i < ev.len) corrupt();
+                    i += ev.len;
+                }
+            }
+
+            template <class F>
+            static std::pair<char*, std::size_t> walk_adopted(
+                    const Log_Entry &entry, F f)
+            {
+                char *at = entry.data;
+                char *end = entry.data + entry.length;
+
+                uint32_t count;
+                if (std::size_t(end - at) < sizeof(count)) corrupt();
+                memcpy(&count, at, sizeof(count));
+                at += sizeof(count);
+
+                for (uint32_t i = 0; i < count; ++i) {
+                    int32_t wd;
+                    uint32_t size;
+                    if (std::size_t(end - at) < sizeof(wd) + sizeof(size)) {
+                        corrupt();
+                    }
+                    memcpy(&wd, at, sizeof(wd));
+                    memcpy(&size, at + sizeof(wd), sizeof(size));
+                    at += sizeof(wd) + sizeof(size);
+
+                    if (std::size_t(end - at) < Log_Format::padded(size, 4)) {
+                        corrupt();
+                    }
+                    f(int(wd), at, size);
+                    at += Log_Format::padded(size, 4);
+                }
+
+                return std::make_pair(at, std::size_t(end - at));
+            }
+
+            char *data_ = nullptr;
+            std::size_t size_ = 0;
+            std::string root_;
+    };
+
+} // namespace Watch
+
+#endif
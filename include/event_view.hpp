@@ -0,0 +1,39 @@
+#ifndef WATCHDOG_EVENT_VIEW_H
+#define WATCHDOG_EVENT_VIEW_H
+
+#include <sys/inotify.h>
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string_view>
+
+namespace Watch {
+
+    // Everything interesting about an Event, without owning any of it. The
+    // views are only good until the callback returns, so copy whatever you
+    // want to keep.
+    struct Event_View {
+        int wd;
+        uint32_t mask;
+        uint32_t cookie;
+        // Name of the file the event is about, if any. Does not include the
+        // padding the kernel adds.
+        std::string_view name;
+        // Watched directory the event came from
+        std::string_view path;
+    };
+
+    using View_Callback = std::function<void(const Event_View&)>;
+
+    inline Event_View view_of(const inotify_event *ev, std::string_view path)
+    {
+        return Event_View{ ev->wd, ev->mask, ev->cookie,
+                           std::string_view(ev->name,
+                                            strnlen(ev->name, ev->len)),
+                           path };
+    }
+
+} // namespace Watch
+
+#endif
@@ -0,0 +1,311 @@
+#ifndef WATCHDOG_EXECUTOR_H
+#define WATCHDOG_EXECUTOR_H
+
+#include <sys/inotify.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <exceptions.hpp>
+#include <poller.hpp>
+
+namespace Watch {
+
+    // What to do with an event when its worker is already too far behind
+    enum class Saturation {
+        // Make the reader wait for room. Nothing is lost, but the kernel's
+        // queue can fill up in the meantime.
+        Block,
+        // Throw the event away (and count it)
+        Drop,
+        // Run it on the reader. Nothing is lost, but it may get ahead of
+        // events for the same directory that are still queued.
+        Inline,
+    };
+
+    struct Executor_Options {
+        // 0 means one per core
+        unsigned workers = 0;
+        // Events each worker can have waiting
+        std::size_t queue_depth = 1024;
+        Saturation when_full = Saturation::Block;
+    };
+
+    struct Executor_Stats {
+        std::size_t submitted = 0;
+        // Run by workers or inline
+        std::size_t executed = 0;
+        std::size_t dropped = 0;
+        std::size_t ran_inline = 0;
+        // How often, and for how long, the reader waited for room
+        std::size_t blocked = 0;
+        std::chrono::microseconds blocked_for{0};
+        // Waiting right now, across every worker
+        std::size_t queued = 0;
+        // Most events any one worker has had waiting at once
+        std::size_t high_water = 0;
+    };
+
+    // A fixed pool of threads that run callbacks for the thread reading
+    // events. Events are sharded by wd, so everything about one directory
+    // runs in order on the same worker, while different directories run in
+    // parallel.
+    //
+    // Each worker has a bounded ring of jobs. Jobs are swapped in and out of
+    // it rather than copied, so their strings keep their capacity and the
+    // reader stops allocating once things have warmed up.
+    class Executor {
+        public:
+            // A copy of an event, since the read buffer will be reused long
+            // before a worker gets to it
+            struct Job {
+                int wd = -1;
+                uint32_t mask = 0;
+                uint32_t cookie = 0;
+                std::string name;
+                std::string path;
+            };
+
+            using Run = std::function<void(const Job&)>;
+
+            // Don't allow assignment or copying
+            Executor(const Executor &src) = delete;
+            Executor& operator=(const Executor &src) = delete;
+
+            Executor(const Executor_Options &options, Run run)
+                : options_(options), run_(std::move(run))
+            {
+                if (options_.workers == 0) {
+                    options_.workers = std::thread::hardware_concurrency();
+                }
+                if (options_.workers == 0) options_.workers = 1;
+                if (options_.queue_depth == 0) {
+                    throw Exception("Executor needs room for something");
+                }
+
+                for (unsigned i = 0; i < options_.workers; ++i) {
+                    workers_.emplace_back(new Worker());
+                    workers_.back()->ring.resize(options_.queue_depth);
+                }
+                for (unsigned i = 0; i < options_.workers; ++i) {
+                    workers_[i]->thread = std::thread(&Executor::work, this,
+                                                      std::ref(*workers_[i]));
+                }
+            }
+
+            // Runs whatever is still queued, then stops
+            ~Executor()
+            {
+                for (auto &worker : workers_) {
+                    {
+                        std::lock_guard<std::mutex> lock(worker->m);
+                        worker->stopping = true;
+                    }
+                    worker->not_empty.notify_all();
+                    worker->not_full.notify_all();
+                }
+
+                for (auto &worker : workers_) worker->thread.join();
+            }
+
+            // Only ever called from the reading thread
+            void submit(const inotify_event *ev, const std::string &path)
+            {
+                ++submitted_;
+
+                Worker &worker = *workers_[static_cast<unsigned>(ev->wd)
+                                           % workers_.size()];
+                std::unique_lock<std::mutex> lock(worker.m);
+
+                if (worker.count == worker.ring.size()) {
+                    switch (options_.when_full) {
+                        case Saturation::Drop:
+                            ++dropped_;
+                            return;
+
+                        case Saturation::Inline:
+                            lock.unlock();
+                            fill(inline_, ev, path);
+                            ++ran_inline_;
+                            execute(inline_);
+                            return;
+
+                        case Saturation::Block: {
+                            const auto start = Clock::now();
+                            worker.not_full.wait(lock, [&worker] {
+                                    return worker.count < worker.ring.size()
+                                        || worker.stopping;
+                                });
+                            ++blocked_;
+                            blocked_for_ += std::chrono::duration_cast<
+                                std::chrono::microseconds>(
+                                        Clock::now() - start).count();
+                            if (worker.stopping) return;
+                            break;
+                        }
+                    }
+                }
+
+                const std::size_t tail = (worker.head + worker.count)
+                                         % worker.ring.size();
+                fill(worker.ring[tail], ev, path);
+                ++worker.count;
+                ++queued_;
+
+                if (worker.count > high_water_.load()) {
+                    high_water_ = worker.count;
+                }
+
+                lock.unlock();
+                worker.not_empty.notify_one();
+            }
+
+            // Wait for everything queued so far to finish
+            void drain()
+            {
+                for (auto &worker : workers_) {
+                    std::unique_lock<std::mutex> lock(worker->m);
+                    worker->idle.wait(lock, [&worker] {
+                            return worker->count == 0 && !worker->busy;
+                        });
+                }
+            }
+
+            // If a callback threw on a worker, throw it here instead, so
+            // that it comes out of whatever the reader was doing
+            void rethrow()
+            {
+                if (!failed_.load()) return;
+
+                std::lock_guard<std::mutex> lock(error_m_);
+                if (!error_) return;
+
+                std::exception_ptr error;
+                std::swap(error, error_);
+                failed_ = false;
+                std::rethrow_exception(error);
+            }
+
+            Executor_Stats stats() const
+            {
+                Executor_Stats stats;
+                stats.submitted = submitted_.load();
+                stats.executed = executed_.load();
+                stats.dropped = dropped_.load();
+                stats.ran_inline = ran_inline_.load();
+                stats.blocked = blocked_.load();
+                stats.blocked_for = std::chrono::microseconds(
+                        blocked_for_.load());
+                stats.queued = queued_.load();
+                stats.high_water = high_water_.load();
+                return stats;
+            }
+
+            std::size_t size() const
+            {
+                return workers_.size();
+            }
+
+        private:
+            struct Worker {
+                std::mutex m;
+                std::condition_variable not_empty;
+                std::condition_variable not_full;
+                std::condition_variable idle;
+
+                std::vector<Job> ring;
+                std::size_t head = 0;
+                std::size_t count = 0;
+                bool busy = false;
+                bool stopping = false;
+
+                std::thread thread;
+            };
+
+            static void fill(Job &job, const inotify_event *ev,
+                             const std::string &path)
+            {
+                job.wd = ev->wd;
+                job.mask = ev->mask;
+                job.cookie = ev->cookie;
+                job.name.assign(ev->name, strnlen(ev->name, ev->len));
+                job.path.assign(path);
+            }
+
+            void work(Worker &worker)
+            {
+                Job job;
+
+                while (true) {
+                    {
+                        std::unique_lock<std::mutex> lock(worker.m);
+                        worker.busy = false;
+                        if (worker.count == 0) worker.idle.notify_all();
+
+                        worker.not_empty.wait(lock, [&worker] {
+                                return worker.count != 0 || worker.stopping;
+                            });
+                        if (worker.count == 0) return;
+
+                        // Our old strings go back in the ring for reuse
+                        std::swap(job, worker.ring[worker.head]);
+                        worker.head = (worker.head + 1) % worker.ring.size();
+                        --worker.count;
+                        worker.busy = true;
+                    }
+                    worker.not_full.notify_one();
+                    --queued_;
+
+                    execute(job);
+                }
+            }
+
+            void execute(const Job &job)
+            {
+                try {
+                    run_(job);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(error_m_);
+                    if (!error_) error_ = std::current_exception();
+                    failed_ = true;
+                }
+
+                ++executed_;
+            }
+
+            Executor_Options options_;
+            Run run_;
+
+            std::vector< std::unique_ptr<Worker> > workers_;
+
+            // For Saturation::Inline, which only the reader uses
+            Job inline_;
+
+            std::mutex error_m_;
+            std::exception_ptr error_;
+            std::atomic<bool> failed_{false};
+
+            std::atomic<std::size_t> submitted_{0};
+            std::atomic<std::size_t> executed_{0};
+            std::atomic<std::size_t> dropped_{0};
+            std::atomic<std::size_t> ran_inline_{0};
+            std::atomic<std::size_t> blocked_{0};
+            std::atomic<int64_t> blocked_for_{0};
+            std::atomic<std::size_t> queued_{0};
+            std::atomic<std::size_t> high_water_{0};
+    };
+
+} // namespace Watch
+
+#endif
@@ -0,0 +1,457 @@
+#ifndef WATCHDOG_FANOTIFY_H
+#define WATCHDOG_FANOTIFY_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/fanotify.h>
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <watchdog.hpp>
+
+namespace Watch {
+
+    // Watches everything under a path with a single fanotify mark on the
+    // whole filesystem, instead of one inotify watch per directory. Setting
+    // up costs the same no matter how big the tree is, there's no crawl, and
+    // max_user_watches doesn't come into it.
+    //
+    // Events come with a handle for the directory they happened in (and the
+    // name of what they're about), which we turn into a path with
+    // open_by_handle_at() and remember. Anything outside the path, or
+    // ignored, is dropped. Otherwise events are handed to the same kinds of
+    // callbacks as a Sentry, with the same `On::` flags. `wd` is a number
+    // for the directory that's never handed out twice, and `cookie` is
+    // always 0, since fanotify doesn't pair up renames. A directory we've
+    // forgotten (it moved or went away, or the cache filled up and was
+    // emptied) gets a new number the next time it's seen, so don't count on
+    // one outliving its directory's stay in the cache. Paths are worked out when the event is read, so an event from
+    // before a directory was renamed shows where it is now. The kernel also
+    // merges events about the same file that are still queued, so their
+    // masks may have several bits set.
+    //
+    // Needs CAP_SYS_ADMIN (for the mark) and CAP_DAC_READ_SEARCH (to open
+    // handles), and Linux 5.9 or later. Since the mark covers the whole
+    // filesystem, a busy filesystem means reading (and dropping) plenty of
+    // events about things elsewhere on it.
+    class Filesystem_Sentry : public Pollable {
+        public:
+            // Don't allow assignment or copying
+            Filesystem_Sentry(const Filesystem_Sentry &src) = delete;
+            Filesystem_Sentry& operator=(const Filesystem_Sentry &src)
+                = delete;
+
+            Filesystem_Sentry(const std::string &path,
+                              Ignore_Rules rules = Ignore_Rules())
+                : rules_(std::move(rules))
+            {
+                // Handles turn back into canonical paths, so that's what we
+                // compare against
+                char *real = realpath(path.c_str(), nullptr);
+                if (real == nullptr) {
+                    throw Exception("Failed to find " + path);
+                }
+                root_ = real;
+                free(real);
+
+                // Anything on the same filesystem will do for opening
+                // handles
+                mount_fd_ = open(root_.c_str(),
+                                 O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (mount_fd_ < 0) {
+                    throw Exception("Failed to open " + root_);
+                }
+
+                fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME
+                                   | FAN_NONBLOCK | FAN_CLOEXEC,
+                                   O_RDONLY | O_LARGEFILE);
+                if (fd < 0) {
+                    close(mount_fd_);
+                    throw Exception("Failed to initiate fanotify");
+                }
+
+                poller_.add(fd);
+            }
+
+            ~Filesystem_Sentry()
+            {
+                leave_reactor();
+
+                close(fd);
+                close(mount_fd_);
+            }
+
+            void add_callback(Callback cb, FlagBearer flags)
+            {
+                mark_(flags);
+
+                _callbacks.add(flags, std::move(cb));
+            }
+
+            // Same as above, but nothing gets copied to call it
+            void add_callback(View_Callback cb, FlagBearer flags)
+            {
+                mark_(flags);
+
+                _view_callbacks.add(flags, std::move(cb));
+            }
+
+            // Listen until someone calls `stop()`
+            void listen()
+            {
+                do {
+                    run_once(std::chrono::milliseconds(-1));
+                } while (!stopped_);
+            }
+
+            // Same as Sentry::run_once
+            std::size_t run_once(std::chrono::milliseconds timeout)
+            {
+                epoll_event ready[2];
+                std::size_t dispatched = 0;
+
+                if (poller_.wait(ready, 2, timeout) != 0) {
+                    Buffer_Pool::Lease buffer = Buffer_Pool::shared().lease(
+                            read_size);
+
+                    while (!poller_.stop_requested()) {
+                        const std::size_t got = read_into(buffer.data(),
+                                                          buffer.size());
+                        if (got == 0) break;
+                        dispatched += got;
+                    }
+                }
+
+                // A stop is for whoever is running us, and for nothing after
+                stopped_ = poller_.consume_stop();
+
+                return dispatched;
+            }
+
+            // Keep running until the deadline passes or `stop()` is called
+            void run_until(Clock::time_point deadline)
+            {
+                for (auto now = Clock::now(); now < deadline;
+                        now = Clock::now()) {
+                    run_once(std::chrono::duration_cast<
+                            std::chrono::milliseconds>(deadline - now));
+                    if (stopped_) break;
+                }
+            }
+
+            // Safe to call from any thread
+            void stop()
+            {
+                poller_.stop();
+            }
+
+            int pollable_fd() const override
+            {
+                return fd;
+            }
+
+            std::size_t read_into(char *buffer,
+                                  std::size_t length) override
+            {
+                ssize_t got;
+                do {
+                    got = read(fd, buffer, length);
+                } while (got < 0 && errno == EINTR);
+
+                if (got < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+                    throw Exception("Failed to read events");
+                }
+
+                if (WATCHDOG_DEBUG) {
+                    fprintf(stderr, "[DEBUG]: Read %zd bytes of fanotify "
+                            "events\n", got);
+                }
+
+                return feed(buffer, got);
+            }
+
+            // Dispatch every event in `buffer`, laid out the way read()
+            // returns them. Returns how many were about something we're
+            // watching.
+            std::size_t feed(char *buffer, std::size_t length)
+            {
+                std::size_t dispatched = 0;
+                fanotify_event_metadata meta;
+
+                // Events are only 4 byte aligned, and the metadata wants 8,
+                // so it gets copied out
+                for (std::size_t at = 0; at + sizeof(meta) <= length;
+                        at += meta.event_len) {
+                    memcpy(&meta, buffer + at, sizeof(meta));
+                    if (meta.event_len < sizeof(meta)
+                            || at + meta.event_len > length) {
+                        break;
+                    }
+
+                    if (meta.vers != FANOTIFY_METADATA_VERSION) {
+                        throw Exception("Unexpected fanotify version");
+                    }
+
+                    // Shouldn't happen when we're told about handles
+                    if (meta.fd >= 0) close(meta.fd);
+
+                    if (meta.mask & FAN_Q_OVERFLOW) {
+                        throw Exception("Fanotify queue overflowed");
+                    }
+
+                    if (dispatch_(meta, buffer + at)) ++dispatched;
+                }
+
+                return dispatched;
+            }
+
+            // How many directories we know the path of
+            std::size_t cached() const
+            {
+                return dirs_.size();
+            }
+
+        private:
+            // What we can get told about. Conveniently, fanotify's bits
+            // are the same as inotify's.
+            enum : uint64_t {
+                supported = FAN_ACCESS | FAN_MODIFY | FAN_ATTRIB
+                          | FAN_CLOSE_WRITE | FAN_CLOSE_NOWRITE | FAN_OPEN
+                          | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_CREATE
+                          | FAN_DELETE | FAN_DELETE_SELF | FAN_MOVE_SELF,
+                // What we need to hear about to keep the paths we know up
+                // to date, whether or not anyone else wants it
+                tracked = FAN_MOVED_FROM | FAN_DELETE | FAN_MOVE_SELF
+                        | FAN_DELETE_SELF,
+            };
+
+            enum : std::size_t {
+                read_size = 64 * 1024,
+                // Forget every path once we know this many
+                cache_limit = 1 << 16,
+            };
+
+            struct Dir {
+                std::string path;
+                int id;
+                // Under the root and not ignored
+                bool wanted;
+            };
+
+            void mark_(FlagBearer flags)
+            {
+                mask_ |= flags & supported;
+
+                if (fanotify_mark(fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+                                  mask_ | tracked | FAN_ONDIR, AT_FDCWD,
+                                  root_.c_str()) < 0) {
+                    throw Exception("Failed to mark " + root_ + ": "
+                                    + strerror(errno));
+                }
+            }
+
+            bool dispatch_(const fanotify_event_metadata &meta,
+                           const char *record)
+            {
+                // Find the directory the event happened in, and the name of
+                // what it happened to, if there is one
+                const fanotify_event_info_fid *fid = nullptr;
+                for (std::size_t at = meta.metadata_len;
+                        at + sizeof(fanotify_event_info_header)
+                            <= meta.event_len; ) {
+                    const auto *header = (const fanotify_event_info_header*)
+                        (record + at);
+                    if (header->len == 0) break;
+
+                    if (header->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME
+                            || header->info_type == FAN_EVENT_INFO_TYPE_DFID
+                            || header->info_type == FAN_EVENT_INFO_TYPE_FID) {
+                        fid = (const fanotify_event_info_fid*) header;
+                        break;
+                    }
+                    at += header->len;
+                }
+                if (fid == nullptr) return false;
+
+                auto *handle = (file_handle*) fid->handle;
+                const char *name = "";
+                if (fid->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) {
+                    name = (const char*) handle->f_handle
+                         + handle->handle_bytes;
+                }
+
+                const Dir *dir = resolve_(handle);
+                if (dir == nullptr || !dir->wanted) return false;
+
+                const bool is_dir = meta.mask & FAN_ONDIR;
+                const std::size_t name_length = strlen(name);
+
+                if (!rules_.empty() && name_length
+                        && rules_.ignored(relative_(dir->path),
+                                          std::string_view(name,
+                                                           name_length),
+                                          is_dir)) {
+                    return false;
+                }
+
+                // As if inotify had sent it
+                alignas(Event) char storage[sizeof(Event) + NAME_MAX + 4];
+                const std::size_t len = name_length
+                    ? (name_length + 1 + 3) & ~std::size_t(3) : 0;
+
+                Event *ev = (Event*) storage;
+                ev->wd = dir->id;
+                ev->mask = uint32_t(meta.mask & supported);
+                if (is_dir) ev->mask |= Reply::Is_Directory;
+                ev->cookie = 0;
+                ev->len = len;
+                memset(ev->name, 0, len);
+                memcpy(ev->name, name, name_length);
+
+                // Take a copy, since a rename below may forget it
+                const std::string path = dir->path;
+
+                // The handles of anything in a directory that moves or goes
+                // away stay the same, but their paths don't
+                if (is_dir && (meta.mask & (FAN_MOVED_FROM | FAN_DELETE))) {
+                    forget_under_(join_paths(path, name));
+                }
+                if (meta.mask & (FAN_MOVE_SELF | FAN_DELETE_SELF)) {
+                    forget_under_(path);
+                }
+
+                // Only here to keep the paths right
+                if ((ev->mask & mask_) == 0) return false;
+
+                call_(ev, path);
+                return true;
+            }
+
+            void call_(Event *ev, const std::string &path)
+            {
+                _callbacks.for_each_match(ev->mask,
+                        [ev, &path](const Callback &cb) {
+                            cb(ev, path);
+                        });
+
+                if (_view_callbacks.empty()) return;
+
+                const Event_View view = view_of(ev, path);
+
+                _view_callbacks.for_each_match(ev->mask,
+                        [&view](const View_Callback &cb) {
+                            cb(view);
+                        });
+            }
+
+            // The directory with this handle, looking it up if we have to.
+            // Null if it's already gone.
+            const Dir *resolve_(file_handle *handle)
+            {
+                std::string key((const char*) &handle->handle_type,
+                                sizeof(handle->handle_type));
+                key.append((const char*) handle->f_handle,
+                           handle->handle_bytes);
+
+                auto it = dirs_.find(key);
+                if (it != dirs_.end()) return &it->second;
+
+                const int dir_fd = open_by_handle_at(mount_fd_, handle,
+                                                     O_PATH | O_CLOEXEC);
+                if (dir_fd < 0) return nullptr;
+
+                char link[32];
+                snprintf(link, sizeof(link), "/proc/self/fd/%d", dir_fd);
+
+                char path[PATH_MAX];
+                const ssize_t got = readlink(link, path, sizeof(path) - 1);
+                close(dir_fd);
+                if (got <= 0) return nullptr;
+
+                if (dirs_.size() >= cache_limit) dirs_.clear();
+
+                Dir dir{ std::string(path, got), next_id_, false };
+                // Two billion directories in, numbers come around again
+                next_id_ = (next_id_ == INT_MAX) ? 1 : next_id_ + 1;
+                dir.wanted = wanted_(dir.path);
+
+                if (WATCHDOG_DEBUG) {
+                    fprintf(stderr, "[DEBUG]: Handle resolved to %s\n",
+                            dir.path.c_str());
+                }
+
+                return &dirs_.emplace(std::move(key),
+                                      std::move(dir)).first->second;
+            }
+
+            // Under the root, and neither it nor anything above it (up to
+            // the root) is ignored
+            bool wanted_(const std::string &path) const
+            {
+                if (!Storage_Policy::is_under(path, root_)) return false;
+                if (rules_.empty()) return true;
+
+                const std::string_view relative = relative_(path);
+                for (std::size_t end = relative.find('/', 1);
+                        ; end = relative.find('/', end + 1)) {
+                    if (rules_.ignored(relative.substr(0, end), true)) {
+                        return false;
+                    }
+                    if (end == std::string_view::npos) return true;
+                }
+            }
+
+            std::string_view relative_(const std::string &path) const
+            {
+                std::string_view relative(path);
+                relative.remove_prefix(std::min(root_.size(),
+                                                relative.size()));
+                return relative;
+            }
+
+            void forget_under_(const std::string &path)
+            {
+                for (auto it = dirs_.begin(); it != dirs_.end(); ) {
+                    if (Storage_Policy::is_under(it->second.path, path)) {
+                        it = dirs_.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+
+            Dispatch_Table<Callback> _callbacks;
+            Dispatch_Table<View_Callback> _view_callbacks;
+
+            std::string root_;
+            Ignore_Rules rules_;
+            uint64_t mask_ = 0;
+
+            // Directory handles to what we know about them
+            std::unordered_map<std::string, Dir> dirs_;
+            // Only ever goes up, so ids from before a clear aren't reused
+            int next_id_ = 1;
+
+            int fd;
+            int mount_fd_;
+
+            Poller poller_;
+            // Whether the last run_once() was told to stop
+            bool stopped_ = false;
+    };
+
+} // namespace Watch
+
+#endif
@@ -4,8 +4,8 @@
 #include <sys/inotify.h>
 
 #include <cstddef>
+#include <cstring>
 #include <string>
-
 #include <vector>
 
 #include <watchdog_common.hpp>
@@ -80,67 +80,99 @@ namespace Watch {
             All = Events | Replies | Flags
         };
 
-        std::vector<std::string> get_names(const FlagBearer flags,
-                                           const FlagBearer _names)
-        {
-            std::vector<std::string> names;
+        struct Flag_Name {
+            FlagBearer flag;
+            // Which of Names it belongs to
+            FlagBearer group;
+            const char *name;
+        };
 
-            if (_names & Names::Events) {
-                // Filesystem events
-                if (flags & On::Access) {
-                    names.push_back("Access");
-                } if (flags & On::Attributes) {
-                    names.push_back("Attributes");
-                } if (flags & On::Close_Write) {
-                    names.push_back("Close_Write");
-                } if (flags & On::Close_Nowrite) {
-                    names.push_back("Close_Nowrite");
-                } if (flags & On::Create) {
-                    names.push_back("Create");
-                } if (flags & On::Delete) {
-                    names.push_back("Delete");
-                } if (flags & On::Delete_Sub) {
-                    names.push_back("Delete_Sub");
-                } if (flags & On::Modify) {
-                    names.push_back("Modify");
-                } if (flags & On::Move) {
-                    names.push_back("Move");
-                } if (flags & On::Moved_From) {
-                    names.push_back("Moved_From");
-                } if (flags & On::Moved_To) {
-                    names.push_back("Moved_To");
-                } if (flags & On::Open) {
-                    names.push_back("Open");
-                }
-            }
+        // Every flag with a name, in the order names are listed
+        constexpr Flag_Name names[] = {
+            // Filesystem events
+            { On::Access, Events, "Access" },
+            { On::Attributes, Events, "Attributes" },
+            { On::Close_Write, Events, "Close_Write" },
+            { On::Close_Nowrite, Events, "Close_Nowrite" },
+            { On::Create, Events, "Create" },
+            { On::Delete, Events, "Delete" },
+            { On::Delete_Sub, Events, "Delete_Sub" },
+            { On::Modify, Events, "Modify" },
+            { On::Move, Events, "Move" },
+            { On::Moved_From, Events, "Moved_From" },
+            { On::Moved_To, Events, "Moved_To" },
+            { On::Open, Events, "Open" },
+
+            // On read
+            { Reply::Ignored, Replies, "Ignored" },
+            { Reply::Is_Directory, Replies, "Is_Directory" },
+            { Reply::Overflow, Replies, "Overflow" },
+            { Reply::Unmounted, Replies, "Unmounted" },
+
+            // Other flags
+            { Flags::No_Follow, Flags, "No_Follow" },
+            { Flags::Unlink, Flags, "Unlink" },
+            { Flags::Add, Flags, "Add" },
+            { Flags::Once, Flags, "Once" },
+            { Flags::Directory_Only, Flags, "Directory_Only" },
+        };
 
-            if (_names & Names::Replies) {
-                // On read
-                if (flags & Reply::Ignored) {
-                    names.push_back("Ignored");
-                } if (flags & Reply::Is_Directory) {
-                    names.push_back("Is_Directory");
-                } if (flags & Reply::Overflow) {
-                    names.push_back("Overflow");
-                } if (flags & Reply::Unmounted) {
-                    names.push_back("Unmounted");
-                }
+        // The name of a single flag, or nullptr
+        constexpr const char *name_of(const FlagBearer flag)
+        {
+            for (const auto &entry : names) {
+                if (entry.flag == flag) return entry.name;
             }
+            return nullptr;
+        }
 
-            if (_names & Names::Flags) {
-                // Other flags
-                if (flags & Flags::No_Follow) {
-                    names.push_back("No_Follow");
-                } if (flags & Flags::Unlink) {
-                    names.push_back("Unlink");
-                } if (flags & Flags::Add) {
-                    names.push_back("Add");
-                } if (flags & Flags::Once) {
-                    names.push_back("Once");
-                } if (flags & Flags::Directory_Only) {
-                    names.push_back("Directory_Only");
+        // Calls f(const char *name) for each flag set, in order
+        template <class F>
+        void for_each_name(const FlagBearer flags, const FlagBearer _names,
+                           F f)
+        {
+            for (const auto &entry : names) {
+                if ((entry.group & _names) && (flags & entry.flag)) {
+                    f(entry.name);
                 }
             }
+        }
+
+        // Writes the names into `out`, `separator` between each, and
+        // returns how many characters that took. Stops at a name that
+        // doesn't fit, and doesn't add a terminating null.
+        inline std::size_t format_names(const FlagBearer flags,
+                                        const FlagBearer _names,
+                                        char *out, const std::size_t size,
+                                        const char separator = '|')
+        {
+            std::size_t at = 0;
+            bool full = false;
+
+            for_each_name(flags, _names, [&](const char *name) {
+                    const std::size_t length = strlen(name);
+                    const std::size_t need = length + (at ? 1 : 0);
+                    if (full || at + need > size) {
+                        full = true;
+                        return;
+                    }
+
+                    if (at) out[at++] = separator;
+                    memcpy(out + at, name, length);
+                    at += length;
+                });
+
+            return at;
+        }
+
+        inline std::vector<std::string> get_names(const FlagBearer flags,
+                                                  const FlagBearer _names)
+        {
+            std::vector<std::string> names;
+
+            for_each_name(flags, _names, [&names](const char *name) {
+                    names.push_back(name);
+                });
 
             return names;
         }
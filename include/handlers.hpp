@@ -0,0 +1,113 @@
+#ifndef WATCHDOG_HANDLERS_H
+#define WATCHDOG_HANDLERS_H
+
+#include <sys/inotify.h>
+
+#include <cstddef>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <event_view.hpp>
+#include <watchdog_common.hpp>
+
+namespace Watch {
+
+    // A callable and the events it wants, both fixed when you build. It's
+    // called with an Event_View if it takes one, or else like a Callback,
+    // with the event and its directory (by reference, so nothing's copied).
+    template <FlagBearer Mask, class F>
+    struct Handler {
+        static constexpr FlagBearer mask = Mask;
+        F f;
+    };
+
+    template <FlagBearer Mask, class F>
+    Handler<Mask, std::decay_t<F>> handle(F &&f)
+    {
+        return Handler<Mask, std::decay_t<F>>{ std::forward<F>(f) };
+    }
+
+    // A fixed set of Handlers, for a Sentry that knows everything it will
+    // ever call when it's built (see Static_Sentry in watchdog.hpp). What
+    // to watch for is worked out at compile time, and dispatching is a
+    // branch per handler on a constant mask, with each call inlined. No
+    // std::function, no table, nothing to look up.
+    //
+    //   auto handlers = make_handlers(
+    //       handle<On::Create>([](const Event_View &ev) { ... }),
+    //       handle<On::Modify | On::Close_Write>(on_write));
+    //   Static_Sentry<Recursively, decltype(handlers)> sentry(path,
+    //                                                         handlers);
+    //
+    // Handlers run in the order given, before any added with
+    // `add_callback()`.
+    template <class... Hs>
+    class Handlers {
+        public:
+            static constexpr FlagBearer mask = (FlagBearer(0) | ...
+                                                | Hs::mask);
+
+            Handlers(Hs... handlers) : handlers_(std::move(handlers)...) {}
+
+            void operator()(inotify_event *ev, const std::string &path)
+            {
+                call_(ev, path, std::index_sequence_for<Hs...>());
+            }
+
+        private:
+            // Whether anyone wants a view, so it's only made if they do
+            template <class H>
+            static constexpr bool takes_view_()
+            {
+                return std::is_invocable<decltype(H::f)&,
+                                         const Event_View&>::value;
+            }
+
+            static constexpr bool any_view_ = (false || ... ||
+                                               takes_view_<Hs>());
+
+            template <std::size_t... I>
+            void call_(inotify_event *ev, const std::string &path,
+                       std::index_sequence<I...>)
+            {
+                if constexpr (any_view_) {
+                    const Event_View view = view_of(ev, path);
+                    (call_one_<I>(ev, path, &view), ...);
+                } else {
+                    (call_one_<I>(ev, path, nullptr), ...);
+                }
+            }
+
+            template <std::size_t I>
+            void call_one_(inotify_event *ev, const std::string &path,
+                           const Event_View *view)
+            {
+                auto &handler = std::get<I>(handlers_);
+                using H = std::remove_reference_t<decltype(handler)>;
+
+                if ((ev->mask & H::mask) == 0) return;
+
+                if constexpr (takes_view_<H>()) {
+                    handler.f(*view);
+                } else {
+                    handler.f(ev, path);
+                }
+            }
+
+            std::tuple<Hs...> handlers_;
+    };
+
+    template <class... Hs>
+    Handlers<Hs...> make_handlers(Hs... handlers)
+    {
+        return Handlers<Hs...>(std::move(handlers)...);
+    }
+
+    // What a Sentry has unless told otherwise
+    using No_Handlers = Handlers<>;
+
+} // namespace Watch
+
+#endif
@@ -1,113 +1,299 @@
 #ifndef WATCHDOG_HELPERS_H
 #define WATCHDOG_HELPERS_H
 
-// ftw
-// From `man nftw`: By default, directories are handled before the files and
-// subdirectories they contain (preorder traversal). However, this does not
-// seem to be true.
-#include <ftw.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <string>
 
-#ifndef WATCHDOG_THREADSAFE
-#define WATCHDOG_THREADSAFE false
-#endif
-
-#if WATCHDOG_THREADSAFE
-#include <mutex>
-#endif
-
-#if WATCHDOG_THREADSAFE
-#include <stdio.h>
+#ifndef WATCHDOG_DEBUG
+#define WATCHDOG_DEBUG false
 #endif
 
 #include <exceptions.hpp>
 
-namespace {
-#if WATCHDOG_THREADSAFE
-    std::mutex path_m;
-#endif
-    std::vector<std::string> static_paths;
+namespace Watch {
 
-    void add_path(const std::string fpath)
+    const char path_sep = '/';
+
+    inline std::string join_paths(const std::string &lhs,
+                                  const std::string &rhs)
     {
-#if WATCHDOG_THREADSAFE
-        std::lock_guard<std::mutex> lock(path_m);
-#endif
-        static_paths.push_back(fpath);
+        if (lhs.empty()) return rhs;
+        if (rhs.empty()) return lhs;
+
+        std::string joined = lhs;
+
+        if (lhs.back() != path_sep) {
+            joined += path_sep;
+        }
+        joined += rhs;
+
+        return joined;
     }
 
-    enum class FTW : int {
-        Continue = 0,
-        Stop = 1,
-    };
+    // Return true to skip a directory and everything under it. Called from
+    // several threads at once, so it had better not modify anything.
+    using Prune = std::function<bool(const std::string &path)>;
 
+    // Called with every directory found (the root too) just before it's
+    // read. Return false to leave it unread. Called from several threads at
+    // once.
+    using Visit = std::function<bool(const std::string &path)>;
 
-    int ftw_callback(const char *fpath,
-                     const struct stat *sb,
-                     int typeflag)
-    {
-        (void) sb;
+    // Finds every directory under a root, in parallel.
+    //
+    // Each worker reads directories with getdents64, which hands us the type
+    // of every entry, so we only have to stat() on filesystems that don't
+    // fill in d_type. Workers keep their own queue of directories to read,
+    // and go steal from everyone else's when theirs runs dry.
+    //
+    // Symbolic links are never followed below the root (which may be one),
+    // so there's no way to loop forever.
+    // Nothing is shared between calls, so go ahead and crawl from as many
+    // threads as you like.
+    class Crawler {
+        public:
+            // 0 threads means one per core
+            Crawler(Prune prune = nullptr, unsigned threads = 0,
+                    Visit visit = nullptr)
+                : prune_(std::move(prune)), visit_(std::move(visit)),
+                  threads_(threads)
+            {
+                if (threads_ == 0) {
+                    threads_ = std::thread::hardware_concurrency();
+                }
+                if (threads_ == 0) threads_ = 1;
+            }
 
-        // Do not record anything that isn't a directory
-        if (typeflag == FTW_F) return (int) FTW::Continue;
-        if (typeflag != FTW_D) return (int) FTW::Continue;
+            // The root always comes first, whether or not we could read it.
+            // Everything else is in no particular order.
+            std::vector<std::string> run(const std::string &root)
+            {
+                std::vector<Worker> workers(threads_);
 
-#if WATCHDOG_DEBUG
-        fprintf(stderr, "[DEBUG/FTW]: Found directory %s\n", fpath);
-#endif
+                root_ = root;
+                pending_ = 1;
+                workers[0].queue.push_back(root);
 
-        add_path(fpath);
+                std::vector<std::thread> helpers;
+                for (unsigned i = 1; i < threads_; ++i) {
+                    helpers.emplace_back(&Crawler::work, this,
+                                         std::ref(workers), i);
+                }
+                work(workers, 0);
 
-        return (int) FTW::Continue;
-    }
+                for (auto &helper : helpers) helper.join();
 
+                std::size_t total = 0;
+                for (const auto &worker : workers) {
+                    total += worker.found.size();
+                }
 
-}
+                std::vector<std::string> found;
+                found.reserve(total + 1);
+                found.push_back(root);
+                for (auto &worker : workers) {
+                    for (auto &path : worker.found) {
+                        found.push_back(std::move(path));
+                    }
+                }
 
-namespace Watch {
+                return found;
+            }
 
-    const char path_sep = '/';
+        private:
+            // Not in any header that glibc gives us
+            struct linux_dirent64 {
+                uint64_t d_ino;
+                int64_t d_off;
+                unsigned short d_reclen;
+                unsigned char d_type;
+                // Really as long as it needs to be, up to d_reclen
+                char d_name[NAME_MAX + 1];
+            };
 
-    std::string join_paths(const std::string &lhs, const std::string &rhs)
-    {
-        if (lhs.empty()) return rhs;
-        if (rhs.empty()) return lhs;
+            struct Worker {
+                std::mutex m;
+                std::deque<std::string> queue;
+                std::vector<std::string> found;
+            };
 
-        std::string joined = lhs;
+            void work(std::vector<Worker> &workers, unsigned self)
+            {
+                std::unique_ptr<char[]> buffer(new char[buffer_length]);
+                std::string dir;
+                unsigned idle = 0;
 
-        if (lhs.back() != path_sep) {
-            joined += path_sep;
-        }
-        joined += rhs;
+                while (pending_.load() != 0) {
+                    if (!take(workers, self, dir)) {
+                        // Everyone else is still busy with what they have
+                        if (++idle < 64) {
+                            std::this_thread::yield();
+                        } else {
+                            std::this_thread::sleep_for(
+                                    std::chrono::microseconds(50));
+                        }
+                        continue;
+                    }
+                    idle = 0;
 
-        return joined;
-    }
+                    read_dir(workers[self], dir, buffer.get());
+                    --pending_;
+                }
+            }
+
+            // Newest from our own queue, since it's probably still cached,
+            // otherwise the oldest from somebody else's
+            bool take(std::vector<Worker> &workers, unsigned self,
+                      std::string &dir)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(workers[self].m);
+                    if (!workers[self].queue.empty()) {
+                        dir = std::move(workers[self].queue.back());
+                        workers[self].queue.pop_back();
+                        return true;
+                    }
+                }
+
+                for (unsigned i = 1; i < workers.size(); ++i) {
+                    Worker &victim = workers[(self + i) % workers.size()];
+
+                    std::lock_guard<std::mutex> lock(victim.m);
+                    if (!victim.queue.empty()) {
+                        dir = std::move(victim.queue.front());
+                        victim.queue.pop_front();
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+
+            void read_dir(Worker &worker, const std::string &dir,
+                          char *buffer)
+            {
+                if (visit_ && !visit_(dir)) return;
+
+                // Whatever we found was a directory, and had better still
+                // be one rather than a link put there since
+                const int follow = (dir == root_) ? 0 : O_NOFOLLOW;
+                int fd = openat(AT_FDCWD, dir.c_str(),
+                        O_RDONLY | O_DIRECTORY | O_CLOEXEC | follow);
+                if (fd < 0) return; // Gone, or we aren't allowed in
+
+                std::vector<std::string> subdirs;
+
+                while (true) {
+                    long got = syscall(SYS_getdents64, fd, buffer,
+                                       buffer_length);
+                    if (got <= 0) break;
+
+                    for (long i = 0; i < got; ) {
+                        auto *entry = (linux_dirent64*) &buffer[i];
+                        i += entry->d_reclen;
+
+                        if (!is_directory(fd, entry)) continue;
+
+                        std::string path = join_paths(dir, entry->d_name);
+
+                        if (prune_ && prune_(path)) {
+                            if (WATCHDOG_DEBUG) {
+                                fprintf(stderr, "[DEBUG/Crawl]: Pruning "
+                                        "%s\n", path.c_str());
+                            }
+                            continue;
+                        }
+
+                        subdirs.push_back(std::move(path));
+                    }
+                }
 
-    std::vector<std::string>
+                close(fd);
+
+                if (subdirs.empty()) return;
+
+                pending_ += subdirs.size();
+                worker.found.insert(worker.found.end(),
+                                    subdirs.begin(), subdirs.end());
+
+                std::lock_guard<std::mutex> lock(worker.m);
+                for (auto &subdir : subdirs) {
+                    worker.queue.push_back(std::move(subdir));
+                }
+            }
+
+            static bool is_directory(int dirfd, const linux_dirent64 *entry)
+            {
+                const char *name = entry->d_name;
+                if (name[0] == '.' && (name[1] == '\0'
+                            || (name[1] == '.' && name[2] == '\0'))) {
+                    return false;
+                }
+
+                if (entry->d_type != DT_UNKNOWN) {
+                    return entry->d_type == DT_DIR;
+                }
+
+                // Some filesystems don't tell us, so go ask
+                struct stat sb;
+                if (fstatat(dirfd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+                    return false;
+                }
+                return S_ISDIR(sb.st_mode);
+            }
+
+            static const std::size_t buffer_length = 32 * 1024;
+
+            Prune prune_;
+            Visit visit_;
+            unsigned threads_;
+
+            std::string root_;
+            // Directories found but not yet read
+            std::atomic<std::size_t> pending_{0};
+    };
+
+    // Every directory under (and including) path, root first
+    inline std::vector<std::string>
     enumerateSubdirectories(const std::string &path,
-                            const int max_open_fd = 256)
+                            Prune prune = nullptr,
+                            const unsigned threads = 0)
     {
-#if WATCHDOG_THREADSAFE
-        // Only allow one fs crawl at a time :|
-        static std::mutex enumeration_lock;
-        std::lock_guard<std::mutex> master_lock(enumeration_lock);
-#endif
+        return Crawler(std::move(prune), threads).run(path);
+    }
 
-        { // Scope the lock_guard
-#if WATCHDOG_THREADSAFE
-            std::lock_guard<std::mutex> lock(path_m);
-#endif
-            static_paths.clear();
+    // What this used to take, back when it was ftw() underneath. Each
+    // thread only has one directory open at a time, so `max_open_fd` caps
+    // the threads instead.
+    inline std::vector<std::string>
+    enumerateSubdirectories(const std::string &path, const int max_open_fd)
+    {
+        unsigned threads = std::thread::hardware_concurrency();
+        if (threads == 0) threads = 1;
+        if (max_open_fd > 0 && unsigned(max_open_fd) < threads) {
+            threads = unsigned(max_open_fd);
         }
 
-        ftw(path.c_str(), ftw_callback, max_open_fd);
-
-        return std::vector<std::string>(static_paths);
+        return Crawler(nullptr, threads).run(path);
     }
 
 } // Watch
 
 #endif
-
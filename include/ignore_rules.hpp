@@ -0,0 +1,457 @@
+#ifndef WATCHDOG_IGNORE_RULES_H
+#define WATCHDOG_IGNORE_RULES_H
+
+#include <cstddef>
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace Watch {
+
+    // Rules for what not to watch, written like .gitignore lines:
+    //
+    //  * `name` matches anything called that, at any depth
+    //  * `some/path` (any slash but a trailing one) or `/name` only matches
+    //    relative to the root
+    //  * `*`, `?` and `[...]` match within a single component, and `**`
+    //    matches any number of them
+    //  * a trailing `/` only matches directories
+    //  * a leading `!` brings back something an earlier rule ignored
+    //  * `#` starts a comment, and `\` escapes whatever follows it
+    //
+    // The last rule to match wins. Once a directory is ignored, nothing under
+    // it is looked at, so (like git) a `!` can't bring back something whose
+    // parent is ignored.
+    //
+    // Most rules are plain names (`node_modules`, `.git`), which are looked
+    // up in a hash table. Plain anchored paths go in a trie of components.
+    // Only rules with wildcards in them get matched one at a time.
+    //
+    // Matching never modifies anything, so it's safe from several threads.
+    class Ignore_Rules {
+        public:
+            Ignore_Rules() = default;
+
+            explicit Ignore_Rules(const std::vector<std::string> &patterns)
+            {
+                for (const auto &pattern : patterns) add(pattern);
+            }
+
+            // The indexes point into rules_, so a copy builds its own
+            Ignore_Rules(const Ignore_Rules &src)
+            {
+                for (const auto &rule : src.rules_) insert(rule);
+            }
+
+            Ignore_Rules& operator=(const Ignore_Rules &src)
+            {
+                if (this != &src) *this = Ignore_Rules(src);
+                return *this;
+            }
+
+            // Moving takes the deque's storage along, so the keys stay
+            // good. What's left behind is empty.
+            Ignore_Rules(Ignore_Rules &&src)
+                : rules_(std::move(src.rules_)),
+                  names_(std::move(src.names_)),
+                  trie_(std::move(src.trie_)),
+                  globs_(std::move(src.globs_))
+            {
+                src.reset();
+            }
+
+            Ignore_Rules& operator=(Ignore_Rules &&src)
+            {
+                if (this != &src) {
+                    rules_ = std::move(src.rules_);
+                    names_ = std::move(src.names_);
+                    trie_ = std::move(src.trie_);
+                    globs_ = std::move(src.globs_);
+                    src.reset();
+                }
+                return *this;
+            }
+
+            // One .gitignore line
+            void add(const std::string &line)
+            {
+                std::string pattern = line;
+
+                // Trailing whitespace doesn't count, unless it's escaped
+                while (!pattern.empty()
+                        && (pattern.back() == '\r' || pattern.back() == ' ')
+                        && !(pattern.size() > 1
+                            && pattern[pattern.size() - 2] == '\\')) {
+                    pattern.pop_back();
+                }
+
+                if (pattern.empty() || pattern[0] == '#') return;
+
+                Rule rule;
+
+                if (pattern[0] == '!') {
+                    rule.negated = true;
+                    pattern.erase(0, 1);
+                }
+
+                if (!pattern.empty() && pattern.back() == '/') {
+                    rule.dir_only = true;
+                    pattern.pop_back();
+                }
+
+                rule.anchored = pattern.find('/') != std::string::npos;
+
+                rule.parts = split(pattern);
+                if (rule.parts.empty()) return;
+
+                // `**/name` is just `name`
+                if (rule.parts.size() == 2 && rule.parts[0] == "**") {
+                    rule.parts.erase(rule.parts.begin());
+                    rule.anchored = false;
+                }
+
+                rule.literal = std::none_of(rule.parts.begin(),
+                        rule.parts.end(), [](const std::string &part) {
+                            return part.find_first_of("*?[\\")
+                                != std::string::npos;
+                        });
+
+                insert(std::move(rule));
+            }
+
+            // Exactly this path (relative to the root) and everything under
+            // it, with no wildcards or escapes
+            void add_literal(const std::string &relative)
+            {
+                Rule rule;
+                rule.anchored = true;
+                rule.literal = true;
+                rule.subtree = true;
+                rule.parts = split(relative);
+                if (rule.parts.empty()) return;
+
+                insert(std::move(rule));
+            }
+
+            // Every line of a .gitignore file. False if it couldn't be read.
+            bool load(const std::string &file)
+            {
+                std::ifstream in(file.c_str());
+                if (!in) return false;
+
+                std::string line;
+                while (std::getline(in, line)) add(line);
+
+                return true;
+            }
+
+            bool empty() const
+            {
+                return rules_.empty();
+            }
+
+            std::size_t size() const
+            {
+                return rules_.size();
+            }
+
+            // `relative` is relative to the root these rules are for
+            bool ignored(std::string_view relative, bool is_dir) const
+            {
+                if (rules_.empty()) return false;
+
+                std::vector<std::string_view> &parts = scratch();
+                parts.clear();
+                split_into(relative, parts);
+
+                return match(parts, is_dir);
+            }
+
+            // Same thing, for `name` in the directory `dir`
+            bool ignored(std::string_view dir, std::string_view name,
+                         bool is_dir) const
+            {
+                if (rules_.empty()) return false;
+
+                // Most of the time, only names need checking
+                if (trie_.size() == 1 && globs_.empty()) {
+                    const int best = by_name(name, is_dir, -1);
+                    return best > -1 && !rules_[best].negated;
+                }
+
+                std::vector<std::string_view> &parts = scratch();
+                parts.clear();
+                split_into(dir, parts);
+                split_into(name, parts);
+
+                return match(parts, is_dir);
+            }
+
+        private:
+            struct Rule {
+                bool negated = false;
+                bool dir_only = false;
+                bool anchored = false;
+                bool literal = false;
+                // Covers everything under it too
+                bool subtree = false;
+                std::vector<std::string> parts;
+            };
+
+            struct Node {
+                std::unordered_map<std::string_view, std::size_t> children;
+                std::vector<int> rules;
+            };
+
+            static std::vector<std::string> split(const std::string &path)
+            {
+                std::vector<std::string> parts;
+
+                std::size_t start = 0;
+                while (start <= path.size()) {
+                    std::size_t end = path.find('/', start);
+                    if (end == std::string::npos) end = path.size();
+
+                    if (end > start) {
+                        parts.emplace_back(path, start, end - start);
+                    }
+                    start = end + 1;
+                }
+
+                return parts;
+            }
+
+            static void split_into(std::string_view path,
+                                   std::vector<std::string_view> &parts)
+            {
+                std::size_t start = 0;
+                while (start <= path.size()) {
+                    std::size_t end = path.find('/', start);
+                    if (end == std::string_view::npos) end = path.size();
+
+                    if (end > start) {
+                        parts.push_back(path.substr(start, end - start));
+                    }
+                    start = end + 1;
+                }
+            }
+
+            // So that matching doesn't allocate once each thread has warmed
+            // up
+            static std::vector<std::string_view> &scratch()
+            {
+                thread_local std::vector<std::string_view> parts;
+                return parts;
+            }
+
+            void reset()
+            {
+                rules_.clear();
+                names_.clear();
+                trie_.assign(1, Node());
+                globs_.clear();
+            }
+
+            void insert(Rule rule)
+            {
+                const int index = static_cast<int>(rules_.size());
+
+                // A deque, so the names our keys point at never move
+                rules_.push_back(std::move(rule));
+                const Rule &added = rules_.back();
+
+                if (!added.literal) {
+                    globs_.push_back(index);
+                } else if (!added.anchored) {
+                    names_[added.parts[0]].push_back(index);
+                } else {
+                    std::size_t node = 0;
+                    for (const auto &part : added.parts) {
+                        auto it = trie_[node].children.find(part);
+                        if (it == trie_[node].children.end()) {
+                            trie_.emplace_back();
+                            it = trie_[node].children.emplace(
+                                    part, trie_.size() - 1).first;
+                        }
+                        node = it->second;
+                    }
+                    trie_[node].rules.push_back(index);
+                }
+            }
+
+            bool applies(int index, bool is_dir) const
+            {
+                return !rules_[index].dir_only || is_dir;
+            }
+
+            // The last rule about a name that applies, if it's after `best`
+            int by_name(std::string_view name, bool is_dir, int best) const
+            {
+                auto it = names_.find(name);
+                if (it == names_.end()) return best;
+
+                for (const int index : it->second) {
+                    if (index > best && applies(index, is_dir)) best = index;
+                }
+                return best;
+            }
+
+            bool match(const std::vector<std::string_view> &parts,
+                       bool is_dir) const
+            {
+                if (parts.empty()) return false;
+
+                int best = by_name(parts.back(), is_dir, -1);
+
+                // Anchored plain paths match from the root down
+                std::size_t node = 0;
+                for (std::size_t i = 0; i < parts.size(); ++i) {
+                    auto it = trie_[node].children.find(parts[i]);
+                    if (it == trie_[node].children.end()) break;
+                    node = it->second;
+
+                    const bool last = i + 1 == parts.size();
+                    for (const int index : trie_[node].rules) {
+                        if (index <= best) continue;
+                        if (last ? applies(index, is_dir)
+                                 : rules_[index].subtree) {
+                            best = index;
+                        }
+                    }
+                }
+
+                for (const int index : globs_) {
+                    if (index <= best || !applies(index, is_dir)) continue;
+
+                    const Rule &rule = rules_[index];
+                    const bool matched = rule.anchored
+                        ? match_parts(rule.parts, 0, parts, 0)
+                        : rule.parts.size() == 1
+                            && glob(rule.parts[0], parts.back());
+
+                    if (matched) best = index;
+                }
+
+                return best > -1 && !rules_[best].negated;
+            }
+
+            static bool match_parts(const std::vector<std::string> &rule,
+                                    std::size_t i,
+                                    const std::vector<std::string_view> &path,
+                                    std::size_t j)
+            {
+                if (i == rule.size()) return j == path.size();
+
+                if (rule[i] == "**") {
+                    // A trailing `**` is everything inside, but not the
+                    // directory itself
+                    if (i + 1 == rule.size()) return j < path.size();
+
+                    for (std::size_t k = j; k <= path.size(); ++k) {
+                        if (match_parts(rule, i + 1, path, k)) return true;
+                    }
+                    return false;
+                }
+
+                return j < path.size() && glob(rule[i], path[j])
+                    && match_parts(rule, i + 1, path, j + 1);
+            }
+
+            // One component against one pattern, with *, ?, [...] and \.
+            // Backs up to the last * on a mismatch, which is all the
+            // backtracking a single component ever needs.
+            static bool glob(std::string_view pattern, std::string_view text)
+            {
+                std::size_t p = 0, t = 0;
+                std::size_t star = std::string_view::npos, resume = 0;
+
+                while (t < text.size()) {
+                    if (p < pattern.size() && pattern[p] == '*') {
+                        star = p++;
+                        resume = t;
+                        continue;
+                    }
+
+                    std::size_t next = p;
+                    if (p < pattern.size()
+                            && one(pattern, next, text[t])) {
+                        p = next;
+                        ++t;
+                        continue;
+                    }
+
+                    if (star == std::string_view::npos) return false;
+                    p = star + 1;
+                    t = ++resume;
+                }
+
+                while (p < pattern.size() && pattern[p] == '*') ++p;
+
+                return p == pattern.size();
+            }
+
+            // Whether the pattern element at `p` matches `c`, moving `p`
+            // past it
+            static bool one(std::string_view pattern, std::size_t &p, char c)
+            {
+                const char first = pattern[p++];
+
+                if (first == '?') return true;
+
+                if (first == '\\' && p < pattern.size()) {
+                    return pattern[p++] == c;
+                }
+
+                if (first != '[') return first == c;
+
+                // A character class, which may not be closed
+                std::size_t q = p;
+                bool negate = false;
+                if (q < pattern.size()
+                        && (pattern[q] == '!' || pattern[q] == '^')) {
+                    negate = true;
+                    ++q;
+                }
+
+                bool matched = false;
+                bool any = false;
+                while (q < pattern.size() && (pattern[q] != ']' || !any)) {
+                    any = true;
+
+                    char low = pattern[q++];
+                    if (low == '\\' && q < pattern.size()) low = pattern[q++];
+
+                    char high = low;
+                    if (q + 1 < pattern.size() && pattern[q] == '-'
+                            && pattern[q + 1] != ']') {
+                        high = pattern[q + 1];
+                        q += 2;
+                    }
+
+                    if (low <= c && c <= high) matched = true;
+                }
+
+                // Unclosed, so it was just a [
+                if (q >= pattern.size()) return c == '[';
+
+                p = q + 1;
+                return matched != negate;
+            }
+
+            std::deque<Rule> rules_;
+
+            // Plain names, anywhere
+            std::unordered_map< std::string_view, std::vector<int> > names_;
+            // Plain paths from the root, starting with an empty root node
+            std::deque<Node> trie_ = std::deque<Node>(1);
+            // Everything else
+            std::vector<int> globs_;
+    };
+
+} // namespace Watch
+
+#endif
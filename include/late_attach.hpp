@@ -0,0 +1,340 @@
+#ifndef WATCHDOG_LATE_ATTACH_H
+#define WATCHDOG_LATE_ATTACH_H
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <flags.hpp>
+#include <helpers.hpp>
+#include <poller.hpp>
+
+namespace Watch {
+
+    struct Attach_Progress {
+        // Watched in the background so far
+        std::size_t directories = 0;
+        // Subtrees left for the background, and how many are done
+        std::size_t subtrees = 0;
+        std::size_t subtrees_done = 0;
+    };
+
+    using Attach_Callback = std::function<void(const Attach_Progress&)>;
+
+    struct Attach_Report {
+        // Watched in the background
+        std::size_t directories = 0;
+        // Events made up for things that changed before they were watched
+        std::size_t caught_up = 0;
+        std::chrono::microseconds duration{0};
+    };
+
+    // Which directories a recursive Sentry watches before its constructor
+    // returns. Everything else is watched by a background thread.
+    struct Attach_Options {
+        // Directories up to this many levels below the root. Negative means
+        // every level, so nothing is left for later (unless `hot` is set,
+        // in which case it's just the root).
+        int hot_depth = -1;
+        // Subtrees, relative to the root, to watch right away no matter
+        // how deep they are
+        std::vector<std::string> hot;
+        // Called on the background thread after each subtree
+        Attach_Callback progress;
+        // Threads for crawling each subtree in the background
+        unsigned threads = 1;
+        // How long what the background found can wait for the reading
+        // thread to pick it up
+        std::chrono::milliseconds pickup{50};
+
+        bool lazy() const
+        {
+            return hot_depth >= 0 || !hot.empty();
+        }
+    };
+
+    // Watches what the constructor left for later, on a thread of its own.
+    //
+    // Nothing here touches the Sentry. Whatever gets watched (and whatever
+    // turned up in a directory before it was watched) waits here until the
+    // reading thread picks it up with `take()`. A watch and its path are
+    // recorded under the same lock, and the reader picks them up after
+    // reading and before dispatching, so events never show up for a watch
+    // the reader can't find yet.
+    class Late_Attach {
+        public:
+            // Don't allow assignment or copying
+            Late_Attach(const Late_Attach &src) = delete;
+            Late_Attach& operator=(const Late_Attach &src) = delete;
+
+            // `roots` are the subtrees to watch, and `since` is when the
+            // Sentry started looking, so anything changed after that needs
+            // catching up on
+            Late_Attach(int fd, std::vector<std::string> roots, Prune prune,
+                        const Attach_Options &options, timespec since)
+                : fd_(fd), roots_(std::move(roots)), prune_(std::move(prune)),
+                  progress_(options.progress), threads_(options.threads),
+                  pickup_(options.pickup),
+                  finished_(promise_.get_future().share())
+            {
+                // Timestamps come from a coarse clock, so give it a little
+                // room, at the cost of maybe catching up on something that
+                // changed just before
+                since_ = int64_t(since.tv_sec) * 1000000000 + since.tv_nsec
+                       - slack;
+            }
+
+            ~Late_Attach()
+            {
+                cancel_ = true;
+                if (thread_.joinable()) thread_.join();
+            }
+
+            // Start watching, for `mask`. Only does anything the first time.
+            void start(uint32_t mask)
+            {
+                if (thread_.joinable()) return;
+
+                mask_ = mask;
+                busy_ = true;
+                thread_ = std::thread(&Late_Attach::run, this);
+            }
+
+            // Watch for more from now on. Whatever was already watched is
+            // handed over first, so the caller can widen those itself.
+            template <class Watched>
+            void widen(uint32_t mask, Watched watched)
+            {
+                std::lock_guard<std::mutex> lock(m_);
+                for (auto &found : watched_) {
+                    watched(found.first, std::move(found.second));
+                }
+                watched_.clear();
+                mask_ = mask;
+            }
+
+            // Hands over watched(int wd, std::string &&path) for everything
+            // watched since last time, then missed(int wd, uint32_t mask,
+            // const char *name) for what changed before it was. Returns
+            // how many things were missed.
+            template <class Watched, class Missed>
+            std::size_t take(Watched watched, Missed missed)
+            {
+                if (!busy_.load()) return 0;
+
+                std::lock_guard<std::mutex> lock(m_);
+                const std::size_t made = take_locked(watched, missed);
+
+                // Nothing more is coming, and the Sentry has it all now
+                if (done_) {
+                    busy_ = false;
+                    if (error_) {
+                        promise_.set_exception(error_);
+                    } else {
+                        promise_.set_value(report_);
+                    }
+                }
+
+                return made;
+            }
+
+            // Still watching, or still has something to hand over
+            bool busy() const
+            {
+                return busy_.load();
+            }
+
+            std::shared_future<Attach_Report> finished() const
+            {
+                return finished_;
+            }
+
+            std::chrono::milliseconds pickup() const
+            {
+                return pickup_;
+            }
+
+        private:
+            struct Late_Event {
+                int wd;
+                uint32_t mask;
+                std::string name;
+            };
+
+            // 50ms
+            enum : int64_t { slack = 50000000 };
+
+            template <class Watched, class Missed>
+            std::size_t take_locked(Watched &watched, Missed &missed)
+            {
+                for (auto &found : watched_) {
+                    watched(found.first, std::move(found.second));
+                }
+                watched_.clear();
+
+                for (const auto &ev : missed_) {
+                    missed(ev.wd, ev.mask, ev.name.c_str());
+                }
+                const std::size_t made = missed_.size();
+                missed_.clear();
+
+                return made;
+            }
+
+            void run()
+            {
+                const auto start = Clock::now();
+                Attach_Progress progress;
+                progress.subtrees = roots_.size();
+
+                std::atomic<std::size_t> directories{0};
+                std::atomic<std::size_t> caught_up{0};
+
+                // Each directory is watched before it's listed, so anything
+                // that turns up in it later is the kernel's to tell us about,
+                // and anything already there gets crawled (and watched) too
+                Visit visit = [&](const std::string &dir) {
+                    if (cancel_) return false;
+
+                    const int wd = watch(dir);
+                    if (wd < 0) return false; // Already gone
+
+                    caught_up += catch_up(wd, dir);
+                    ++directories;
+                    return true;
+                };
+
+                std::exception_ptr error;
+
+                try {
+                    for (const auto &root : roots_) {
+                        if (cancel_) break;
+
+                        Crawler(prune_, threads_, visit).run(root);
+
+                        progress.directories = directories;
+                        ++progress.subtrees_done;
+                        if (progress_) progress_(progress);
+                    }
+
+                } catch (...) {
+                    error = std::current_exception();
+                }
+
+                std::lock_guard<std::mutex> lock(m_);
+                report_.directories = directories;
+                report_.caught_up = caught_up;
+                report_.duration = std::chrono::duration_cast<
+                    std::chrono::microseconds>(Clock::now() - start);
+                error_ = error;
+                done_ = true;
+            }
+
+            int watch(const std::string &dir)
+            {
+                std::lock_guard<std::mutex> lock(m_);
+
+                const int wd = inotify_add_watch(fd_, dir.c_str(), mask_);
+                if (wd >= 0) watched_.emplace_back(wd, dir);
+
+                return wd;
+            }
+
+            // Anything in `dir` created or changed since we started, which
+            // the kernel would have told us about if it had been watched
+            std::size_t catch_up(int wd, const std::string &dir)
+            {
+                std::vector<Late_Event> found;
+
+                DIR *listing = opendir(dir.c_str());
+                if (listing == nullptr) return 0;
+
+                while (dirent *entry = readdir(listing)) {
+                    const char *name = entry->d_name;
+                    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+                        continue;
+                    }
+
+                    struct statx sx;
+                    if (statx(dirfd(listing), name, AT_SYMLINK_NOFOLLOW,
+                              STATX_TYPE | STATX_MTIME | STATX_CTIME
+                              | STATX_BTIME, &sx) < 0) {
+                        continue;
+                    }
+
+                    const bool is_dir = S_ISDIR(sx.stx_mode);
+
+                    // A directory's times change along with what's in it,
+                    // which the kernel wouldn't have told us about
+                    uint32_t mask = 0;
+                    if ((sx.stx_mask & STATX_BTIME)
+                            && nanoseconds(sx.stx_btime) >= since_) {
+                        mask = On::Create;
+                    } else if (!is_dir
+                            && (nanoseconds(sx.stx_mtime) >= since_
+                                || nanoseconds(sx.stx_ctime) >= since_)) {
+                        mask = On::Modify;
+                    }
+                    if (mask == 0) continue;
+
+                    if (is_dir) mask |= Reply::Is_Directory;
+                    found.push_back(Late_Event{ wd, mask, name });
+                }
+
+                closedir(listing);
+
+                if (!found.empty()) {
+                    std::lock_guard<std::mutex> lock(m_);
+                    for (auto &ev : found) missed_.push_back(std::move(ev));
+                }
+
+                return found.size();
+            }
+
+            static int64_t nanoseconds(const statx_timestamp &ts)
+            {
+                return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+            }
+
+            int fd_;
+            std::vector<std::string> roots_;
+            Prune prune_;
+            Attach_Callback progress_;
+            unsigned threads_;
+            std::chrono::milliseconds pickup_;
+            int64_t since_;
+
+            std::promise<Attach_Report> promise_;
+            std::shared_future<Attach_Report> finished_;
+
+            std::mutex m_;
+            uint32_t mask_ = 0;
+            std::vector< std::pair<int, std::string> > watched_;
+            std::vector<Late_Event> missed_;
+            bool done_ = false;
+            Attach_Report report_;
+            std::exception_ptr error_;
+
+            std::atomic<bool> busy_{false};
+            std::atomic<bool> cancel_{false};
+            std::thread thread_;
+    };
+
+} // namespace Watch
+
+#endif
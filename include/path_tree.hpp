@@ -0,0 +1,561 @@
+#ifndef WATCHDOG_PATH_TREE_H
+#define WATCHDOG_PATH_TREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <storage_policies.hpp>
+
+namespace Watch {
+
+    // Stores watched directories as a tree instead of as full paths. Each
+    // directory is one small node (its parent, and the id of its name), and
+    // each distinct name is only stored once, however many directories share
+    // it. Paths are put back together on demand.
+    //
+    // That costs a few dozen bytes per directory instead of a few hundred,
+    // which matters once you're watching millions of them. A rename is a
+    // single node update, no matter how much is under it.
+    //
+    // Names are counted, and forgotten along with the last directory
+    // using them, so churning through temporary names doesn't pile up.
+    //
+    // The string `find()` returns lives in a buffer that's reused by the next
+    // call, so copy it if you need it for longer than that.
+    class Compact : public Storage_Policy {
+        public:
+            Compact()
+            {
+                // The roots for absolute and relative paths, which are
+                // never let go of
+                const uint32_t root = intern("");
+                spans_[root].refs = 2;
+                nodes_.push_back(Node{ none, root, -1, 1 });
+                nodes_.push_back(Node{ none, root, -1, 1 });
+
+                children_.assign(initial_capacity, none);
+            }
+
+            void add(int key, std::string value) override
+            {
+                if (key < 0) return;
+
+                const uint32_t node = walk(value, true);
+                Node &n = nodes_[node];
+
+                if (n.wd == key) return;
+
+                if (n.wd >= 0) {
+                    // Same path, new watch, so the old one is dead
+                    by_wd_[n.wd] = none;
+                    --size_;
+                } else {
+                    ++n.refs;
+                }
+
+                // A wd we had somewhere else has moved here
+                if (contains(key)) remove(key);
+
+                n.wd = key;
+                if (by_wd_.size() <= std::size_t(key)) {
+                    by_wd_.resize(std::size_t(key) + 1, none);
+                }
+                by_wd_[key] = node;
+                ++size_;
+
+                cached_ = -1;
+            }
+
+            const std::string &find(int key) const override
+            {
+                if (!contains(key)) return Storage_Policy::none();
+
+                if (key != cached_) {
+                    build(by_wd_[key], buffer_);
+                    cached_ = key;
+                }
+
+                return buffer_;
+            }
+
+            bool contains(int key) const override
+            {
+                return key >= 0 && std::size_t(key) < by_wd_.size()
+                    && by_wd_[key] != none;
+            }
+
+            void remove(int key) override
+            {
+                if (!contains(key)) return;
+
+                const uint32_t node = by_wd_[key];
+                by_wd_[key] = none;
+                nodes_[node].wd = -1;
+                --size_;
+
+                release(node);
+                cached_ = -1;
+            }
+
+            void repath(const std::string &from,
+                        const std::string &to) override
+            {
+                const uint32_t node = walk(from, false);
+                if (node == none || node <= relative_root) return;
+
+                // Where it's going, which has to exist for it to go there.
+                // Right under "/" is still absolute.
+                const std::size_t cut = to.find_last_of('/');
+                const uint32_t parent = (cut == std::string::npos)
+                    ? relative_root
+                    : walk(to.substr(0, std::max<std::size_t>(cut, 1)),
+                           true);
+                const uint32_t name = intern(
+                        std::string_view(to).substr(
+                            cut == std::string::npos ? 0 : cut + 1));
+                ++spans_[name].refs;
+
+                // Hold on to the new parent before letting go of the old
+                // one, in case the one is under the other
+                ++nodes_[parent].refs;
+
+                unlink(node);
+                const uint32_t old_parent = nodes_[node].parent;
+                const uint32_t old_name = nodes_[node].name;
+                nodes_[node].parent = parent;
+                nodes_[node].name = name;
+                drop_name(old_name);
+
+                // Whatever had that name before is gone, along with
+                // anything we thought was under it
+                const std::size_t slot = find_child(parent, name);
+                const uint32_t replaced = children_[slot];
+                if (replaced != none) unlink(replaced);
+                link(node);
+
+                if (replaced != none) forget_under(replaced);
+
+                release(old_parent);
+                cached_ = -1;
+            }
+
+            void append(const Compact &s)
+            {
+                s.for_each([this](int wd, const std::string &path) {
+                        add(wd, path);
+                    });
+            }
+
+            std::size_t size() const
+            {
+                return size_;
+            }
+
+            // Calls f(wd, path) for each watch, in order of wd
+            template <class F>
+            void for_each(F f) const
+            {
+                std::string path;
+
+                for (std::size_t wd = 0; wd < by_wd_.size(); ++wd) {
+                    if (by_wd_[wd] == none) continue;
+
+                    build(by_wd_[wd], path);
+                    f(int(wd), path);
+                }
+            }
+
+            // Roughly how much memory we're holding on to
+            std::size_t footprint() const
+            {
+                return nodes_.capacity() * sizeof(Node)
+                    + free_.capacity() * sizeof(uint32_t)
+                    + children_.capacity() * sizeof(uint32_t)
+                    + by_wd_.capacity() * sizeof(uint32_t)
+                    + names_.capacity()
+                    + spans_.capacity() * sizeof(Span)
+                    + interned_.capacity() * sizeof(uint32_t)
+                    + free_names_.capacity() * sizeof(uint32_t)
+                    + scratch_.capacity() * sizeof(uint32_t);
+            }
+
+        private:
+            enum : uint32_t { none = UINT32_MAX };
+            enum : uint32_t { absolute_root = 0, relative_root = 1 };
+            enum : std::size_t { initial_capacity = 16 };
+
+            struct Node {
+                uint32_t parent;
+                uint32_t name;
+                int wd;
+                // Children, plus one if it's watched itself. Nodes without
+                // any are recycled.
+                uint32_t refs;
+            };
+
+            // Where a name lives in names_, and how many nodes have it
+            struct Span {
+                uint32_t offset;
+                uint32_t length;
+                uint32_t refs;
+            };
+
+            std::string_view name_of(uint32_t name) const
+            {
+                return std::string_view(names_).substr(spans_[name].offset,
+                                                       spans_[name].length);
+            }
+
+            static std::size_t hash_name(std::string_view name)
+            {
+                // FNV-1a
+                std::size_t hash = 14695981039346656037ull;
+                for (const char c : name) {
+                    hash = (hash ^ static_cast<unsigned char>(c))
+                         * 1099511628211ull;
+                }
+                return hash;
+            }
+
+            static std::size_t hash_child(uint32_t parent, uint32_t name)
+            {
+                uint64_t key = (uint64_t(parent) << 32) | name;
+                key ^= key >> 33;
+                key *= 0xff51afd7ed558ccdull;
+                key ^= key >> 33;
+                return std::size_t(key);
+            }
+
+            // Either the slot with this name, or the empty one where it
+            // would go
+            std::size_t find_name(std::string_view name) const
+            {
+                const std::size_t mask = interned_.size() - 1;
+                std::size_t i = hash_name(name) & mask;
+
+                for (; interned_[i] != none; i = (i + 1) & mask) {
+                    if (name_of(interned_[i]) == name) return i;
+                }
+
+                return i;
+            }
+
+            // The id of `name`, or none if we haven't seen it
+            uint32_t lookup(std::string_view name) const
+            {
+                if (interned_.empty()) return none;
+                return interned_[find_name(name)];
+            }
+
+            // The id of `name`, which is added if we haven't seen it. It's
+            // up to the caller to count itself in.
+            uint32_t intern(std::string_view name)
+            {
+                if (interned_.empty()) {
+                    interned_.assign(initial_capacity, none);
+                }
+
+                const std::size_t i = find_name(name);
+                if (interned_[i] != none) return interned_[i];
+
+                const Span span{ uint32_t(names_.size()),
+                                 uint32_t(name.size()), 0 };
+                uint32_t id;
+                if (!free_names_.empty()) {
+                    id = free_names_.back();
+                    free_names_.pop_back();
+                    spans_[id] = span;
+                } else {
+                    id = uint32_t(spans_.size());
+                    spans_.push_back(span);
+                }
+                names_.append(name.data(), name.size());
+                interned_[i] = id;
+
+                const std::size_t live = spans_.size() - free_names_.size();
+                if (live * 4 > interned_.size() * 3) {
+                    std::vector<uint32_t> old(interned_.size() * 2, none);
+                    old.swap(interned_);
+                    const std::size_t mask = interned_.size() - 1;
+                    for (const uint32_t id_ : old) {
+                        if (id_ == none) continue;
+                        std::size_t j = hash_name(name_of(id_)) & mask;
+                        while (interned_[j] != none) j = (j + 1) & mask;
+                        interned_[j] = id_;
+                    }
+                }
+
+                return id;
+            }
+
+            // Let go of a name, and forget it once nobody has it
+            void drop_name(uint32_t name)
+            {
+                if (--spans_[name].refs != 0) return;
+
+                // Backward shift deletion, like unlink()
+                const std::size_t mask = interned_.size() - 1;
+                std::size_t hole = find_name(name_of(name));
+
+                for (std::size_t i = (hole + 1) & mask;
+                        interned_[i] != none;
+                        i = (i + 1) & mask) {
+                    const std::size_t home = hash_name(name_of(interned_[i]))
+                                             & mask;
+
+                    bool stays = (hole < i)
+                        ? (hole < home && home <= i)
+                        : (hole < home || home <= i);
+                    if (stays) continue;
+
+                    interned_[hole] = interned_[i];
+                    hole = i;
+                }
+
+                interned_[hole] = none;
+                free_names_.push_back(name);
+
+                // Its bytes stay where they are until half of names_ is
+                // dead, so moving the rest down costs no more than what
+                // was forgotten
+                dead_ += spans_[name].length;
+                spans_[name].length = 0;
+                if (dead_ * 2 > names_.size()) compact_names();
+            }
+
+            // Slides the names still in use down over the dead ones, in
+            // place, so that names_ never needs more room than it had
+            void compact_names()
+            {
+                scratch_.clear();
+                for (uint32_t id = 0; id < spans_.size(); ++id) {
+                    if (spans_[id].refs != 0) scratch_.push_back(id);
+                }
+                std::sort(scratch_.begin(), scratch_.end(),
+                        [this](uint32_t a, uint32_t b) {
+                            return spans_[a].offset < spans_[b].offset;
+                        });
+
+                std::size_t end = 0;
+                for (const uint32_t id : scratch_) {
+                    Span &span = spans_[id];
+                    memmove(&names_[end], &names_[span.offset], span.length);
+                    span.offset = uint32_t(end);
+                    end += span.length;
+                }
+
+                names_.resize(end);
+                dead_ = 0;
+            }
+
+            // Either the slot with this child, or the empty one where it
+            // would go
+            std::size_t find_child(uint32_t parent, uint32_t name) const
+            {
+                const std::size_t mask = children_.size() - 1;
+                std::size_t i = hash_child(parent, name) & mask;
+
+                for (; children_[i] != none; i = (i + 1) & mask) {
+                    const Node &n = nodes_[children_[i]];
+                    if (n.parent == parent && n.name == name) return i;
+                }
+
+                return i;
+            }
+
+            void link(uint32_t node)
+            {
+                if ((children_count_ + 1) * 4 > children_.size() * 3) {
+                    grow();
+                }
+
+                const std::size_t i = find_child(nodes_[node].parent,
+                                                 nodes_[node].name);
+                children_[i] = node;
+                ++children_count_;
+            }
+
+            // Backward shift deletion, like Flat
+            void unlink(uint32_t node)
+            {
+                const std::size_t mask = children_.size() - 1;
+                std::size_t hole = find_child(nodes_[node].parent,
+                                              nodes_[node].name);
+                if (children_[hole] != node) return;
+
+                for (std::size_t i = (hole + 1) & mask;
+                        children_[i] != none;
+                        i = (i + 1) & mask) {
+                    const Node &n = nodes_[children_[i]];
+                    const std::size_t home = hash_child(n.parent, n.name)
+                                             & mask;
+
+                    bool stays = (hole < i)
+                        ? (hole < home && home <= i)
+                        : (hole < home || home <= i);
+                    if (stays) continue;
+
+                    children_[hole] = children_[i];
+                    hole = i;
+                }
+
+                children_[hole] = none;
+                --children_count_;
+            }
+
+            void grow()
+            {
+                std::vector<uint32_t> old(children_.size() * 2, none);
+                old.swap(children_);
+
+                const std::size_t mask = children_.size() - 1;
+                for (const uint32_t node : old) {
+                    if (node == none) continue;
+
+                    const Node &n = nodes_[node];
+                    std::size_t i = hash_child(n.parent, n.name) & mask;
+                    while (children_[i] != none) i = (i + 1) & mask;
+                    children_[i] = node;
+                }
+            }
+
+            // The node for `path`, making it (and everything above it) if
+            // `create` is set. Otherwise, none if it isn't there.
+            uint32_t walk(std::string_view path, bool create)
+            {
+                uint32_t node = (!path.empty() && path[0] == '/')
+                    ? absolute_root : relative_root;
+
+                std::size_t start = 0;
+                while (start <= path.size()) {
+                    std::size_t end = path.find('/', start);
+                    if (end == std::string_view::npos) end = path.size();
+
+                    if (end > start) {
+                        node = child(node, path.substr(start, end - start),
+                                     create);
+                        if (node == none) return none;
+                    }
+                    start = end + 1;
+                }
+
+                return node;
+            }
+
+            uint32_t child(uint32_t parent, std::string_view name_,
+                           bool create)
+            {
+                // Looking for something that isn't there shouldn't cost
+                // us a name
+                const uint32_t name = create ? intern(name_) : lookup(name_);
+                if (name == none) return none;
+
+                const std::size_t i = find_child(parent, name);
+                if (children_[i] != none) return children_[i];
+                if (!create) return none;
+
+                uint32_t node;
+                if (!free_.empty()) {
+                    node = free_.back();
+                    free_.pop_back();
+                    nodes_[node] = Node{ parent, name, -1, 0 };
+                } else {
+                    node = uint32_t(nodes_.size());
+                    nodes_.push_back(Node{ parent, name, -1, 0 });
+                }
+
+                ++nodes_[parent].refs;
+                ++spans_[name].refs;
+                link(node);
+
+                return node;
+            }
+
+            // Drop a reference, and recycle the node (and maybe its
+            // parents) once nothing needs it
+            void release(uint32_t node)
+            {
+                while (node > relative_root && --nodes_[node].refs == 0) {
+                    const uint32_t parent = nodes_[node].parent;
+
+                    unlink(node);
+                    free_.push_back(node);
+                    drop_name(nodes_[node].name);
+
+                    node = parent;
+                }
+            }
+
+            // Drop every watch at or under `node`, which lets it (and its
+            // hold on its parent) go once the last one is gone. Only for
+            // something already unlinked, since this goes through every
+            // watch.
+            void forget_under(uint32_t node)
+            {
+                for (std::size_t wd = 0; wd < by_wd_.size(); ++wd) {
+                    uint32_t n = by_wd_[wd];
+                    while (n != none && n > relative_root && n != node) {
+                        n = nodes_[n].parent;
+                    }
+                    if (n == node) remove(int(wd));
+                }
+            }
+
+            void build(uint32_t node, std::string &path) const
+            {
+                chain_.clear();
+                for (uint32_t n = node; n > relative_root;
+                        n = nodes_[n].parent) {
+                    chain_.push_back(n);
+                }
+
+                uint32_t root = chain_.empty() ? node
+                                               : nodes_[chain_.back()].parent;
+
+                path.clear();
+                if (root == absolute_root) path += '/';
+
+                for (std::size_t i = chain_.size(); i > 0; --i) {
+                    if (i != chain_.size()) path += '/';
+                    const std::string_view name = name_of(
+                            nodes_[chain_[i - 1]].name);
+                    path.append(name.data(), name.size());
+                }
+            }
+
+            std::vector<Node> nodes_;
+            std::vector<uint32_t> free_;
+
+            // (parent, name) to node
+            std::vector<uint32_t> children_;
+            std::size_t children_count_ = 0;
+
+            // wd to node
+            std::vector<uint32_t> by_wd_;
+            std::size_t size_ = 0;
+
+            // Every name we've seen, back to back
+            std::string names_;
+            std::vector<Span> spans_;
+            std::vector<uint32_t> interned_;
+            // Ids of forgotten names, and how much of names_ they left
+            std::vector<uint32_t> free_names_;
+            std::size_t dead_ = 0;
+            // For sorting names by where they are when compacting
+            std::vector<uint32_t> scratch_;
+
+            // The last path find() built, and scratch space for building
+            mutable std::string buffer_;
+            mutable int cached_ = -1;
+            mutable std::vector<uint32_t> chain_;
+    };
+
+} // namespace Watch
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef WATCHDOG_POLLER_H
+#define WATCHDOG_POLLER_H
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <limits>
+
+#include <exceptions.hpp>
+
+namespace Watch {
+
+    using Clock = std::chrono::steady_clock;
+
+    // An epoll set with an eventfd attached so that other threads can knock
+    // a waiting thread out of `epoll_wait()`. Used by anything that wants to
+    // run an event loop that can be stopped.
+    class Poller {
+        public:
+            // Don't allow assignment or copying
+            Poller(const Poller &src) = delete;
+            Poller& operator=(const Poller &src) = delete;
+
+            Poller()
+            {
+                epfd_ = epoll_create1(EPOLL_CLOEXEC);
+                if (epfd_ < 0) {
+                    throw Exception("Failed to create epoll set");
+                }
+
+                wakefd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                if (wakefd_ < 0) {
+                    close(epfd_);
+                    throw Exception("Failed to create wakeup eventfd");
+                }
+
+                add(wakefd_);
+            }
+
+            ~Poller()
+            {
+                close(wakefd_);
+                close(epfd_);
+            }
+
+            // Level triggered, so anything left unread shows up again on the
+            // next wait
+            void add(int fd)
+            {
+                epoll_event ev = {};
+                ev.events = EPOLLIN;
+                ev.data.fd = fd;
+
+                if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                    throw Exception("Failed to add descriptor to epoll set");
+                }
+            }
+
+            void remove(int fd)
+            {
+                // Closing a descriptor removes it anyways, so don't complain
+                epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+            }
+
+            // Returns the number of ready descriptors written to `events`,
+            // not counting our own wakeups. A negative timeout waits forever.
+            int wait(epoll_event *events, int max_events,
+                     Clock::duration timeout)
+            {
+                int n = epoll_wait(epfd_, events, max_events,
+                                   to_milliseconds(timeout));
+                if (n < 0) {
+                    if (errno == EINTR) return 0;
+                    throw Exception("Failed to wait for events");
+                }
+
+                int ready = 0;
+                for (int i = 0; i < n; ++i) {
+                    if (events[i].data.fd == wakefd_) {
+                        uint64_t count;
+                        // Nonblocking, and we only care that it's drained
+                        (void) !read(wakefd_, &count, sizeof(count));
+                        continue;
+                    }
+                    events[ready++] = events[i];
+                }
+
+                return ready;
+            }
+
+            // Safe to call from any thread
+            void wake()
+            {
+                uint64_t one = 1;
+                (void) !write(wakefd_, &one, sizeof(one));
+            }
+
+            // Safe to call from any thread
+            void stop()
+            {
+                stopping_.store(true);
+                wake();
+            }
+
+            bool stop_requested() const
+            {
+                return stopping_.load();
+            }
+
+            // Returns whether a stop was requested, and clears the request
+            bool consume_stop()
+            {
+                return stopping_.exchange(false);
+            }
+
+            int fd() const
+            {
+                return epfd_;
+            }
+
+            // Round up, so that we never spin on a timeout shorter than 1ms
+            static int to_milliseconds(Clock::duration timeout)
+            {
+                using namespace std::chrono;
+
+                if (timeout < Clock::duration::zero()) return -1;
+
+                auto ms = duration_cast<milliseconds>(timeout);
+                if (ms < timeout) ms += milliseconds(1);
+                if (ms.count() > std::numeric_limits<int>::max()) {
+                    return std::numeric_limits<int>::max();
+                }
+
+                return static_cast<int>(ms.count());
+            }
+
+        private:
+            int epfd_;
+            int wakefd_;
+            std::atomic<bool> stopping_{false};
+    };
+
+} // namespace Watch
+
+#endif
@@ -0,0 +1,285 @@
+#ifndef WATCHDOG_REACTOR_H
+#define WATCHDOG_REACTOR_H
+
+#include <limits.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+
+#include <cstddef>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <exceptions.hpp>
+#include <poller.hpp>
+
+namespace Watch {
+
+    class Reactor;
+
+    // Anything that a Reactor can drive: a nonblocking descriptor, and a way
+    // to read from it into a buffer that someone else owns
+    class Pollable {
+        public:
+            virtual ~Pollable() {}
+
+            virtual int pollable_fd() const = 0;
+
+            // Called on the Reactor's thread before it first waits on us,
+            // to finish anything put off until someone's listening (like a
+            // Sentry's held watches)
+            virtual void prepare() {}
+
+            // Do at most one read() into `buffer` and dispatch what it
+            // returned. Returns the number of events dispatched, and 0 if
+            // there was nothing to read.
+            virtual std::size_t read_into(char *buffer,
+                                          std::size_t length) = 0;
+
+            // When `expire()` next needs to be called, for anything that
+            // holds on to events for a while (see coalesce.hpp)
+            virtual Clock::time_point deadline() const
+            {
+                return Clock::time_point::max();
+            }
+
+            // Dispatch whatever was held on to until `now`. Returns the
+            // number of events dispatched.
+            virtual std::size_t expire(Clock::time_point now)
+            {
+                (void) now;
+                return 0;
+            }
+
+        protected:
+            // Implementations must call this before they tear anything down
+            void leave_reactor();
+
+        private:
+            friend class Reactor;
+            Reactor *reactor_ = nullptr;
+    };
+
+    // One thread, one epoll set and one read buffer for any number of
+    // Pollables. Ready descriptors get one read() each per round, and the
+    // starting point rotates between rounds, so a busy watcher can't starve
+    // the others.
+    class Reactor {
+        public:
+            // Don't allow assignment or copying
+            Reactor(const Reactor &src) = delete;
+            Reactor& operator=(const Reactor &src) = delete;
+
+            // Defaults to the same amount of space a single Sentry uses
+            Reactor(const std::size_t buffer_length
+                        = 1024 * (sizeof(inotify_event) + NAME_MAX + 1),
+                    const std::size_t max_ready = 64)
+                : buffer_(new char[buffer_length]),
+                  buffer_length_(buffer_length),
+                  ready_(max_ready)
+            {}
+
+            ~Reactor()
+            {
+                std::lock_guard<std::recursive_mutex> lock(m_);
+                for (auto &source : sources_) {
+                    source.second->reactor_ = nullptr;
+                }
+            }
+
+            // Safe to call from any thread, including from inside a
+            // callback that this Reactor is dispatching
+            void attach(Pollable &p)
+            {
+                std::lock_guard<std::recursive_mutex> lock(m_);
+
+                if (p.reactor_ != nullptr) {
+                    throw Exception("Already attached to a reactor");
+                }
+
+                poller_.add(p.pollable_fd());
+                sources_[p.pollable_fd()] = &p;
+                fresh_.push_back(&p);
+                p.reactor_ = this;
+            }
+
+            // Once this returns, the Reactor will not touch `p` again. Safe
+            // to call from any thread.
+            void detach(Pollable &p)
+            {
+                std::lock_guard<std::recursive_mutex> lock(m_);
+
+                if (p.reactor_ != this) return;
+
+                poller_.remove(p.pollable_fd());
+                sources_.erase(p.pollable_fd());
+                fresh_.erase(std::remove(fresh_.begin(), fresh_.end(), &p),
+                             fresh_.end());
+                p.reactor_ = nullptr;
+            }
+
+            std::size_t size() const
+            {
+                std::lock_guard<std::recursive_mutex> lock(m_);
+                return sources_.size();
+            }
+
+            // Listen until someone calls `stop()`
+            void listen()
+            {
+                do {
+                    run_once(std::chrono::milliseconds(-1));
+                } while (!stopped_);
+            }
+
+            // Wait up to `timeout` (forever if negative), then give every
+            // ready watcher one read. Returns the number of events
+            // dispatched.
+            std::size_t run_once(std::chrono::milliseconds timeout)
+            {
+                prepare_();
+
+                Clock::duration wait = timeout;
+
+                // Don't sleep through anyone's deadline
+                const Clock::time_point due = deadline();
+                if (due != Clock::time_point::max()) {
+                    const Clock::duration until = std::max(
+                            due - Clock::now(), Clock::duration(0));
+                    if (timeout.count() < 0 || until < wait) wait = until;
+                }
+
+                int n = poller_.wait(ready_.data(),
+                                     static_cast<int>(ready_.size()),
+                                     wait);
+
+                std::lock_guard<std::recursive_mutex> lock(m_);
+
+                std::size_t dispatched = 0;
+                for (int i = 0; i < n; ++i) {
+                    if (poller_.stop_requested()) break;
+
+                    int fd = ready_[(start_ + i) % n].data.fd;
+
+                    // It may have been detached by an earlier callback
+                    auto it = sources_.find(fd);
+                    if (it == sources_.end()) continue;
+
+                    dispatched += it->second->read_into(buffer_.get(),
+                                                        buffer_length_);
+                }
+                if (n > 0) ++start_;
+
+                if (due != Clock::time_point::max()) {
+                    dispatched += expire(Clock::now());
+                }
+
+                // A stop is for whoever is running us, and for nothing after
+                stopped_ = poller_.consume_stop();
+
+                return dispatched;
+            }
+
+            // Keep running until the deadline passes or `stop()` is called
+            void run_until(Clock::time_point deadline)
+            {
+                for (auto now = Clock::now(); now < deadline;
+                        now = Clock::now()) {
+                    run_once(std::chrono::duration_cast<
+                            std::chrono::milliseconds>(deadline - now));
+                    if (stopped_) break;
+                }
+            }
+
+            // Safe to call from any thread
+            void stop()
+            {
+                poller_.stop();
+            }
+
+            // The epoll descriptor, in case you want to nest this Reactor
+            // inside yet another event loop
+            int pollable_fd() const
+            {
+                return poller_.fd();
+            }
+
+        private:
+            // Anyone attached since last time gets to finish setting up,
+            // which may attach (or detach) someone else
+            void prepare_()
+            {
+                std::lock_guard<std::recursive_mutex> lock(m_);
+
+                while (!fresh_.empty()) {
+                    Pollable *p = fresh_.back();
+                    fresh_.pop_back();
+                    p->prepare();
+                }
+            }
+
+            // The soonest deadline of everyone attached
+            Clock::time_point deadline() const
+            {
+                std::lock_guard<std::recursive_mutex> lock(m_);
+
+                Clock::time_point soonest = Clock::time_point::max();
+                for (const auto &source : sources_) {
+                    soonest = std::min(soonest, source.second->deadline());
+                }
+
+                return soonest;
+            }
+
+            std::size_t expire(Clock::time_point now)
+            {
+                std::size_t dispatched = 0;
+
+                // Collected first, since callbacks may detach anyone
+                expiring_.clear();
+                for (const auto &source : sources_) {
+                    if (source.second->deadline() <= now) {
+                        expiring_.push_back(source.first);
+                    }
+                }
+
+                for (const int fd : expiring_) {
+                    if (poller_.stop_requested()) break;
+
+                    auto it = sources_.find(fd);
+                    if (it == sources_.end()) continue;
+
+                    dispatched += it->second->expire(now);
+                }
+
+                return dispatched;
+            }
+
+            mutable std::recursive_mutex m_;
+            std::unordered_map<int, Pollable*> sources_;
+            // Attached, but not yet prepared
+            std::vector<Pollable*> fresh_;
+
+            std::unique_ptr<char[]> buffer_;
+            std::size_t buffer_length_;
+
+            std::vector<epoll_event> ready_;
+            std::size_t start_ = 0;
+            std::vector<int> expiring_;
+
+            Poller poller_;
+            // Whether the last run_once() was told to stop
+            bool stopped_ = false;
+    };
+
+    inline void Pollable::leave_reactor()
+    {
+        if (reactor_ != nullptr) reactor_->detach(*this);
+    }
+
+} // namespace Watch
+
+#endif
@@ -0,0 +1,337 @@
+#ifndef WATCHDOG_RESYNC_H
+#define WATCHDOG_RESYNC_H
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Watch {
+
+    // What we remember about each thing in a watched directory
+    struct Entry_State {
+        ino_t inode;
+        int64_t mtime; // Nanoseconds
+        off_t size;
+        bool is_dir;
+
+        bool operator==(const Entry_State &rhs) const
+        {
+            return inode == rhs.inode && mtime == rhs.mtime
+                && size == rhs.size && is_dir == rhs.is_dir;
+        }
+    };
+
+    // Everything in one directory, by name
+    using Dir_State = std::unordered_map<std::string, Entry_State>;
+
+    // What happened when we recovered from an overflowed queue
+    struct Resync_Report {
+        // How many times the queue has overflowed, ever
+        std::size_t overflows = 0;
+        std::size_t directories = 0;
+        // Changes found that nobody had been told about. The kernel may
+        // have dropped more than this (say, a file created and deleted
+        // again), but these are the ones that matter.
+        std::size_t events_lost = 0;
+        std::size_t created = 0;
+        std::size_t deleted = 0;
+        std::size_t modified = 0;
+        // Directories that had something come or go, and had to be listed
+        // again. The rest were only stat()ed.
+        std::size_t listed = 0;
+        std::chrono::microseconds duration{0};
+    };
+
+    using Resync_Callback = std::function<void(const Resync_Report&)>;
+
+    inline bool stat_entry(int dirfd, const char *name, Entry_State &state)
+    {
+        struct stat sb;
+        if (fstatat(dirfd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0) return false;
+
+        state.inode = sb.st_ino;
+        state.mtime = int64_t(sb.st_mtim.tv_sec) * 1000000000
+                    + sb.st_mtim.tv_nsec;
+        state.size = sb.st_size;
+        state.is_dir = S_ISDIR(sb.st_mode);
+
+        return true;
+    }
+
+    inline Dir_State scan_directory(const std::string &path)
+    {
+        Dir_State found;
+
+        DIR *listing = opendir(path.c_str());
+        if (listing == nullptr) return found;
+
+        while (dirent *entry = readdir(listing)) {
+            const char *name = entry->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+            Entry_State state;
+            if (stat_entry(dirfd(listing), name, state)) {
+                found.emplace(name, state);
+            }
+        }
+
+        closedir(listing);
+
+        return found;
+    }
+
+    // Runs `work(i)` for every i below `count`, on a few threads
+    template <class Work>
+    void in_parallel(std::size_t count, Work work, unsigned threads = 0)
+    {
+        if (threads == 0) threads = std::thread::hardware_concurrency();
+        if (threads == 0) threads = 1;
+        if (threads > count) threads = count;
+
+        std::atomic<std::size_t> next{0};
+        auto run = [&]() {
+            for (std::size_t i = next++; i < count; i = next++) work(i);
+        };
+
+        std::vector<std::thread> helpers;
+        for (unsigned i = 1; i < threads; ++i) helpers.emplace_back(run);
+        run();
+        for (auto &helper : helpers) helper.join();
+    }
+
+    // The last known state of every watched directory, by wd. Kept up to
+    // date as events come in, so that after the queue overflows we can
+    // rescan and work out what we missed.
+    class Snapshot {
+        public:
+            // Events we need to hear about to keep the snapshot honest.
+            // Modifications are picked up when the file is closed.
+            static constexpr uint32_t mask = IN_CREATE | IN_DELETE
+                | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB;
+
+            // What `update()` wants to hear about. Modifications too, if
+            // anyone is watching for them anyway, or a file still being
+            // written when the queue overflows looks modified again.
+            static constexpr uint32_t tracked = mask | IN_MODIFY;
+
+            // Listing a directory makes inotify report it being opened,
+            // read and closed, on the directory and on its parent
+            static constexpr uint32_t listing = IN_OPEN | IN_ACCESS
+                | IN_CLOSE_NOWRITE;
+
+            void take(const std::vector< std::pair<int, std::string> > &dirs)
+            {
+                std::vector<Known_Dir> found(dirs.size());
+
+                in_parallel(dirs.size(), [&](std::size_t i) {
+                        // Before listing, so that anything that changes
+                        // meanwhile gets it listed again next time
+                        stat_dir(dirs[i].second, found[i]);
+                        found[i].entries = scan_directory(dirs[i].second);
+                    });
+
+                for (std::size_t i = 0; i < dirs.size(); ++i) {
+                    dirs_[dirs[i].first] = std::move(found[i]);
+                }
+            }
+
+            void forget(int wd)
+            {
+                dirs_.erase(wd);
+            }
+
+            // Bring a single entry up to date after an event about it
+            void update(int wd, const std::string &dir, const char *name,
+                        uint32_t event)
+            {
+                auto it = dirs_.find(wd);
+                if (it == dirs_.end()) return;
+
+                Known_Dir &known = it->second;
+
+                // Something came or went, which touches the directory too
+                if (event & (IN_CREATE | IN_DELETE | IN_MOVED_FROM
+                             | IN_MOVED_TO)) {
+                    stat_dir(dir, known);
+                }
+
+                if (event & (IN_DELETE | IN_MOVED_FROM)) {
+                    known.entries.erase(name);
+                    return;
+                }
+
+                Entry_State state;
+                if (stat_entry(AT_FDCWD, (dir + '/' + name).c_str(), state)) {
+                    known.entries[name] = state;
+                } else {
+                    known.entries.erase(name);
+                }
+            }
+
+            // Rescan and call emit(wd, mask, name) for each difference,
+            // then remember what we found. Only directories whose own
+            // mtime changed get listed again; for the rest, what we knew
+            // was in them just gets stat()ed, which inotify doesn't
+            // report. `quiet(paths, true)` is called before listing
+            // `paths`, and `quiet(paths, false)` afterwards, so that the
+            // caller can stop listening for us doing it.
+            template <class Emit, class Quiet>
+            Resync_Report resync(
+                    const std::vector< std::pair<int, std::string> > &dirs,
+                    Emit emit, Quiet quiet)
+            {
+                Resync_Report report;
+                report.directories = dirs.size();
+
+                std::vector<Known_Dir> found(dirs.size());
+                std::vector<char> relist(dirs.size(), 0);
+
+                in_parallel(dirs.size(), [&](std::size_t i) {
+                        relist[i] = !look(dirs[i], found[i]);
+                    });
+
+                std::vector<std::size_t> which;
+                std::vector<std::string> paths;
+                for (std::size_t i = 0; i < dirs.size(); ++i) {
+                    if (!relist[i]) continue;
+                    which.push_back(i);
+                    paths.push_back(dirs[i].second);
+                }
+
+                if (!which.empty()) {
+                    quiet(paths, true);
+                    in_parallel(which.size(), [&](std::size_t i) {
+                            found[which[i]].entries = scan_directory(
+                                    paths[i]);
+                        });
+                    quiet(paths, false);
+                }
+
+                for (std::size_t i = 0; i < dirs.size(); ++i) {
+                    const int wd = dirs[i].first;
+                    Dir_State &before = dirs_[wd].entries;
+                    Dir_State &after = found[i].entries;
+
+                    for (const auto &entry : before) {
+                        auto now = after.find(entry.first);
+                        bool replaced = now != after.end()
+                            && now->second.inode != entry.second.inode;
+
+                        if (now == after.end() || replaced) {
+                            emit(wd, IN_DELETE | dir_bit(entry.second),
+                                 entry.first.c_str());
+                            ++report.deleted;
+                        }
+                    }
+
+                    for (const auto &entry : after) {
+                        auto then = before.find(entry.first);
+
+                        if (then == before.end()
+                                || then->second.inode != entry.second.inode) {
+                            emit(wd, IN_CREATE | dir_bit(entry.second),
+                                 entry.first.c_str());
+                            ++report.created;
+                        } else if (!entry.second.is_dir
+                                && !(then->second == entry.second)) {
+                            emit(wd, IN_MODIFY, entry.first.c_str());
+                            ++report.modified;
+                        }
+                    }
+
+                    dirs_[wd] = std::move(found[i]);
+                }
+
+                report.listed = which.size();
+                report.events_lost = report.created + report.deleted
+                                   + report.modified;
+
+                return report;
+            }
+
+            std::size_t size() const
+            {
+                return dirs_.size();
+            }
+
+        private:
+            struct Known_Dir {
+                // The directory itself, whose mtime changes whenever
+                // anything in it comes or goes
+                Entry_State self{};
+                bool known = false;
+                // When we stat()ed it, in the same terms as mtime
+                int64_t seen = 0;
+                Dir_State entries;
+            };
+
+            // Comfortably coarser than any filesystem's timestamps
+            static constexpr int64_t racy = 100 * 1000000;
+
+            static bool stat_dir(const std::string &path, Known_Dir &dir)
+            {
+                timespec now;
+                clock_gettime(CLOCK_REALTIME, &now);
+                dir.seen = int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+
+                dir.known = stat_entry(AT_FDCWD, path.c_str(), dir.self);
+                return dir.known;
+            }
+
+            static uint32_t dir_bit(const Entry_State &state)
+            {
+                return state.is_dir ? IN_ISDIR : 0;
+            }
+
+            // Fill in `now` for one directory without listing it, if
+            // nothing in it can have come or gone. False if it needs
+            // listing.
+            bool look(const std::pair<int, std::string> &dir,
+                      Known_Dir &now) const
+            {
+                if (!stat_dir(dir.second, now)) return false;
+
+                auto it = dirs_.find(dir.first);
+                if (it == dirs_.end() || !it->second.known
+                        || !(it->second.self == now.self)) {
+                    return false;
+                }
+
+                // Timestamps are only so fine, so if it had only just
+                // changed when we looked, it may have changed again since
+                // without the mtime showing it (like git's racy index)
+                if (it->second.seen - it->second.self.mtime < racy) {
+                    return false;
+                }
+
+                for (const auto &entry : it->second.entries) {
+                    Entry_State state;
+                    const std::string path = dir.second + '/' + entry.first;
+                    if (!stat_entry(AT_FDCWD, path.c_str(), state)) {
+                        return false;
+                    }
+                    now.entries.emplace(entry.first, state);
+                }
+
+                return true;
+            }
+
+            std::unordered_map<int, Known_Dir> dirs_;
+    };
+
+} // namespace Watch
+
+#endif
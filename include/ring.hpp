@@ -0,0 +1,347 @@
+#ifndef WATCHDOG_RING_H
+#define WATCHDOG_RING_H
+
+#include <limits.h>
+#include <sys/inotify.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <event_view.hpp>
+#include <exceptions.hpp>
+
+namespace Watch {
+
+    // Dmitry Vyukov's bounded queue: every cell carries a sequence number
+    // that says whose turn it is, so producers and consumers only ever fight
+    // over a single counter each, and never take a lock. Any number of
+    // threads may push and pop at once.
+    //
+    // push() and pop() hand the caller the cell itself, so records can be
+    // written and read in place.
+    template <class T>
+    class Bounded_Queue {
+        public:
+            // Rounded up to a power of two
+            explicit Bounded_Queue(std::size_t capacity)
+            {
+                std::size_t size = 2;
+                while (size < capacity) size <<= 1;
+
+                mask_ = size - 1;
+                cells_.reset(new Cell[size]);
+                for (std::size_t i = 0; i < size; ++i) {
+                    cells_[i].sequence.store(i, std::memory_order_relaxed);
+                }
+            }
+
+            // fill(T&) writes the new element. False if we're full.
+            template <class Fill>
+            bool push(Fill fill)
+            {
+                std::size_t pos = enqueue_.load(std::memory_order_relaxed);
+                Cell *cell;
+
+                while (true) {
+                    cell = &cells_[pos & mask_];
+                    const std::size_t seq =
+                        cell->sequence.load(std::memory_order_acquire);
+                    const intptr_t diff = intptr_t(seq) - intptr_t(pos);
+
+                    if (diff == 0) {
+                        if (enqueue_.compare_exchange_weak(pos, pos + 1,
+                                    std::memory_order_relaxed)) {
+                            break;
+                        }
+                    } else if (diff < 0) {
+                        return false;
+                    } else {
+                        pos = enqueue_.load(std::memory_order_relaxed);
+                    }
+                }
+
+                fill(cell->value);
+                cell->sequence.store(pos + 1, std::memory_order_release);
+
+                return true;
+            }
+
+            bool push(const T &value)
+            {
+                return push([&value](T &cell) { cell = value; });
+            }
+
+            // take(T&) reads the oldest element, which stays put until take
+            // returns. False if we're empty.
+            template <class Take>
+            bool pop(Take take)
+            {
+                std::size_t pos = dequeue_.load(std::memory_order_relaxed);
+                Cell *cell;
+
+                while (true) {
+                    cell = &cells_[pos & mask_];
+                    const std::size_t seq =
+                        cell->sequence.load(std::memory_order_acquire);
+                    const intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+
+                    if (diff == 0) {
+                        if (dequeue_.compare_exchange_weak(pos, pos + 1,
+                                    std::memory_order_relaxed)) {
+                            break;
+                        }
+                    } else if (diff < 0) {
+                        return false;
+                    } else {
+                        pos = dequeue_.load(std::memory_order_relaxed);
+                    }
+                }
+
+                // Hand the cell back to the producers even if take throws
+                struct Release {
+                    Cell *cell;
+                    std::size_t next;
+                    ~Release()
+                    {
+                        cell->sequence.store(next,
+                                             std::memory_order_release);
+                    }
+                } release{cell, pos + mask_ + 1};
+
+                take(cell->value);
+
+                return true;
+            }
+
+            bool pop(T &value)
+            {
+                return pop([&value](T &cell) { value = cell; });
+            }
+
+            // Everything pushed and popped so far. Racy, but never by much.
+            std::size_t pushed() const
+            {
+                return enqueue_.load(std::memory_order_relaxed);
+            }
+
+            std::size_t popped() const
+            {
+                return dequeue_.load(std::memory_order_relaxed);
+            }
+
+            std::size_t size() const
+            {
+                const std::size_t in = pushed();
+                const std::size_t out = popped();
+                return (in > out) ? in - out : 0;
+            }
+
+            std::size_t capacity() const
+            {
+                return mask_ + 1;
+            }
+
+        private:
+            struct Cell {
+                std::atomic<std::size_t> sequence;
+                T value;
+            };
+
+            std::unique_ptr<Cell[]> cells_;
+            std::size_t mask_;
+
+            // On their own cache lines, since they're written by different
+            // threads
+            alignas(64) std::atomic<std::size_t> enqueue_{0};
+            alignas(64) std::atomic<std::size_t> dequeue_{0};
+    };
+
+    struct Ring_Stats {
+        std::size_t pushed = 0;
+        std::size_t popped = 0;
+        // Lost because the ring was full, or there was no room for a long
+        // path
+        std::size_t dropped = 0;
+        // Paths too long to fit in a record
+        std::size_t spilled = 0;
+        // Waiting right now
+        std::size_t occupancy = 0;
+        std::size_t high_water = 0;
+    };
+
+    // Hands events from the thread reading them to any number of consumer
+    // threads, without locks. Each event is a fixed size record with the
+    // directory and name inline. Paths that don't fit borrow a slab from a
+    // fixed pool of spill space instead, which goes back to the pool once
+    // the event has been consumed. When there's no room, the event is
+    // dropped and counted rather than making the reader wait.
+    class Event_Ring {
+        public:
+            // Both rounded up to powers of two
+            Event_Ring(std::size_t capacity = 4096,
+                       std::size_t spill_slabs = 64)
+                : records_(capacity), free_slabs_(spill_slabs)
+            {
+                slabs_.reset(new char[free_slabs_.capacity() * slab_size]);
+                for (std::size_t i = 0; i < free_slabs_.capacity(); ++i) {
+                    free_slabs_.push(static_cast<uint32_t>(i));
+                }
+            }
+
+            // Called by whoever reads events. False if it had to be dropped.
+            bool push(const inotify_event *ev, const std::string &path)
+            {
+                const std::size_t name_length = strnlen(ev->name, ev->len);
+                if (path.size() + name_length >= slab_size) {
+                    ++dropped_;
+                    return false;
+                }
+
+                uint32_t slab = no_slab;
+                if (path.size() + name_length > inline_text) {
+                    if (!free_slabs_.pop(slab)) {
+                        ++dropped_;
+                        return false;
+                    }
+                    ++spilled_;
+                }
+
+                const bool pushed = records_.push([&](Record &record) {
+                        record.wd = ev->wd;
+                        record.mask = ev->mask;
+                        record.cookie = ev->cookie;
+                        record.path_length = uint16_t(path.size());
+                        record.name_length = uint16_t(name_length);
+                        record.slab = slab;
+
+                        char *text = text_of(record);
+                        memcpy(text, path.data(), path.size());
+                        memcpy(text + path.size(), ev->name, name_length);
+                    });
+
+                if (!pushed) {
+                    if (slab != no_slab) free_slabs_.push(slab);
+                    ++dropped_;
+                    return false;
+                }
+
+                const std::size_t occupancy = records_.size();
+                std::size_t high = high_water_.load(std::memory_order_relaxed);
+                while (occupancy > high
+                        && !high_water_.compare_exchange_weak(high,
+                                occupancy, std::memory_order_relaxed)) {
+                }
+
+                return true;
+            }
+
+            // Calls f(const Event_View&) with the oldest event, if there is
+            // one. The view is only good until f returns. Never blocks.
+            template <class F>
+            bool pop(F f)
+            {
+                return records_.pop([&](Record &record) {
+                        const char *text = text_of(record);
+
+                        // Back in the pool once we're done, no matter what
+                        struct Release {
+                            Event_Ring &ring;
+                            uint32_t slab;
+                            ~Release()
+                            {
+                                if (slab != no_slab) {
+                                    ring.free_slabs_.push(slab);
+                                }
+                            }
+                        } release{*this, record.slab};
+
+                        f(Event_View{ record.wd, record.mask, record.cookie,
+                                std::string_view(text + record.path_length,
+                                                 record.name_length),
+                                std::string_view(text, record.path_length)
+                            });
+                    });
+            }
+
+            // Pop up to `max` events. Returns how many there were.
+            template <class F>
+            std::size_t pop_all(F f, std::size_t max = SIZE_MAX)
+            {
+                std::size_t popped = 0;
+                while (popped < max && pop(f)) ++popped;
+                return popped;
+            }
+
+            bool empty() const
+            {
+                return records_.size() == 0;
+            }
+
+            std::size_t capacity() const
+            {
+                return records_.capacity();
+            }
+
+            Ring_Stats stats() const
+            {
+                Ring_Stats stats;
+                stats.pushed = records_.pushed();
+                stats.popped = records_.popped();
+                stats.dropped = dropped_.load(std::memory_order_relaxed);
+                stats.spilled = spilled_.load(std::memory_order_relaxed);
+                stats.occupancy = records_.size();
+                stats.high_water =
+                    high_water_.load(std::memory_order_relaxed);
+                return stats;
+            }
+
+        private:
+            enum : uint32_t { no_slab = UINT32_MAX };
+            // A full path and name always fits in a slab
+            enum : std::size_t {
+                slab_size = PATH_MAX + NAME_MAX + 1,
+                record_size = 128,
+                inline_text = record_size - 5 * sizeof(uint32_t)
+                            - sizeof(std::atomic<std::size_t>),
+            };
+
+            // Sized so that a cell (this plus its sequence number) fills
+            // exactly two cache lines
+            struct Record {
+                int wd;
+                uint32_t mask;
+                uint32_t cookie;
+                uint16_t path_length;
+                uint16_t name_length;
+                uint32_t slab;
+                char text[inline_text];
+            };
+            static_assert(sizeof(Record) + sizeof(std::atomic<std::size_t>)
+                          == record_size, "Records should fill their cells");
+
+            char *text_of(Record &record)
+            {
+                return (record.slab == no_slab)
+                    ? record.text
+                    : &slabs_[std::size_t(record.slab) * slab_size];
+            }
+
+            Bounded_Queue<Record> records_;
+
+            // Spill space, and which slabs of it are free
+            std::unique_ptr<char[]> slabs_;
+            Bounded_Queue<uint32_t> free_slabs_;
+
+            alignas(64) std::atomic<std::size_t> dropped_{0};
+            std::atomic<std::size_t> spilled_{0};
+            std::atomic<std::size_t> high_water_{0};
+    };
+
+} // namespace Watch
+
+#endif
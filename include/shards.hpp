@@ -0,0 +1,585 @@
+#ifndef WATCHDOG_SHARDS_H
+#define WATCHDOG_SHARDS_H
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <watchdog.hpp>
+
+namespace Watch {
+
+    struct Shard_Options {
+        // Reader threads, one per core by default
+        std::size_t shards = 0;
+        // How often to compare how busy the shards have been, and move a
+        // subtree from the busiest to the quietest if they're too far
+        // apart. Never, if zero.
+        Clock::duration rebalance_every = std::chrono::seconds(1);
+        // Too far apart is the busiest having read at least this many
+        // times as many events as the quietest since last time...
+        double imbalance = 2.0;
+        // ...and at least this many
+        std::size_t min_events = 1000;
+    };
+
+    struct Shard_Load {
+        std::size_t subtrees = 0;
+        std::size_t directories = 0;
+        // Events read for its subtrees, all told and since the last look.
+        // Every one counts, whether or not any callback wanted it, since
+        // reading and parsing it was the shard's work either way.
+        std::size_t events = 0;
+        std::size_t recent = 0;
+    };
+
+    struct Shard_Stats {
+        std::vector<Shard_Load> shards;
+        // Subtrees moved from one shard to another
+        std::size_t moves = 0;
+    };
+
+    // Watches a tree recursively with one inotify descriptor per directory
+    // right under the root (a subtree), spread across several shards, each
+    // of which is a Reactor on a thread of its own. One busy part of the
+    // tree then can't keep the rest from being read, and parsing and
+    // dispatching are spread across cores.
+    //
+    // Subtrees start out spread by how many directories they have. While
+    // listening, every so often the shard that has read the most events
+    // hands one of its subtrees to the one that has read the fewest. Moving
+    // a subtree only moves its descriptor from one Reactor to the other, so
+    // nothing is watched again and nothing is missed; whatever happens in
+    // the meantime waits in its queue.
+    //
+    // A subtree is as small as it gets: it's always read by one shard, so
+    // a single busy directory right under the root (or anywhere under it)
+    // gets no more than one thread, however many shards there are. Trees
+    // with one hot top level directory are better off with a `Reactor` of
+    // Sentries of their own choosing.
+    //
+    // The root itself has a (non-recursive) Sentry of its own, always on
+    // the first shard, which hears about subtrees coming and going.
+    // Anything already in a new one is reported with made-up On::Create
+    // events (with a `wd` of -1), the way a Sentry does for new
+    // directories.
+    //
+    // Callbacks run on every shard's thread at once, so they need to be
+    // thread safe. Register them all before `listen()`. Each subtree needs
+    // an inotify instance, so trees with more top level directories than
+    // max_user_instances allows can't be watched this way.
+    template < class Container = Flat >
+    class Sharded_Sentry {
+        public:
+            using Subtree = Sentry<Recursively, Flags::Add, Container>;
+            using Top = Sentry<Normally, Flags::Add, Container>;
+
+            // Don't allow assignment or copying
+            Sharded_Sentry(const Sharded_Sentry &src) = delete;
+            Sharded_Sentry& operator=(const Sharded_Sentry &src) = delete;
+
+            explicit Sharded_Sentry(const std::string &path,
+                                    const Shard_Options &options
+                                        = Shard_Options())
+                : root_(path), options_(options)
+            {
+                std::size_t count = options_.shards;
+                if (count == 0) count = std::thread::hardware_concurrency();
+                count = std::max<std::size_t>(count, 1);
+
+                for (std::size_t i = 0; i < count; ++i) {
+                    shards_.emplace_back(new Shard_());
+                }
+
+                top_.reset(new Top(root_));
+                top_->hold_watches();
+                top_->add_callback([this](const Event_View &ev) {
+                        changed_(ev);
+                    }, On::Create | On::Delete_Sub | On::Moved_From
+                       | On::Moved_To);
+                shards_[0]->reactor.attach(*top_);
+
+                for (auto &dir : subdirectories_(root_)) {
+                    subtrees_.emplace_back(new Subtree_(std::move(dir)));
+                }
+
+                // Biggest first, each onto whichever has the fewest so far
+                std::sort(subtrees_.begin(), subtrees_.end(),
+                          [](const std::unique_ptr<Subtree_> &lhs,
+                             const std::unique_ptr<Subtree_> &rhs) {
+                              return lhs->directories > rhs->directories;
+                          });
+
+                std::vector<std::size_t> directories(count, 0);
+                directories[0] = 1;
+                for (auto &subtree : subtrees_) {
+                    const std::size_t shard = std::min_element(
+                            directories.begin(), directories.end())
+                        - directories.begin();
+                    directories[shard] += subtree->directories;
+
+                    subtree->shard = shard;
+                    shards_[shard]->reactor.attach(*subtree->sentry);
+                }
+            }
+
+            ~Sharded_Sentry()
+            {
+                stop_readers_();
+            }
+
+            // Same as Sentry::add_callback, for everything under the root
+            void add_callback(Callback cb, FlagBearer flags)
+            {
+                top_->add_callback(cb, flags);
+                for (auto &subtree : subtrees_) {
+                    subtree->sentry->add_callback(cb, flags);
+                }
+
+                callbacks_.emplace_back(std::move(cb), flags);
+            }
+
+            void add_callback(View_Callback cb, FlagBearer flags)
+            {
+                top_->add_callback(cb, flags);
+                for (auto &subtree : subtrees_) {
+                    subtree->sentry->add_callback(cb, flags);
+                }
+
+                view_callbacks_.emplace_back(std::move(cb), flags);
+            }
+
+            // Start every shard reading, and look after them from this
+            // thread until someone calls `stop()`
+            void listen()
+            {
+                run_until(Clock::time_point::max());
+            }
+
+            // Same as `listen()`, but also returns once the deadline passes
+            void run_until(Clock::time_point deadline)
+            {
+                start_readers_();
+
+                Clock::time_point next = Clock::now()
+                                         + options_.rebalance_every;
+                epoll_event ready[1];
+
+                while (!poller_.consume_stop()) {
+                    const Clock::time_point now = Clock::now();
+                    if (now >= deadline) break;
+
+                    if (options_.rebalance_every.count() > 0 && now >= next) {
+                        rebalance_();
+                        next = now + options_.rebalance_every;
+                    }
+
+                    Clock::time_point until = deadline;
+                    if (options_.rebalance_every.count() > 0) {
+                        until = std::min(until, next);
+                    }
+
+                    poller_.wait(ready, 1, until - now);
+                    take_changes_();
+                }
+
+                // Whatever came in as the deadline passed was for this run,
+                // not the next
+                poller_.consume_stop();
+
+                stop_readers_();
+            }
+
+            // Makes `listen()` or `run_until()` return, once every shard
+            // is done with what it's dispatching. Safe to call from any
+            // thread, including from inside a callback.
+            void stop()
+            {
+                poller_.stop();
+            }
+
+            std::size_t shards() const
+            {
+                return shards_.size();
+            }
+
+            // Where everything stands, as of the last look (which is when
+            // `recent` was counted). Safe to call from any thread.
+            Shard_Stats stats() const
+            {
+                std::lock_guard<std::mutex> lock(m_);
+
+                Shard_Stats stats;
+                stats.shards.resize(shards_.size());
+                stats.moves = moves_;
+
+                stats.shards[0].directories = 1;
+                stats.shards[0].events = top_->events_read();
+                stats.shards[0].recent = top_recent_;
+
+                for (const auto &subtree : subtrees_) {
+                    Shard_Load &load = stats.shards[subtree->shard];
+                    ++load.subtrees;
+                    load.directories += subtree->directories;
+                    load.events += subtree->sentry->events_read();
+                    load.recent += subtree->recent;
+                }
+
+                return stats;
+            }
+
+        private:
+            struct Shard_ {
+                Reactor reactor;
+                std::thread reader;
+            };
+
+            struct Subtree_ {
+                explicit Subtree_(std::string path_)
+                    : path(std::move(path_)), sentry(new Subtree(path))
+                {
+                    sentry->hold_watches();
+                    directories = sentry->directories();
+                }
+
+                std::string path;
+                std::unique_ptr<Subtree> sentry;
+                std::size_t directories = 0;
+                std::size_t shard = 0;
+
+                // Events read as of the last look, and since the one
+                // before
+                uint64_t seen = 0;
+                uint64_t recent = 0;
+            };
+
+            // A subtree came or went, as heard by the root's Sentry on the
+            // first shard. Dealt with by whoever's listening.
+            struct Change_ {
+                std::string path;
+                bool appeared;
+            };
+
+            static std::vector<std::string> subdirectories_(
+                    const std::string &dir)
+            {
+                std::vector<std::string> found;
+
+                DIR *listing = opendir(dir.c_str());
+                if (listing == nullptr) {
+                    throw Exception("Failed to open " + dir);
+                }
+
+                while (dirent *entry = readdir(listing)) {
+                    if (strcmp(entry->d_name, ".") == 0
+                            || strcmp(entry->d_name, "..") == 0) {
+                        continue;
+                    }
+
+                    if (is_directory_(listing, entry)) {
+                        found.push_back(join_paths(dir, entry->d_name));
+                    }
+                }
+
+                closedir(listing);
+                return found;
+            }
+
+            static bool is_directory_(DIR *listing, const dirent *entry)
+            {
+                if (entry->d_type != DT_UNKNOWN) {
+                    return entry->d_type == DT_DIR;
+                }
+
+                struct stat sb;
+                return fstatat(dirfd(listing), entry->d_name, &sb,
+                               AT_SYMLINK_NOFOLLOW) == 0
+                    && S_ISDIR(sb.st_mode);
+            }
+
+            void changed_(const Event_View &ev)
+            {
+                if ((ev.mask & Reply::Is_Directory) == 0) return;
+
+                std::lock_guard<std::mutex> lock(changes_m_);
+                changes_.push_back(Change_{
+                        join_paths(root_, std::string(ev.name)),
+                        (ev.mask & (On::Create | On::Moved_To)) != 0 });
+                poller_.wake();
+            }
+
+            void take_changes_()
+            {
+                std::vector<Change_> changes;
+                {
+                    std::lock_guard<std::mutex> lock(changes_m_);
+                    changes.swap(changes_);
+                }
+
+                for (auto &change : changes) {
+                    // Renamed within the root or not, what was there is
+                    // gone
+                    remove_(change.path);
+                    if (change.appeared) add_(std::move(change.path));
+                }
+            }
+
+            void add_(std::string path)
+            {
+                std::unique_ptr<Subtree_> subtree;
+                try {
+                    subtree.reset(new Subtree_(std::move(path)));
+
+                    for (const auto &cb : callbacks_) {
+                        subtree->sentry->add_callback(cb.first, cb.second);
+                    }
+                    for (const auto &cb : view_callbacks_) {
+                        subtree->sentry->add_callback(cb.first, cb.second);
+                    }
+                    subtree->sentry->attach_watches();
+                } catch (const Exception&) {
+                    return; // Already gone again
+                }
+
+                // Whatever was there before we were watching
+                catch_up_(subtree->path);
+
+                const std::size_t shard = quietest_();
+                subtree->shard = shard;
+                shards_[shard]->reactor.attach(*subtree->sentry);
+
+                std::lock_guard<std::mutex> lock(m_);
+                subtrees_.push_back(std::move(subtree));
+            }
+
+            void remove_(const std::string &path)
+            {
+                std::unique_ptr<Subtree_> gone;
+                {
+                    std::lock_guard<std::mutex> lock(m_);
+
+                    auto it = std::find_if(subtrees_.begin(), subtrees_.end(),
+                            [&path](const std::unique_ptr<Subtree_> &s) {
+                                return s->path == path;
+                            });
+                    if (it == subtrees_.end()) return;
+
+                    gone = std::move(*it);
+                    subtrees_.erase(it);
+                }
+
+                // Waits for its shard to be done with it, so not while
+                // holding the lock (a callback may want stats())
+            }
+
+            // Make up an On::Create for everything under `path`, for the
+            // callbacks that want one
+            void catch_up_(const std::string &path)
+            {
+                alignas(Event) char buffer[sizeof(Event) + NAME_MAX + 1];
+                Event *ev = (Event*) buffer;
+
+                std::vector<std::string> todo(1, path);
+
+                while (!todo.empty()) {
+                    const std::string dir = std::move(todo.back());
+                    todo.pop_back();
+
+                    DIR *listing = opendir(dir.c_str());
+                    if (listing == nullptr) continue;
+
+                    while (dirent *entry = readdir(listing)) {
+                        const char *name = entry->d_name;
+                        if (strcmp(name, ".") == 0
+                                || strcmp(name, "..") == 0) {
+                            continue;
+                        }
+
+                        const bool is_dir = is_directory_(listing, entry);
+
+                        const std::size_t length = strlen(name) + 1;
+                        ev->wd = -1;
+                        ev->mask = On::Create;
+                        if (is_dir) ev->mask |= Reply::Is_Directory;
+                        ev->cookie = 0;
+                        ev->len = length;
+                        memcpy(ev->name, name, length);
+
+                        deliver_(ev, dir);
+
+                        if (is_dir) todo.push_back(join_paths(dir, name));
+                    }
+
+                    closedir(listing);
+                }
+            }
+
+            void deliver_(Event *ev, const std::string &dir)
+            {
+                for (const auto &cb : callbacks_) {
+                    if (ev->mask & cb.second) cb.first(ev, dir);
+                }
+
+                if (view_callbacks_.empty()) return;
+
+                const Event_View view = view_of(ev, dir);
+                for (const auto &cb : view_callbacks_) {
+                    if (ev->mask & cb.second) cb.first(view);
+                }
+            }
+
+            // Whichever shard has had the least to do lately, counting the
+            // directories it watches when nobody has been busy
+            std::size_t quietest_() const
+            {
+                std::vector< std::pair<uint64_t, std::size_t> > load(
+                        shards_.size());
+                load[0].first = top_recent_;
+                load[0].second = 1;
+                for (const auto &subtree : subtrees_) {
+                    load[subtree->shard].first += subtree->recent;
+                    load[subtree->shard].second += subtree->directories;
+                }
+
+                return std::min_element(load.begin(), load.end())
+                    - load.begin();
+            }
+
+            // Hand one subtree from the busiest shard to the quietest, if
+            // they're far enough apart and that would bring them closer
+            void rebalance_()
+            {
+                std::vector<uint64_t> load(shards_.size(), 0);
+                {
+                    std::lock_guard<std::mutex> lock(m_);
+
+                    const uint64_t seen = top_->events_read();
+                    top_recent_ = seen - top_seen_;
+                    top_seen_ = seen;
+                    load[0] = top_recent_;
+
+                    for (auto &subtree : subtrees_) {
+                        const uint64_t events = subtree->sentry->events_read();
+                        subtree->recent = events - subtree->seen;
+                        subtree->seen = events;
+                        load[subtree->shard] += subtree->recent;
+                    }
+                }
+
+                const std::size_t hot = std::max_element(load.begin(),
+                                                         load.end())
+                    - load.begin();
+                const std::size_t cold = std::min_element(load.begin(),
+                                                          load.end())
+                    - load.begin();
+
+                if (hot == cold || load[hot] < options_.min_events
+                        || load[hot] < options_.imbalance * load[cold]) {
+                    return;
+                }
+
+                // Whichever comes closest to evening them out. Anything as
+                // busy as the gap between them would just swap them around.
+                const uint64_t gap = load[hot] - load[cold];
+                Subtree_ *best = nullptr;
+                uint64_t best_off = gap;
+
+                for (auto &subtree : subtrees_) {
+                    if (subtree->shard != hot || subtree->recent == 0
+                            || subtree->recent >= gap) {
+                        continue;
+                    }
+
+                    const uint64_t twice = subtree->recent * 2;
+                    const uint64_t off = (twice > gap) ? twice - gap
+                                                       : gap - twice;
+                    if (off < best_off) {
+                        best = subtree.get();
+                        best_off = off;
+                    }
+                }
+
+                if (best == nullptr) return;
+
+                if (WATCHDOG_DEBUG) {
+                    fprintf(stderr, "[DEBUG]: Moving %s from shard %zu to "
+                            "%zu\n", best->path.c_str(), hot, cold);
+                }
+
+                // Once it's detached, the busy shard is done with it
+                shards_[hot]->reactor.detach(*best->sentry);
+                shards_[cold]->reactor.attach(*best->sentry);
+
+                std::lock_guard<std::mutex> lock(m_);
+                best->shard = cold;
+                ++moves_;
+            }
+
+            void start_readers_()
+            {
+                top_->attach_watches();
+                for (auto &subtree : subtrees_) {
+                    subtree->sentry->attach_watches();
+                }
+
+                for (auto &shard : shards_) {
+                    Reactor &reactor = shard->reactor;
+                    shard->reader = std::thread([&reactor] {
+                            reactor.listen();
+                        });
+                }
+            }
+
+            void stop_readers_()
+            {
+                for (auto &shard : shards_) {
+                    if (!shard->reader.joinable()) continue;
+
+                    shard->reactor.stop();
+                    shard->reader.join();
+                }
+            }
+
+            std::string root_;
+            Shard_Options options_;
+
+            std::vector< std::pair<Callback, FlagBearer> > callbacks_;
+            std::vector< std::pair<View_Callback, FlagBearer> >
+                view_callbacks_;
+
+            std::vector< std::unique_ptr<Shard_> > shards_;
+
+            // Which subtree is on which shard only changes while listening,
+            // and is only read elsewhere by stats()
+            mutable std::mutex m_;
+            std::vector< std::unique_ptr<Subtree_> > subtrees_;
+            std::size_t moves_ = 0;
+
+            std::unique_ptr<Top> top_;
+            uint64_t top_seen_ = 0;
+            uint64_t top_recent_ = 0;
+
+            std::mutex changes_m_;
+            std::vector<Change_> changes_;
+
+            Poller poller_;
+    };
+
+    using Sharded_Pen = Sharded_Sentry<>;
+
+} // namespace Watch
+
+#endif
@@ -0,0 +1,340 @@
+#ifndef WATCHDOG_SINK_H
+#define WATCHDOG_SINK_H
+
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <charconv>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include <event_batch.hpp>
+#include <event_view.hpp>
+#include <exceptions.hpp>
+#include <flags.hpp>
+#include <helpers.hpp>
+
+namespace Watch {
+
+    enum class Sink_Format {
+        // {"wd":1,"mask":["Create"],"cookie":0,"path":"/dir/name"}
+        JSON_Lines,
+        // wd, names joined with |, cookie and path, separated by tabs
+        TSV
+    };
+
+    // Writes one event as one line into a buffer of at least `bound(ev)`
+    // bytes, without allocating anything. Paths are the directory and name
+    // joined, escaped as the format needs.
+    namespace Format {
+
+        // Every character of the path escaped the long way, plus every
+        // flag's name and the numbers
+        inline std::size_t bound(const Event_View &ev)
+        {
+            return (ev.path.size() + ev.name.size() + 1) * 6 + 512;
+        }
+
+        inline char *number(char *out, int64_t n)
+        {
+            // Always fits, since the line has room to spare
+            return std::to_chars(out, out + 24, n).ptr;
+        }
+
+        inline char *json_string(char *out, std::string_view text)
+        {
+            static const char hex[] = "0123456789abcdef";
+
+            for (const char c : text) {
+                switch (c) {
+                    case '"': *out++ = '\\'; *out++ = '"'; break;
+                    case '\\': *out++ = '\\'; *out++ = '\\'; break;
+                    case '\n': *out++ = '\\'; *out++ = 'n'; break;
+                    case '\t': *out++ = '\\'; *out++ = 't'; break;
+                    case '\r': *out++ = '\\'; *out++ = 'r'; break;
+                    default:
+                        if ((unsigned char) c < 0x20) {
+                            memcpy(out, "\\u00", 4);
+                            out[4] = hex[(unsigned char) c >> 4];
+                            out[5] = hex[c & 0xf];
+                            out += 6;
+                        } else {
+                            // Anything else, including UTF-8, goes as is
+                            *out++ = c;
+                        }
+                }
+            }
+
+            return out;
+        }
+
+        inline char *tsv_string(char *out, std::string_view text)
+        {
+            for (const char c : text) {
+                switch (c) {
+                    case '\\': *out++ = '\\'; *out++ = '\\'; break;
+                    case '\n': *out++ = '\\'; *out++ = 'n'; break;
+                    case '\t': *out++ = '\\'; *out++ = 't'; break;
+                    case '\r': *out++ = '\\'; *out++ = 'r'; break;
+                    default: *out++ = c;
+                }
+            }
+
+            return out;
+        }
+
+        // Like join_paths(), but escaped straight into `out`
+        template <class Escape>
+        char *joined(char *out, const Event_View &ev, Escape escape)
+        {
+            out = escape(out, ev.path);
+            if (!ev.path.empty() && !ev.name.empty()
+                    && ev.path.back() != path_sep) {
+                *out++ = path_sep;
+            }
+            return escape(out, ev.name);
+        }
+
+        // Returns how many bytes the line took, newline included
+        inline std::size_t json_line(const Event_View &ev, char *out)
+        {
+            char *at = out;
+
+            memcpy(at, "{\"wd\":", 6);
+            at = number(at + 6, ev.wd);
+
+            memcpy(at, ",\"mask\":[", 9);
+            at += 9;
+            bool first = true;
+            Flags::for_each_name(ev.mask, Flags::Names::All,
+                    [&at, &first](const char *name) {
+                        if (!first) *at++ = ',';
+                        first = false;
+
+                        const std::size_t length = strlen(name);
+                        *at++ = '"';
+                        memcpy(at, name, length);
+                        at += length;
+                        *at++ = '"';
+                    });
+
+            memcpy(at, "],\"cookie\":", 11);
+            at = number(at + 11, ev.cookie);
+
+            memcpy(at, ",\"path\":\"", 9);
+            at = joined(at + 9, ev, json_string);
+
+            memcpy(at, "\"}\n", 3);
+            return at + 3 - out;
+        }
+
+        inline std::size_t tsv_line(const Event_View &ev, char *out)
+        {
+            char *at = number(out, ev.wd);
+            *at++ = '\t';
+
+            at += Flags::format_names(ev.mask, Flags::Names::All, at, 480);
+            *at++ = '\t';
+
+            at = number(at, ev.cookie);
+            *at++ = '\t';
+
+            at = joined(at, ev, tsv_string);
+            *at++ = '\n';
+            return at - out;
+        }
+
+        inline std::size_t line(Sink_Format format, const Event_View &ev,
+                                char *out)
+        {
+            return (format == Sink_Format::TSV) ? tsv_line(ev, out)
+                                                : json_line(ev, out);
+        }
+
+    } // namespace Format
+
+    struct Sink_Options {
+        Sink_Format format = Sink_Format::JSON_Lines;
+        // Lines are written into chunks of this size, and all the full ones
+        // go out in one writev()
+        std::size_t chunk_size = 1 << 16;
+        std::size_t chunks = 4;
+        // Write out at the end of every batch, so nothing sits in here
+        // between reads. Otherwise only when the chunks fill up (or on
+        // flush()).
+        bool flush_each_batch = true;
+    };
+
+    struct Sink_Stats {
+        std::size_t lines = 0;
+        std::size_t bytes = 0;
+        // Calls to writev()
+        std::size_t writes = 0;
+    };
+
+    // Writes events to a descriptor as JSON lines or TSV. Everything it
+    // needs is allocated up front, so writing an event never allocates;
+    // lines pile up in chunks that go out together in one writev(). Hand
+    // it whole batches (see `batch_callback()`) to write once per read.
+    //
+    // Doesn't close the descriptor. Errors writing throw Watch::Exception
+    // (except from the destructor, which has nobody to tell).
+    class Event_Sink {
+        public:
+            // Don't allow assignment or copying
+            Event_Sink(const Event_Sink &src) = delete;
+            Event_Sink& operator=(const Event_Sink &src) = delete;
+
+            explicit Event_Sink(int fd,
+                                const Sink_Options &options = Sink_Options())
+                : fd_(fd), options_(options)
+            {
+                options_.chunk_size = std::max<std::size_t>(
+                        options_.chunk_size, smallest_chunk);
+                options_.chunks = std::min<std::size_t>(
+                        std::max<std::size_t>(options_.chunks, 1), IOV_MAX);
+
+                storage_.reset(new char[options_.chunk_size
+                                        * options_.chunks]);
+                used_.assign(options_.chunks, 0);
+                iov_.resize(options_.chunks);
+            }
+
+            ~Event_Sink()
+            {
+                try {
+                    flush();
+                } catch (const Exception&) {}
+            }
+
+            void write(const Event_View &ev)
+            {
+                const std::size_t need = Format::bound(ev);
+                if (need > options_.chunk_size) {
+                    write_long_(ev, need);
+                    return;
+                }
+
+                if (options_.chunk_size - used_[current_] < need) {
+                    if (++current_ == options_.chunks) flush();
+                }
+
+                char *at = chunk_(current_) + used_[current_];
+                const std::size_t length = Format::line(options_.format, ev,
+                                                        at);
+                used_[current_] += length;
+
+                ++stats_.lines;
+                stats_.bytes += length;
+            }
+
+            void write(const Event_Batch &batch)
+            {
+                for (const auto &ev : batch) write(ev);
+                if (options_.flush_each_batch) flush();
+            }
+
+            // Write out everything waiting
+            void flush()
+            {
+                std::size_t count = 0;
+                for (std::size_t i = 0; i <= current_ && i < options_.chunks;
+                        ++i) {
+                    if (used_[i] == 0) continue;
+                    iov_[count].iov_base = chunk_(i);
+                    iov_[count].iov_len = used_[i];
+                    ++count;
+                }
+
+                // Start over even if the write fails, so we don't write
+                // the same thing twice
+                current_ = 0;
+                std::fill(used_.begin(), used_.end(), 0);
+
+                write_all_(iov_.data(), count);
+            }
+
+            Batch_Callback batch_callback()
+            {
+                return [this](const Event_Batch &batch) { write(batch); };
+            }
+
+            View_Callback callback()
+            {
+                return [this](const Event_View &ev) { write(ev); };
+            }
+
+            Sink_Stats stats() const
+            {
+                return stats_;
+            }
+
+        private:
+            enum : std::size_t { smallest_chunk = 4096 };
+
+            // Paths longer than PATH_MAX can happen, just not often enough
+            // to set aside room for
+            void write_long_(const Event_View &ev, std::size_t need)
+            {
+                flush();
+
+                std::unique_ptr<char[]> line(new char[need]);
+                iovec iov;
+                iov.iov_base = line.get();
+                iov.iov_len = Format::line(options_.format, ev, line.get());
+
+                ++stats_.lines;
+                stats_.bytes += iov.iov_len;
+                write_all_(&iov, 1);
+            }
+
+            char *chunk_(std::size_t i)
+            {
+                return storage_.get() + i * options_.chunk_size;
+            }
+
+            void write_all_(iovec *iov, std::size_t count)
+            {
+                while (count > 0) {
+                    const ssize_t wrote = writev(fd_, iov, count);
+                    if (wrote < 0) {
+                        if (errno == EINTR) continue;
+                        throw Exception("Failed to write events");
+                    }
+                    ++stats_.writes;
+
+                    // Whatever didn't make it goes next time around
+                    std::size_t left = wrote;
+                    while (count > 0 && left >= iov->iov_len) {
+                        left -= iov->iov_len;
+                        ++iov;
+                        --count;
+                    }
+                    if (count > 0) {
+                        iov->iov_base = (char*) iov->iov_base + left;
+                        iov->iov_len -= left;
+                    }
+                }
+            }
+
+            int fd_;
+            Sink_Options options_;
+
+            std::unique_ptr<char[]> storage_;
+            std::vector<std::size_t> used_;
+            std::vector<iovec> iov_;
+            std::size_t current_ = 0;
+
+            Sink_Stats stats_;
+    };
+
+} // namespace Watch
+
+#endif
@@ -0,0 +1,431 @@
+#ifndef WATCHDOG_STATS_H
+#define WATCHDOG_STATS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Defining this as true makes Sentry keep the numbers below. Otherwise
+// none of it is compiled in, and `Sentry::stats()` comes back empty.
+#ifndef WATCHDOG_STATS
+#define WATCHDOG_STATS false
+#endif
+
+namespace Watch {
+
+    // Counts in powers of two: bucket i holds values below 2^i (and at
+    // least 2^(i-1)), with everything bigger in the last one
+    struct Histogram_Stats {
+        enum : std::size_t { buckets = 40 };
+
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t bucket[buckets] = {};
+
+        void add(const Histogram_Stats &other)
+        {
+            count += other.count;
+            sum += other.sum;
+            for (std::size_t i = 0; i < buckets; ++i) {
+                bucket[i] += other.bucket[i];
+            }
+        }
+
+        // Roughly the value that fraction `q` of everything was below
+        uint64_t quantile(double q) const
+        {
+            const double target = q * double(count);
+            uint64_t seen = 0;
+            for (std::size_t i = 0; i < buckets; ++i) {
+                seen += bucket[i];
+                if (seen > 0 && double(seen) >= target) {
+                    return uint64_t(1) << i;
+                }
+            }
+            return uint64_t(1) << (buckets - 1);
+        }
+    };
+
+    struct Callback_Stats {
+        // "callback", "view" or "batch", and which one of those it was,
+        // in the order they were added
+        std::string kind;
+        std::size_t index = 0;
+        uint64_t calls = 0;
+        Histogram_Stats nanoseconds;
+    };
+
+    struct Sentry_Stats {
+        // Whether anything was being kept at all
+        bool enabled = false;
+
+        uint64_t reads = 0;
+        uint64_t events = 0;
+        uint64_t ignored = 0;
+        uint64_t overflows = 0;
+        Histogram_Stats bytes_per_read;
+        Histogram_Stats events_per_read;
+
+        std::vector<Callback_Stats> callbacks;
+
+        // Right now
+        uint64_t watches = 0;
+        std::chrono::microseconds crawling{0};
+    };
+
+    namespace Stats {
+
+        // Something only one thread ever changes, but any thread can read.
+        // Adding to it is a plain load and store.
+        class Counter {
+            public:
+                void add(uint64_t n = 1)
+                {
+                    value_.store(value_.load(std::memory_order_relaxed) + n,
+                                 std::memory_order_relaxed);
+                }
+
+                // For when several threads add to it
+                void add_shared(uint64_t n = 1)
+                {
+                    value_.fetch_add(n, std::memory_order_relaxed);
+                }
+
+                void set(uint64_t n)
+                {
+                    value_.store(n, std::memory_order_relaxed);
+                }
+
+                uint64_t get() const
+                {
+                    return value_.load(std::memory_order_relaxed);
+                }
+
+            private:
+                std::atomic<uint64_t> value_{0};
+        };
+
+        class Histogram {
+            public:
+                template <bool Shared = false>
+                void record(uint64_t value)
+                {
+                    std::size_t i = 0;
+                    if (value != 0) {
+                        i = 64 - __builtin_clzll(value);
+                        if (i >= Histogram_Stats::buckets) {
+                            i = Histogram_Stats::buckets - 1;
+                        }
+                    }
+
+                    if (Shared) {
+                        bucket_[i].add_shared();
+                        count_.add_shared();
+                        sum_.add_shared(value);
+                    } else {
+                        bucket_[i].add();
+                        count_.add();
+                        sum_.add(value);
+                    }
+                }
+
+                Histogram_Stats snapshot() const
+                {
+                    Histogram_Stats stats;
+                    stats.count = count_.get();
+                    stats.sum = sum_.get();
+                    for (std::size_t i = 0; i < Histogram_Stats::buckets;
+                            ++i) {
+                        stats.bucket[i] = bucket_[i].get();
+                    }
+                    return stats;
+                }
+
+            private:
+                Counter count_;
+                Counter sum_;
+                Counter bucket_[Histogram_Stats::buckets];
+        };
+
+        // Which of `lanes` the calling thread counts into. Threads take
+        // turns, so up to `lanes` of them never share one.
+        inline std::size_t thread_lane(std::size_t lanes)
+        {
+            static std::atomic<std::size_t> next{0};
+            thread_local const std::size_t lane = next++;
+            return lane % lanes;
+        }
+
+        // Where Sentry keeps its numbers. Everything is written by the
+        // thread reading events, except for callbacks, which may run on
+        // several workers at once, so each of those counts into a lane of
+        // its own.
+        template <bool Enabled>
+        class Recorder {
+            public:
+                void read(std::size_t bytes, std::size_t events)
+                {
+                    reads_.add();
+                    events_.add(events);
+                    bytes_per_read_.record(bytes);
+                    events_per_read_.record(events);
+                }
+
+                void ignored() { ignored_.add(); }
+                void overflowed() { overflows_.add(); }
+                void watches(std::size_t count) { watches_.set(count); }
+
+                // Counts as crawling until it goes out of scope
+                struct Crawl {
+                    Recorder *stats;
+                    std::chrono::steady_clock::time_point start;
+                    ~Crawl()
+                    {
+                        stats->crawling_.add(
+                                std::chrono::duration_cast<
+                                    std::chrono::microseconds>(
+                                        std::chrono::steady_clock::now()
+                                        - start).count());
+                    }
+                };
+
+                Crawl crawling()
+                {
+                    return Crawl{ this, std::chrono::steady_clock::now() };
+                }
+
+                // Wraps `cb` so that its calls get counted and timed
+                template <class Callback_>
+                Callback_ timed(Callback_ cb, const char *kind)
+                {
+                    std::size_t index = 0;
+                    for (const auto &slot : callbacks_) {
+                        if (slot.kind == kind) ++index;
+                    }
+
+                    // A deque, so the slot never moves
+                    callbacks_.emplace_back(kind, index);
+                    Slot *slot = &callbacks_.back();
+
+                    return [slot, cb](auto&&... args) {
+                        const auto start = std::chrono::steady_clock::now();
+
+                        // Counted even if it throws
+                        struct Done {
+                            Slot *slot;
+                            std::chrono::steady_clock::time_point start;
+                            ~Done()
+                            {
+                                auto &lane = slot->lanes[
+                                        thread_lane(Slot::count)];
+                                lane.calls.add_shared();
+                                lane.nanoseconds.template record<true>(
+                                        std::chrono::duration_cast<
+                                            std::chrono::nanoseconds>(
+                                                std::chrono::steady_clock
+                                                    ::now() - start)
+                                        .count());
+                            }
+                        } done{ slot, start };
+
+                        cb(std::forward<decltype(args)>(args)...);
+                    };
+                }
+
+                Sentry_Stats snapshot() const
+                {
+                    Sentry_Stats stats;
+                    stats.enabled = true;
+                    stats.reads = reads_.get();
+                    stats.events = events_.get();
+                    stats.ignored = ignored_.get();
+                    stats.overflows = overflows_.get();
+                    stats.bytes_per_read = bytes_per_read_.snapshot();
+                    stats.events_per_read = events_per_read_.snapshot();
+                    stats.watches = watches_.get();
+                    stats.crawling = std::chrono::microseconds(
+                            crawling_.get());
+
+                    for (const auto &slot : callbacks_) {
+                        Callback_Stats callback;
+                        callback.kind = slot.kind;
+                        callback.index = slot.index;
+                        for (const auto &lane : slot.lanes) {
+                            callback.calls += lane.calls.get();
+                            callback.nanoseconds.add(
+                                    lane.nanoseconds.snapshot());
+                        }
+                        stats.callbacks.push_back(std::move(callback));
+                    }
+
+                    return stats;
+                }
+
+            private:
+                struct Slot {
+                    Slot(const char *kind_, std::size_t index_)
+                        : kind(kind_), index(index_)
+                    {}
+
+                    // A cache line or more each, so workers counting the
+                    // same callback don't fight over one. Still atomic
+                    // adds, for when there are more workers than lanes.
+                    enum : std::size_t { count = 8 };
+                    struct alignas(64) Lane {
+                        Counter calls;
+                        Histogram nanoseconds;
+                    };
+
+                    std::string kind;
+                    std::size_t index;
+                    Lane lanes[count];
+                };
+
+                Counter reads_;
+                Counter events_;
+                Counter ignored_;
+                Counter overflows_;
+                Histogram bytes_per_read_;
+                Histogram events_per_read_;
+                Counter watches_;
+                Counter crawling_;
+                std::deque<Slot> callbacks_;
+        };
+
+        // Nothing at all
+        template <>
+        class Recorder<false> {
+            public:
+                void read(std::size_t, std::size_t) {}
+                void ignored() {}
+                void overflowed() {}
+                void watches(std::size_t) {}
+
+                struct Crawl {
+                    ~Crawl() {}
+                };
+
+                Crawl crawling()
+                {
+                    return Crawl();
+                }
+
+                template <class Callback_>
+                Callback_ timed(Callback_ cb, const char*)
+                {
+                    return cb;
+                }
+
+                Sentry_Stats snapshot() const
+                {
+                    return Sentry_Stats();
+                }
+        };
+
+        inline void append_histogram(std::string &out, const std::string &name,
+                                     const char *labels,
+                                     const Histogram_Stats &h)
+        {
+            char line[256];
+            const std::string open = *labels ? std::string("{") + labels + ","
+                                             : std::string("{");
+
+            uint64_t seen = 0;
+            for (std::size_t i = 0; i < Histogram_Stats::buckets; ++i) {
+                seen += h.bucket[i];
+                // Only where something changes, plus the end
+                if (h.bucket[i] == 0 && i + 1 < Histogram_Stats::buckets) {
+                    continue;
+                }
+
+                if (i + 1 < Histogram_Stats::buckets) {
+                    snprintf(line, sizeof(line), "%s_bucket%sle=\"%llu\"} "
+                             "%llu\n", name.c_str(), open.c_str(),
+                             (unsigned long long) ((uint64_t(1) << i) - 1),
+                             (unsigned long long) seen);
+                } else {
+                    snprintf(line, sizeof(line), "%s_bucket%sle=\"+Inf\"} "
+                             "%llu\n", name.c_str(), open.c_str(),
+                             (unsigned long long) h.count);
+                }
+                out += line;
+            }
+
+            const std::string closed = *labels ? std::string("{") + labels
+                                                 + "}"
+                                               : std::string();
+            snprintf(line, sizeof(line), "%s_sum%s %llu\n%s_count%s %llu\n",
+                     name.c_str(), closed.c_str(),
+                     (unsigned long long) h.sum,
+                     name.c_str(), closed.c_str(),
+                     (unsigned long long) h.count);
+            out += line;
+        }
+
+    } // namespace Stats
+
+    // The Prometheus text format, with every name starting with `prefix`.
+    // Histogram buckets are powers of two, and hold whole numbers, so `le`
+    // is one less than a power of two. Callback latencies are in
+    // nanoseconds.
+    inline std::string to_prometheus(const Sentry_Stats &stats,
+                                     const std::string &prefix = "watchdog")
+    {
+        std::string out;
+        if (!stats.enabled) return out;
+
+        char line[256];
+        auto counter = [&](const char *name, const char *type,
+                           uint64_t value) {
+            snprintf(line, sizeof(line), "# TYPE %s_%s %s\n%s_%s %llu\n",
+                     prefix.c_str(), name, type, prefix.c_str(), name,
+                     (unsigned long long) value);
+            out += line;
+        };
+
+        counter("reads_total", "counter", stats.reads);
+        counter("events_total", "counter", stats.events);
+        counter("ignored_total", "counter", stats.ignored);
+        counter("overflows_total", "counter", stats.overflows);
+        counter("watches", "gauge", stats.watches);
+        counter("crawl_microseconds_total", "counter",
+                uint64_t(stats.crawling.count()));
+
+        out += "# TYPE " + prefix + "_read_bytes histogram\n";
+        Stats::append_histogram(out, prefix + "_read_bytes", "",
+                                stats.bytes_per_read);
+        out += "# TYPE " + prefix + "_read_events histogram\n";
+        Stats::append_histogram(out, prefix + "_read_events", "",
+                                stats.events_per_read);
+
+        if (stats.callbacks.empty()) return out;
+
+        out += "# TYPE " + prefix + "_callback_calls_total counter\n";
+        for (const auto &callback : stats.callbacks) {
+            snprintf(line, sizeof(line), "%s_callback_calls_total"
+                     "{kind=\"%s\",index=\"%zu\"} %llu\n",
+                     prefix.c_str(), callback.kind.c_str(), callback.index,
+                     (unsigned long long) callback.calls);
+            out += line;
+        }
+
+        out += "# TYPE " + prefix + "_callback_nanoseconds histogram\n";
+        for (const auto &callback : stats.callbacks) {
+            snprintf(line, sizeof(line), "kind=\"%s\",index=\"%zu\"",
+                     callback.kind.c_str(), callback.index);
+            Stats::append_histogram(out, prefix + "_callback_nanoseconds",
+                                    line, callback.nanoseconds);
+        }
+
+        return out;
+    }
+
+} // namespace Watch
+
+#endif
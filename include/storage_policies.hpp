@@ -1,6 +1,7 @@
 #ifndef WATCHDOG_PATHS_H
 #define WATCHDOG_PATHS_H
 
+#include <cstddef>
 #include <string>
 
 #include <vector>
@@ -15,9 +16,41 @@ namespace Watch {
     // Abstract class?
     class Storage_Policy {
         public:
+            virtual ~Storage_Policy() {}
+
             virtual void add(int key, std::string value) = 0;
-            virtual std::string find(int key) = 0;
+            // Unknown keys give you an empty string
+            virtual const std::string &find(int key) const = 0;
+            virtual bool contains(int key) const = 0;
+            virtual void remove(int key) = 0;
+            // Moves `from`, and everything under it, to `to`
+            virtual void repath(const std::string &from,
+                                const std::string &to) = 0;
             /* virtual void append(const Storage_Policy &s) = 0; */
+
+            // Is `path` either `dir` or somewhere under it?
+            static bool is_under(const std::string &path,
+                                 const std::string &dir)
+            {
+                if (path.compare(0, dir.size(), dir) != 0) return false;
+
+                return path.size() == dir.size()
+                    || path[dir.size()] == '/'
+                    || (!dir.empty() && dir.back() == '/');
+            }
+
+        protected:
+            static const std::string &none()
+            {
+                static const std::string nothing;
+                return nothing;
+            }
+
+            static void rebase(std::string &path, const std::string &from,
+                               const std::string &to)
+            {
+                if (is_under(path, from)) path.replace(0, from.size(), to);
+            }
     };
 
     class Small : public Storage_Policy {
@@ -27,14 +60,38 @@ namespace Watch {
                 back_.push_back(std::make_pair(key, value));
             }
 
-            std::string find(int key) override
+            const std::string &find(int key) const override
             {
                 auto it = std::find_if(back_.begin(), back_.end(),
                         [key](const Watch_Path &wp) {
                             return wp.first == key;
                         });
 
-                return it->second;
+                return (it == back_.end()) ? none() : it->second;
+            }
+
+            bool contains(int key) const override
+            {
+                return std::any_of(back_.begin(), back_.end(),
+                        [key](const Watch_Path &wp) {
+                            return wp.first == key;
+                        });
+            }
+
+            // There may be more than one of each key
+            void remove(int key) override
+            {
+                back_.erase(std::remove_if(back_.begin(), back_.end(),
+                            [key](const Watch_Path &wp) {
+                                return wp.first == key;
+                            }),
+                        back_.end());
+            }
+
+            void repath(const std::string &from,
+                        const std::string &to) override
+            {
+                for (auto &wp : back_) rebase(wp.second, from, to);
             }
 
             void append(const Small &s)
@@ -42,6 +99,18 @@ namespace Watch {
                 back_.insert(back_.end(), s.back_.begin(), s.back_.end());
             }
 
+            std::size_t size() const
+            {
+                return back_.size();
+            }
+
+            // Calls f(wd, path) for every entry
+            template <class F>
+            void for_each(F f) const
+            {
+                for (const auto &wp : back_) f(wp.first, wp.second);
+            }
+
             using storage_type = std::vector<Watch_Path>;
 
             const storage_type &backing()
@@ -60,9 +129,27 @@ namespace Watch {
                 back_.insert(std::make_pair(key, value));
             }
 
-            std::string find(int key) override
+            const std::string &find(int key) const override
+            {
+                auto it = back_.find(key);
+
+                return (it == back_.end()) ? none() : it->second;
+            }
+
+            bool contains(int key) const override
+            {
+                return back_.count(key) != 0;
+            }
+
+            void remove(int key) override
             {
-                return back_[key];
+                back_.erase(key);
+            }
+
+            void repath(const std::string &from,
+                        const std::string &to) override
+            {
+                for (auto &wp : back_) rebase(wp.second, from, to);
             }
 
             void append(const Large &s)
@@ -70,6 +157,18 @@ namespace Watch {
                 back_.insert(s.back_.begin(), s.back_.end());
             }
 
+            std::size_t size() const
+            {
+                return back_.size();
+            }
+
+            // Calls f(wd, path) for every entry
+            template <class F>
+            void for_each(F f) const
+            {
+                for (const auto &wp : back_) f(wp.first, wp.second);
+            }
+
             using storage_type = std::map<Watch_Path::first_type,
                                           Watch_Path::second_type>;
 
@@ -82,6 +181,144 @@ namespace Watch {
             storage_type back_;
     };
 
+    // Open addressing with linear probing, keyed directly by wd. The kernel
+    // hands out wds more or less sequentially, so using the wd itself as the
+    // hash puts neighbors in neighboring slots and almost never collides.
+    // Keys live apart from the paths so that probing stays in cache.
+    class Flat : public Storage_Policy {
+        public:
+            Flat()
+                : keys_(initial_capacity, empty), values_(initial_capacity)
+            {}
+
+            // Replaces the path if the key is already present
+            void add(int key, std::string value) override
+            {
+                if ((size_ + 1) * 4 > keys_.size() * 3) {
+                    grow();
+                }
+
+                std::size_t i = slot(key);
+                if (keys_[i] == empty) {
+                    keys_[i] = key;
+                    ++size_;
+                }
+                values_[i] = std::move(value);
+            }
+
+            const std::string &find(int key) const override
+            {
+                std::size_t i = slot(key);
+
+                return (keys_[i] == empty) ? none() : values_[i];
+            }
+
+            bool contains(int key) const override
+            {
+                return keys_[slot(key)] != empty;
+            }
+
+            // Backward shift deletion, so that there are no tombstones to
+            // slow down later lookups
+            void remove(int key) override
+            {
+                std::size_t hole = slot(key);
+                if (keys_[hole] == empty) return;
+
+                const std::size_t mask = keys_.size() - 1;
+
+                for (std::size_t i = (hole + 1) & mask;
+                        keys_[i] != empty;
+                        i = (i + 1) & mask) {
+                    std::size_t home = hash(keys_[i]);
+
+                    // Leave it alone if its home is cyclically in (hole, i]
+                    bool stays = (hole < i)
+                        ? (hole < home && home <= i)
+                        : (hole < home || home <= i);
+                    if (stays) continue;
+
+                    keys_[hole] = keys_[i];
+                    values_[hole] = std::move(values_[i]);
+                    hole = i;
+                }
+
+                keys_[hole] = empty;
+                std::string().swap(values_[hole]);
+                --size_;
+            }
+
+            void repath(const std::string &from,
+                        const std::string &to) override
+            {
+                for (std::size_t i = 0; i < keys_.size(); ++i) {
+                    if (keys_[i] != empty) rebase(values_[i], from, to);
+                }
+            }
+
+            void append(const Flat &s)
+            {
+                for (std::size_t i = 0; i < s.keys_.size(); ++i) {
+                    if (s.keys_[i] != empty) add(s.keys_[i], s.values_[i]);
+                }
+            }
+
+            std::size_t size() const
+            {
+                return size_;
+            }
+
+            // Calls f(wd, path) for every entry
+            template <class F>
+            void for_each(F f) const
+            {
+                for (std::size_t i = 0; i < keys_.size(); ++i) {
+                    if (keys_[i] != empty) f(keys_[i], values_[i]);
+                }
+            }
+
+        private:
+            enum : int { empty = -1 };
+            enum : std::size_t { initial_capacity = 16 };
+
+            std::size_t hash(int key) const
+            {
+                return static_cast<unsigned>(key) & (keys_.size() - 1);
+            }
+
+            // Either the slot holding `key`, or the empty slot where it
+            // would go
+            std::size_t slot(int key) const
+            {
+                const std::size_t mask = keys_.size() - 1;
+
+                std::size_t i = hash(key);
+                while (keys_[i] != empty && keys_[i] != key) {
+                    i = (i + 1) & mask;
+                }
+
+                return i;
+            }
+
+            void grow()
+            {
+                std::vector<int> keys(keys_.size() * 2, empty);
+                std::vector<std::string> values(keys.size());
+
+                keys_.swap(keys);
+                values_.swap(values);
+                size_ = 0;
+
+                for (std::size_t i = 0; i < keys.size(); ++i) {
+                    if (keys[i] != empty) add(keys[i], std::move(values[i]));
+                }
+            }
+
+            std::vector<int> keys_;
+            std::vector<std::string> values_;
+            std::size_t size_ = 0;
+    };
+
 } // Watch
 
 #endif
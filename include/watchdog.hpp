@@ -2,7 +2,10 @@
 #define WATCHDOG_H
 
 #include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 
 // inotify
@@ -12,19 +15,45 @@
 #include <cstdio>
 #endif
 
+#include <cstring>
 #include <functional>
+#include <future>
+#include <mutex>
 #include <utility>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string_view>
+#include <thread>
 
 #include <vector>
 #include <map>
 #include <set>
 
 #include <flags.hpp>
+#include <buffer_pool.hpp>
+#include <coalesce.hpp>
+#include <coroutine.hpp>
+#include <dispatch_table.hpp>
+#include <event_log.hpp>
+#include <event_batch.hpp>
+#include <event_view.hpp>
 #include <exceptions.hpp>
+#include <executor.hpp>
+#include <handlers.hpp>
 #include <helpers.hpp>
+#include <ignore_rules.hpp>
+#include <late_attach.hpp>
+#include <poller.hpp>
+#include <reactor.hpp>
+#include <resync.hpp>
+#include <ring.hpp>
+#include <stats.hpp>
 #include <watchdog_common.hpp>
 #include <storage_policies.hpp>
+#include <path_tree.hpp>
 
 // If you want to override the defaults, this will allow you to do so by
 // defining these names before you include this header.
@@ -53,7 +82,8 @@ namespace Watch {
     using Event = inotify_event;
 
     // Callbacks attached to Events are fired and given the Event as an
-    // argument.
+    // argument. If you'd rather not pay for a copy of the path on every
+    // event, register a View_Callback instead (see event_view.hpp).
     using Callback = std::function<void(Event*, std::string path)>;
 
     // Do you want to watch directories recursively?
@@ -64,21 +94,49 @@ namespace Watch {
 
     // max_events and max_len_name used to determine internal buffer length
     // For more information, see man or info pages for inotify
+    //
+    // Handler_Set is a fixed set of handlers called without going through
+    // std::function (see handlers.hpp and Static_Sentry below)
     template < Recurse RECURSE,
                FlagBearer Default_Flags = Flags::Add,
                class Container = Small,
                std::size_t MAX_EVENTS = WATCHDOG_MAX_EVENTS,
-               std::size_t MAX_LEN_NAME = WATCHDOG_MAX_LEN_NAME >
-    class Sentry {
+               std::size_t MAX_LEN_NAME = WATCHDOG_MAX_LEN_NAME,
+               class Handler_Set = No_Handlers >
+    class Sentry : public Pollable {
         public:
             // Don't allow assignment or copying
             Sentry(const Sentry &src) = delete;
             Sentry& operator=(const Sentry &src) = delete;
 
-            // Path is required, but the ignore list is optional
+            // Path is required, but the ignore list is optional. These are
+            // exact paths, each of which is ignored along with everything
+            // under it.
             Sentry(const std::string &path,
                    const std::set<std::string> ignore = {})
-                : paths_(1, path), ignored_(ignore)
+                : Sentry(path, literal_rules_(path, ignore))
+            {}
+
+            // Ignore whatever matches .gitignore style rules, relative to
+            // `path` (see ignore_rules.hpp). Ignored directories aren't
+            // crawled or watched, and events about ignored names are
+            // dropped before anyone hears about them.
+            //
+            // When watching recursively, `attach` can leave all but the
+            // most important part of the tree to be watched in the
+            // background (see late_attach.hpp).
+            Sentry(const std::string &path, Ignore_Rules rules,
+                   const Attach_Options &attach = Attach_Options())
+                : Sentry(path, Handler_Set(), std::move(rules), attach)
+            {}
+
+            // With a fixed set of handlers, which are watched for right
+            // away
+            Sentry(const std::string &path, Handler_Set handlers,
+                   Ignore_Rules rules = Ignore_Rules(),
+                   const Attach_Options &attach = Attach_Options())
+                : root_(path), paths_(1, path), rules_(std::move(rules)),
+                  handlers_(std::move(handlers))
             {
                 if (WATCHDOG_DEBUG) {
                     fprintf(stderr, "[DEBUG]: Setting up to watch %s %s\n",
@@ -87,167 +145,1420 @@ namespace Watch {
                                 ? "normally" : "recursively");
                 }
 
-                fd = inotify_init();
+                // Nonblocking so that we can drain the queue from an event
+                // loop without ever getting stuck in read()
+                fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
                 if (fd < 0) {
                     throw Exception("Failed to initiate watch");
                 }
 
                 if (RECURSE == Watch::Recursively) {
-                    for (const auto &path_ : enumerateSubdirectories(path)) {
-                        if (ignored_.find(path_) == ignored_.end()) {
-                            paths_.push_back(path_);
-                        } else if (WATCHDOG_DEBUG) {
-                            fprintf(stderr, "[DEBUG]: Ignoring %s\n",
-                                    path_.c_str());
-                        }
+                    // Ignored directories are skipped along with everything
+                    // under them
+                    Prune prune = nullptr;
+                    if (!rules_.empty()) {
+                        prune = [this](const std::string &path_) {
+                            return rules_.ignored(relative_(path_), true);
+                        };
+                    }
+
+                    const auto crawling = stats_.crawling();
+
+                    // Anything that changes from here on in a directory we
+                    // only watch later needs catching up on
+                    timespec since;
+                    clock_gettime(CLOCK_REALTIME, &since);
+
+                    std::vector<std::string> found;
+                    if (attach.lazy()) {
+                        std::mutex m;
+                        std::vector<std::string> cold;
+
+                        found = enumerateSubdirectories(path,
+                                [&](const std::string &path_) {
+                                    if (prune && prune(path_)) return true;
+                                    if (hot_(relative_(path_), attach)) {
+                                        return false;
+                                    }
+
+                                    std::lock_guard<std::mutex> lock(m);
+                                    cold.push_back(path_);
+                                    return true;
+                                });
+
+                        late_.reset(new Late_Attach(fd, std::move(cold),
+                                                    prune, attach, since));
+                    } else {
+                        found = enumerateSubdirectories(path, prune);
                     }
+
+                    // The first one is the root, which we already have
+                    paths_.insert(paths_.end(),
+                                  std::make_move_iterator(found.begin() + 1),
+                                  std::make_move_iterator(found.end()));
                 }
 
                 if (WATCHDOG_DEBUG) {
                     for (const auto &path : paths_) {
-                        fprintf(stderr, "[DEBUG]: Watching %s\n", path.c_str());
+                        fprintf(stderr, "[DEBUG]: Will watch %s\n",
+                                path.c_str());
                     }
                 }
+
+                if (Handler_Set::mask != 0) watch_(Handler_Set::mask);
+            }
+
+            // Nothing but a place to `replay()` a log into. Doesn't look at
+            // the filesystem, and only knows about the directories the log
+            // says were watched. Give it the same rules as the Sentry that
+            // recorded the log.
+            explicit Sentry(const Event_Log_Reader &log,
+                            Ignore_Rules rules = Ignore_Rules())
+                : root_(log.root()), rules_(std::move(rules)),
+                  replaying_(true)
+            {
+                fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+                if (fd < 0) {
+                    throw Exception("Failed to initiate watch");
+                }
             }
 
             ~Sentry()
             {
+                leave_reactor();
+
+                // Still using our descriptor
+                late_.reset();
+
                 if (WATCHDOG_DEBUG) {
                     fprintf(stderr, "[DEBUG]: Cleaning up watches for %s\n",
-                            paths_[0].c_str());
+                            root_.c_str());
                 }
 
-                for (const auto wd : wds.backing()) {
-                    inotify_rm_watch(fd, wd.first);
-                }
+                // Closing the descriptor drops every watch on it
                 close(fd);
             }
 
             void add_callback(Callback cb, FlagBearer flags)
+            {
+                watch_(flags);
+
+                _callbacks.add(flags, stats_.timed(std::move(cb), "callback"));
+            }
+
+            // Same as above, but nothing gets copied to call it
+            void add_callback(View_Callback cb, FlagBearer flags)
+            {
+                watch_(flags);
+
+                _view_callbacks.add(flags,
+                                    stats_.timed(std::move(cb), "view"));
+            }
+
+            // Called once per read() with every matching event from it, so
+            // that a sink can do one write or one transaction per batch
+            void add_batch_callback(Batch_Callback cb,
+                                    FlagBearer flags = On::All)
+            {
+                watch_(flags);
+
+                _batches.add(flags, stats_.timed(std::move(cb), "batch"));
+            }
+
+            // Until `attach_watches()`, registering callbacks only works out
+            // what to watch for, without touching the kernel. Registering
+            // several callbacks then costs one inotify_add_watch() per
+            // directory instead of one per directory per callback.
+            void hold_watches()
+            {
+                holding_ = true;
+            }
+
+            // Attach (or widen) every watch with what all the callbacks so
+            // far need. Called by `listen()` and `run_once()` if need be.
+            void attach_watches()
+            {
+                holding_ = false;
+                apply_();
+            }
+
+            // Ready once everything left for the background has been
+            // watched and picked up by the reading thread. Right away if
+            // nothing was.
+            std::shared_future<Attach_Report> attached() const
+            {
+                if (late_) return late_->finished();
+
+                std::promise<Attach_Report> done;
+                done.set_value(Attach_Report());
+                return done.get_future().share();
+            }
+
+            // Instead of throwing when the kernel's queue overflows, rescan
+            // every watched directory and make up events for whatever
+            // changed. Costs a snapshot of every watched directory, which
+            // is kept up to date as events come in. `report` hears about
+            // every resync.
+            void resync_on_overflow(Resync_Callback report = nullptr)
+            {
+                on_resync_ = std::move(report);
+
+                if (snapshot_) return;
+                snapshot_.reset(new Snapshot());
+
+                std::vector< std::pair<int, std::string> > dirs;
+                wds.for_each([&dirs](int wd, const std::string &path) {
+                        dirs.emplace_back(wd, path);
+                    });
+                snapshot_->take(dirs);
+
+                // Widen the existing watches (if any) to what the snapshot
+                // needs
+                if (!dirs.empty()) watch_(0);
+            }
+
+            // Hold on to bursts of events about the same file and deliver
+            // them as one, with their masks OR-ed together (see
+            // coalesce.hpp). Anything held is delivered from `run_once()` (or
+            // the Reactor) once its time is up.
+            void coalesce(const Coalesce_Options &options = Coalesce_Options())
+            {
+                if (coalescer_) {
+                    coalescer_->flush_all([this](Event *ev) {
+                            dispatch(ev);
+                        });
+                    _batches.deliver();
+                }
+
+                coalescer_.reset(new Coalescer(options));
+            }
+
+            Coalesce_Stats coalesce_stats() const
+            {
+                return coalescer_ ? coalescer_->stats() : Coalesce_Stats();
+            }
+
+            // Run callbacks on a pool of worker threads, so that slow ones
+            // don't hold up reading (see executor.hpp). Events for the same
+            // directory are still handled in order. Batch callbacks stay on
+            // the reading thread. Add callbacks before calling this, since
+            // the workers don't lock anything to look at them.
+            void offload(const Executor_Options &options = Executor_Options())
+            {
+                executor_.reset();
+                executor_.reset(new Executor(options,
+                        [this](const Executor::Job &job) {
+                            run_job_(job);
+                        }));
+            }
+
+            Executor_Stats executor_stats() const
+            {
+                return executor_ ? executor_->stats() : Executor_Stats();
+            }
+
+            // What's happened so far, if WATCHDOG_STATS is true (see
+            // stats.hpp). Safe to call from any thread once the callbacks
+            // are in, though numbers kept by different threads may be a
+            // moment apart.
+            Sentry_Stats stats() const
+            {
+                return stats_.snapshot();
+            }
+
+            // Push every matching event into `ring`, for other threads to pop
+            // without taking any locks. The ring has to outlive this Sentry,
+            // and may be shared with others.
+            void publish(Event_Ring &ring, FlagBearer flags = On::All)
+            {
+                watch_(flags);
+
+                ring_ = &ring;
+                ring_flags_ = flags;
+            }
+
+            // Append everything we read from here on to `log`, along with
+            // every directory we watch and every event we make up, so that
+            // it can all be replayed later (see event_log.hpp). The log has
+            // to outlive this Sentry, and can't be shared with others.
+            void record(Event_Log &log)
+            {
+                log_ = &log;
+
+                log.root(root_);
+                wds.for_each([&log](int wd, const std::string &path) {
+                        log.watch(wd, path);
+                    });
+            }
+
+            // Feed a recorded log through dispatch, as fast as we can, or
+            // at `speed` times the pace it was recorded at. Callbacks,
+            // rules, coalescing and workers all work as they do live.
+            // Returns the number of events dispatched. Stops early if
+            // `stop()` is called.
+            //
+            // Meant for a Sentry built from the log, but one watching the
+            // same tree works too. Recovering from an overflow rescans the
+            // filesystem, so that part isn't replayed.
+            std::size_t replay(const Event_Log_Reader &log, double speed = 0)
+            {
+                Event_Log_Reader::Cursor cursor = log.cursor();
+                Log_Entry entry;
+
+                const Clock::time_point start = Clock::now();
+                int64_t first = -1;
+                std::size_t dispatched = 0;
+
+                while (!stopping_.exchange(false) && cursor.next(entry)) {
+                    if (first < 0) first = entry.ns;
+                    if (speed > 0) {
+                        std::this_thread::sleep_until(start
+                                + std::chrono::nanoseconds(int64_t(
+                                        double(entry.ns - first) / speed)));
+                    }
+
+                    switch (entry.kind) {
+                        case Log_Kind::Batch: {
+                            // What new directories in this batch brought
+                            // with them, for adopt_() to pick up
+                            Log_Entry adopted;
+                            while (cursor.peek(adopted)
+                                    && adopted.kind == Log_Kind::Adopt) {
+                                cursor.next(adopted);
+                                adopted_.push_back(adopted);
+                            }
+
+                            dispatched += feed(entry.data, entry.length);
+                            break;
+                        }
+                        case Log_Kind::Watch: {
+                            auto watched = Event_Log_Reader::watched(entry);
+                            late_watched_(watched.first,
+                                          std::move(watched.second));
+                            break;
+                        }
+                        case Log_Kind::Made:
+                            synthetic_.insert(synthetic_.end(), entry.data,
+                                              entry.data + entry.length);
+                            deliver_synthetic_();
+                            break;
+                        case Log_Kind::Adopt:
+                            adopted_.push_back(entry);
+                            break;
+                        case Log_Kind::Root:
+                            break;
+                    }
+                }
+
+                // Nothing more is coming to push these out
+                if (coalescer_) {
+                    coalescer_->flush_all([this](Event *ev) {
+                            dispatch(ev);
+                        });
+                    _batches.deliver();
+                }
+
+                // Only good while we had the log
+                adopted_.clear();
+
+                return dispatched;
+            }
+
+            // Wait until the workers have run everything handed to them
+            void drain()
+            {
+                if (executor_) {
+                    executor_->drain();
+                    executor_->rethrow();
+                }
+            }
+
+            // Listen until someone calls `stop()`
+            void listen()
+            {
+                if (WATCHDOG_DEBUG) {
+                    fprintf(stderr, "[DEBUG]: Listening for changes to %s "
+                            "until stopped\n",
+                            root_.c_str());
+                }
+
+                do {
+                    run_once(std::chrono::milliseconds(-1));
+                } while (!stopped_);
+            }
+
+            // Wait up to `timeout` (forever if negative) for events, then
+            // drain and dispatch everything that is queued. Returns the
+            // number of events dispatched, which is 0 on timeout or when
+            // woken up by `stop()`, unless there were coalesced events
+            // whose time came up. A `stop()` only lasts until the end of
+            // the call that sees it, so the next one reads as usual.
+            std::size_t run_once(std::chrono::milliseconds timeout)
+            {
+                if (holding_) attach_watches();
+
+                epoll_event ready[2];
+                Clock::duration wait = timeout;
+
+                // Wake up in time to deliver whatever we're holding
+                const Clock::time_point due = deadline();
+                if (due != Clock::time_point::max()) {
+                    const Clock::duration until = std::max(
+                            due - Clock::now(), Clock::duration(0));
+                    if (timeout.count() < 0 || until < wait) wait = until;
+                }
+
+                // Already told to stop, so just look
+                Poller &poller = poller_();
+                if (stopping_.load()) wait = Clock::duration(0);
+
+                std::size_t dispatched = 0;
+                if (poller.wait(ready, 2, wait) != 0) dispatched = listen_();
+                dispatched += expire(Clock::now());
+
+                // A stop is for whoever is running us, and for nothing after
+                stopped_ = stopping_.exchange(false);
+
+                return dispatched;
+            }
+
+            // Keep running until the deadline passes or `stop()` is called
+            void run_until(Clock::time_point deadline)
+            {
+                for (auto now = Clock::now(); now < deadline;
+                        now = Clock::now()) {
+                    run_once(std::chrono::duration_cast<
+                            std::chrono::milliseconds>(deadline - now));
+                    if (stopped_) break;
+                }
+            }
+
+            // Makes `listen()` or `run_until()` return once the events
+            // currently being processed are done. Safe to call from any
+            // thread, including from inside a callback.
+            void stop()
+            {
+                stopping_.store(true);
+                if (Poller *poller = waiting_.load()) poller->wake();
+            }
+
+            // The inotify descriptor, for use in someone else's event loop.
+            // It's nonblocking, so call `run_once()` with a timeout of 0 when
+            // it becomes readable.
+            int pollable_fd() const override
+            {
+                return fd;
+            }
+
+            // Called by a Reactor before it first waits on us, the same way
+            // `run_once()` would
+            void prepare() override
+            {
+                if (holding_) attach_watches();
+            }
+
+            // Used by Reactor, which brings its own buffer so that idle
+            // watchers don't need one
+            std::size_t read_into(char *buffer,
+                                  std::size_t length) override
+            {
+                std::size_t bytes;
+                return read_events_(buffer, length, bytes);
+            }
+
+#if WATCHDOG_COROUTINES
+            // The next batch of events matching `flags`, read when awaited
+            // (see coroutine.hpp). Until something comes in, waits for the
+            // inotify descriptor through `scheduler`, which resumes us on
+            // whatever thread it likes. Nothing is read unless someone is
+            // awaiting, so a slow consumer just leaves events queued in the
+            // kernel. What comes back is good until the next call.
+            //
+            // Events go through the usual dispatch on the way, so callbacks
+            // still run. Coalesced events and the background's pickups only
+            // move along when there's something to read; `run_once()` them
+            // along if that matters.
+            template <class Scheduler>
+            Task<Event_Batch> next_batch(Scheduler &scheduler,
+                                         FlagBearer flags = On::All)
+            {
+                if (!collecting_) {
+                    collecting_ = true;
+                    _batches.add(On::All, [this](const Event_Batch &batch) {
+                            if (awaiting_) {
+                                awaited_.take(batch, awaited_flags_);
+                            }
+                        });
+                    watch_(flags);
+                } else if ((flags & ~mask_) != 0) {
+                    watch_(flags);
+                }
+                if (holding_) attach_watches();
+
+                awaited_.clear();
+                awaited_flags_ = flags;
+                awaiting_ = true;
+
+                // However we leave, including by being destroyed while
+                // suspended, so nothing piles up for nobody
+                const Awaiting awaiting{ awaiting_ };
+
+                while (true) {
+                    {
+                        Buffer_Pool::Lease buffer;
+                        bool more;
+                        read_some_(buffer, more);
+                    }
+                    expire(Clock::now());
+
+                    if (!awaited_.empty()) break;
+
+                    co_await Readable<Scheduler>{ fd, scheduler };
+                }
+
+                co_return awaited_.batch();
+            }
+
+            // Every event matching `flags`, one at a time, by way of
+            // `next_batch()`
+            template <class Scheduler>
+            Event_Stream<Sentry, Scheduler> events(Scheduler &scheduler,
+                                                   FlagBearer flags = On::All)
+            {
+                return Event_Stream<Sentry, Scheduler>(*this, scheduler,
+                                                       flags);
+            }
+#endif
+
+            // How many directories are watched, or will be once there are
+            // callbacks. Only from the thread reading events.
+            std::size_t directories() const
+            {
+                return paths_.size() + wds.size();
+            }
+
+            // How many events have been read from the kernel, whether or
+            // not anyone wanted them. Kept whatever WATCHDOG_STATS is, and
+            // safe to read from any thread.
+            uint64_t events_read() const
+            {
+                return events_read_.get();
+            }
+
+            // Where our own reads get their buffers from. Shared by every
+            // Sentry by default.
+            void buffer_pool(Buffer_Pool &pool)
+            {
+                pool_ = &pool;
+            }
+
+            // How much we read at once is picked from what's waiting in the
+            // kernel's queue and how big recent reads were, between these
+            // two. The largest defaults to room for MAX_EVENTS events.
+            void read_sizes(std::size_t smallest, std::size_t largest)
+            {
+                sizer_.limits(smallest, largest);
+            }
+
+            Clock::time_point deadline() const override
+            {
+                Clock::time_point due = coalescer_
+                    ? coalescer_->next_deadline()
+                    : Clock::time_point::max();
+
+                // Check on the background every so often
+                if (late_ && late_->busy()) {
+                    due = std::min(due, Clock::now() + late_->pickup());
+                }
+
+                return due;
+            }
+
+            std::size_t expire(Clock::time_point now) override
+            {
+                std::size_t expired = 0;
+
+                if (late_ && late_->busy()) expired += take_late_();
+
+                if (coalescer_) {
+                    const std::size_t before = coalescer_->stats().flushed;
+                    coalescer_->expire(now, [this](Event *ev) {
+                            dispatch(ev);
+                        });
+                    expired += coalescer_->stats().flushed - before;
+                }
+
+                _batches.deliver();
+
+                if (executor_) executor_->rethrow();
+
+                return expired;
+            }
+
+            // Dispatch every event in `buffer`, which has to be laid out the
+            // way read() returns them. Returns the number of events.
+            std::size_t feed(char *buffer, std::size_t length)
+            {
+                Event *ev = nullptr;
+                std::size_t dispatched = 0;
+
+                // These may be about directories the background has only
+                // just watched
+                if (late_ && late_->busy()) take_late_();
+
+                if (log_) log_->batch(buffer, length);
+
+                // Unless this starts with the other half of a rename from
+                // the last read, whatever moved is gone
+                if (RECURSE == Recursively && !moved_.empty()
+                        && length > 0) {
+                    settle_moves_((Event*) buffer);
+                }
+
+                const Clock::time_point now = coalescer_ ? Clock::now()
+                                                         : Clock::time_point();
+
+                // Process each event's callback
+                for (std::size_t i = 0; i < length;
+                        i += sizeof(Event) + ev->len) {
+                    // Technically unsafe, I know
+                    ev = (Event*) &buffer[i];
+                    if (coalescer_) {
+                        coalescer_->push(ev, now, [this](Event *ready) {
+                                dispatch(ready);
+                            });
+                    } else {
+                        dispatch(ev);
+                    }
+                    ++dispatched;
+                }
+
+                if (RECURSE == Recursively && !moved_.empty()) {
+                    settle_moves_(ev);
+                }
+
+                _batches.deliver();
+
+                if (executor_) executor_->rethrow();
+
+                return dispatched;
+            }
+
+        private:
+
+            // What we need to hear about to keep up with a recursive watch
+            static constexpr FlagBearer tracking()
+            {
+                return (RECURSE == Recursively)
+                    ? (IN_CREATE | IN_MOVED_FROM | IN_MOVED_TO
+                            | IN_DELETE_SELF)
+                    : 0;
+            }
+
+            void watch_(FlagBearer flags)
             {
                 if (WATCHDOG_DEBUG) {
                     fprintf(stderr, "[DEBUG]: Registering callback for %s\n",
-                            paths_[0].c_str());
+                            root_.c_str());
+                }
+
+                mask_ |= flags | Default_Flags | tracking();
+                if (snapshot_) mask_ |= Snapshot::mask;
+
+                if (!holding_) apply_();
+            }
+
+            // Bring the kernel in line with mask_, touching each directory
+            // at most once
+            void apply_()
+            {
+                // Nothing real to watch
+                if (replaying_) {
+                    attached_ = mask_;
+                    return;
+                }
+
+                // Directories we already watch just need to hear about more
+                // events, if there are any more. Ones that have disappeared
+                // will get cleaned up when their Ignored event shows up.
+                if (mask_ != attached_) {
+                    if (late_) {
+                        late_->widen(mask_,
+                                [this](int wd, std::string &&path) {
+                                    late_watched_(wd, std::move(path));
+                                });
+                    }
+
+                    wds.for_each([this](int, const std::string &path) {
+                            if (inotify_add_watch(fd, path.c_str(), mask_) < 0
+                                    && errno != ENOENT) {
+                                throw Exception("Failed to add watch to "
+                                                + path);
+                            }
+                        });
                 }
+                attached_ = mask_;
+
+                if (paths_.empty()) return;
 
                 Container wds_;
+                std::vector< std::pair<int, std::string> > added;
 
                 // Attempt to add all watches. While _this_ is in left in a
                 // relatively consistent state if an exception is thrown, you
                 // probably have other problems when that happens.
-                for (const auto path : paths_) {
-                    int wd = inotify_add_watch(fd, path.c_str(),
-                            flags | Default_Flags);
+                for (const auto &path : paths_) {
+                    int wd = inotify_add_watch(fd, path.c_str(), mask_);
                     if (wd < 0) {
                         throw Exception("Failed to add watch to " + path);
                     }
 
                     wds_.add(wd, path);
+                    if (snapshot_) added.emplace_back(wd, path);
                 }
 
-                _callbacks.push_back(std::make_pair(flags, cb));
-
                 wds.append(wds_);
+                if (snapshot_) snapshot_->take(added);
+                stats_.watches(wds.size());
 
+                if (log_) {
+                    wds_.for_each([this](int wd, const std::string &path) {
+                            log_->watch(wd, path);
+                        });
+                }
+
+                // From here on, wds is the only record of what we watch
+                paths_.clear();
+                paths_.shrink_to_fit();
+
+                // Now that we know what to watch for, the rest of the tree
+                // can follow
+                if (late_) late_->start(mask_);
             }
 
-            void listen()
+            // Whether a directory gets watched before the constructor
+            // returns: it's shallow enough, in a hot subtree, or on the way
+            // to one
+            static bool hot_(std::string_view relative,
+                             const Attach_Options &attach)
             {
-                if (WATCHDOG_DEBUG) {
-                    fprintf(stderr, "[DEBUG]: Forever listening for "
-                            "changes to %s\n",
-                            paths_[0].c_str());
+                while (!relative.empty() && relative.front() == '/') {
+                    relative.remove_prefix(1);
                 }
 
-#if WATCHDOG_DEBUG
-                while (true) listen_(1);
-#else
-                while (true) listen_(10000);
-#endif
+                const std::size_t depth = relative.empty()
+                    ? 0 : std::count(relative.begin(), relative.end(), '/')
+                          + 1;
+                if (attach.hot_depth >= 0
+                        && depth <= std::size_t(attach.hot_depth)) {
+                    return true;
+                }
+
+                for (std::string_view hot : attach.hot) {
+                    while (!hot.empty() && hot.front() == '/') {
+                        hot.remove_prefix(1);
+                    }
+                    while (!hot.empty() && hot.back() == '/') {
+                        hot.remove_suffix(1);
+                    }
+
+                    const std::string_view &shorter =
+                        (hot.size() < relative.size()) ? hot : relative;
+                    const std::string_view &longer =
+                        (hot.size() < relative.size()) ? relative : hot;
+
+                    if (longer.compare(0, shorter.size(), shorter) == 0
+                            && (longer.size() == shorter.size()
+                                || shorter.empty()
+                                || longer[shorter.size()] == '/')) {
+                        return true;
+                    }
+                }
+
+                return false;
             }
 
-        private:
+            void late_watched_(int wd, std::string &&path)
+            {
+                if (wds.contains(wd)) return;
+
+                if (snapshot_) snapshot_->take({ { wd, path } });
+                if (log_) log_->watch(wd, path);
+                wds.add(wd, std::move(path));
+            }
 
-            void listen_(std::size_t howManyTimes)
+            // Pick up whatever the background has watched, and deliver
+            // events for anything that changed before it was
+            std::size_t take_late_()
             {
-                if (WATCHDOG_DEBUG) {
-                    fprintf(stderr, "[DEBUG]: Listening for changes to %s\n",
-                            paths_[0].c_str());
+                const std::size_t missed = late_->take(
+                        [this](int wd, std::string &&path) {
+                            late_watched_(wd, std::move(path));
+                        },
+                        [this](int wd, uint32_t mask, const char *name) {
+                            synthesize_(wd, mask, name);
+                        });
+
+                if (log_ && !synthetic_.empty()) {
+                    log_->made(synthetic_.data(), synthetic_.size());
                 }
 
-                Event *ev = nullptr;
-                int length = 0;
+                deliver_synthetic_();
+                stats_.watches(wds.size());
 
-                for (std::size_t event_count = 0;
-                        event_count < howManyTimes;
-                        ++event_count) {
+                return missed;
+            }
 
-                    length = read(fd, buffer, buffer_length);
-                    if (length < 0) {
-                        throw Exception("Failed to read events");
-                    }
+            static Ignore_Rules literal_rules_(
+                    const std::string &root,
+                    const std::set<std::string> &paths)
+            {
+                Ignore_Rules rules;
 
-                    if (WATCHDOG_DEBUG) {
-                        fprintf(stderr, "[DEBUG]: Read %d bytes of "
-                                "events\n", length);
+                // Nothing outside the root could ever match
+                for (const auto &path : paths) {
+                    if (path.size() > root.size()
+                            && Container::is_under(path, root)) {
+                        rules.add_literal(path.substr(root.size()));
                     }
+                }
 
-                    // Process each event's callback
-                    int i = 0;
-                    for (; i < length; i += sizeof(Event) + ev->len) {
-                        // Technically unsafe, I know
-                        ev = (Event*) &buffer[i];
-                        dispatch(ev);
+                return rules;
+            }
+
+            // Where `path` is, relative to the root
+            std::string_view relative_(const std::string &path) const
+            {
+                std::string_view relative(path);
+                if (relative.compare(0, root_.size(), root_) == 0) {
+                    relative.remove_prefix(root_.size());
+                }
+                return relative;
+            }
+
+            bool ignored_dir_(const std::string &path) const
+            {
+                return rules_.ignored(relative_(path), true);
+            }
+
+            // Keep a recursive watch in line with the directories under it.
+            // Called before anyone hears about the event.
+            void track_(Event *ev)
+            {
+                if ((ev->mask & Reply::Is_Directory) == 0) return;
+                if ((ev->mask & (IN_CREATE | IN_MOVED_FROM | IN_MOVED_TO))
+                        == 0) {
+                    return;
+                }
+
+                std::string path = join_paths(wds.find(ev->wd), ev->name);
+
+                // Wait for the other half to see where it went
+                if (ev->mask & IN_MOVED_FROM) {
+                    moved_[ev->cookie] = std::move(path);
+                    return;
+                }
+
+                // Renamed inside the tree, so the watches still work. They
+                // just need new names.
+                if (ev->mask & IN_MOVED_TO) {
+                    auto it = moved_.find(ev->cookie);
+                    if (it != moved_.end()) {
+                        if (WATCHDOG_DEBUG) {
+                            fprintf(stderr, "[DEBUG]: %s moved to %s\n",
+                                    it->second.c_str(), path.c_str());
+                        }
+                        wds.repath(it->second, path);
+                        moved_.erase(it);
+                        return;
                     }
                 }
+
+                // Created, or moved in from somewhere we weren't watching
+                if (ignored_dir_(path)) return;
+
+                adopt_(path);
             }
 
-            void dispatch(Event *ev)
+            // Watch a new directory and everything under it. Each directory
+            // is watched before it's listed, so anything created in the
+            // meantime shows up either in the listing or as an event (or
+            // possibly both). Everything in the listing is reported as
+            // created, after the event that led us here.
+            void adopt_(const std::string &path)
             {
-                // Call each callback that matches
-                for (auto cbp : _callbacks) {
+                if (replaying_) {
+                    adopt_logged_();
+                    return;
+                }
+
+                const auto crawling = stats_.crawling();
+
+                // What this brought with it, if we're recording
+                std::vector< std::pair<int, std::string> > adopted;
+                const std::size_t made = synthetic_.size();
+
+                std::vector<std::string> todo(1, path);
+
+                while (!todo.empty()) {
+                    std::string dir = std::move(todo.back());
+                    todo.pop_back();
+
+                    int wd = inotify_add_watch(fd, dir.c_str(), mask_);
+                    if (wd < 0) continue; // Already gone again
+
                     if (WATCHDOG_DEBUG) {
-                        fprintf(stderr, "[DEBUG]: Mask: 0x%lx "
-                                "Event Flags: 0x%x\n",
-                                cbp.first, ev->mask);
+                        fprintf(stderr, "[DEBUG]: Now watching %s\n",
+                                dir.c_str());
                     }
 
-                    // Ignore when mask doesn't match
-                    if ((cbp.first & ev->mask) == 0) continue;
-                    // Ignore Ignored events
-                    if (ev->mask & Reply::Ignored) {
-                        if (WATCHDOG_DEBUG) {
-                            fprintf(stderr, "[DEBUG]: From %s -> ignored\n",
-                                    ev->name);
+                    // Renamed while we weren't listening (say, while the
+                    // queue overflowed), it's still the same watch
+                    if (!wds.contains(wd)) {
+                        wds.add(wd, dir);
+                    } else if (wds.find(wd) != dir) {
+                        const std::string was = wds.find(wd);
+                        wds.repath(was, dir);
+                    }
+                    if (snapshot_) snapshot_->take({ { wd, dir } });
+                    if (log_) adopted.emplace_back(wd, dir);
+
+                    DIR *listing = opendir(dir.c_str());
+                    if (listing == nullptr) continue;
+
+                    while (dirent *entry = readdir(listing)) {
+                        const char *name = entry->d_name;
+                        if (strcmp(name, ".") == 0
+                                || strcmp(name, "..") == 0) {
+                            continue;
+                        }
+
+                        bool is_dir = entry->d_type == DT_DIR;
+                        if (entry->d_type == DT_UNKNOWN) {
+                            struct stat sb;
+                            is_dir = fstatat(dirfd(listing), name, &sb,
+                                             AT_SYMLINK_NOFOLLOW) == 0
+                                && S_ISDIR(sb.st_mode);
+                        }
+
+                        uint32_t mask = On::Create;
+                        if (is_dir) mask |= Reply::Is_Directory;
+                        synthesize_(wd, mask, name);
+
+                        if (!is_dir) continue;
+
+                        std::string sub = join_paths(dir, name);
+                        if (!ignored_dir_(sub)) {
+                            todo.push_back(std::move(sub));
                         }
+                    }
+
+                    closedir(listing);
+                }
+
+                if (log_) {
+                    log_->adopt(adopted, synthetic_.data() + made,
+                                synthetic_.size() - made);
+                }
+            }
+
+            // Replaying, the log has what the filesystem had. Directories
+            // get adopted in the same order they did when it was recorded.
+            void adopt_logged_()
+            {
+                if (adopted_.empty()) return;
+
+                const Log_Entry entry = adopted_.front();
+                adopted_.pop_front();
+
+                auto made = Event_Log_Reader::adopted(entry,
+                        [this](int wd, std::string &&dir) {
+                            late_watched_(wd, std::move(dir));
+                        });
+
+                synthetic_.insert(synthetic_.end(), made.first,
+                                  made.first + made.second);
+            }
+
+            // Stop watching a directory and everything under it. Anything
+            // still queued for them gets dropped.
+            void unwatch_(const std::string &path)
+            {
+                if (WATCHDOG_DEBUG) {
+                    fprintf(stderr, "[DEBUG]: %s left, no longer watching "
+                            "it\n", path.c_str());
+                }
+
+                std::vector<int> leaving;
+                wds.for_each([&](int wd, const std::string &watched) {
+                        if (Container::is_under(watched, path)) {
+                            leaving.push_back(wd);
+                        }
+                    });
+
+                for (const int wd : leaving) {
+                    inotify_rm_watch(fd, wd);
+                    forget_(wd);
+                }
+            }
+
+            // Directories moved out of the tree never get a Moved_To we can
+            // see. The two halves of a rename are queued together, so the
+            // only one that can still be on its way is the one split across
+            // two reads. `keep` is the event at the edge of the read.
+            void settle_moves_(const Event *keep)
+            {
+                for (auto it = moved_.begin(); it != moved_.end(); ) {
+                    if (keep != nullptr
+                            && (keep->mask & (IN_MOVED_FROM | IN_MOVED_TO))
+                            && keep->cookie == it->first) {
+                        ++it;
                         continue;
                     }
 
-                    // Explode when the queue does
-                    if (ev->mask & Reply::Overflow) {
+                    unwatch_(it->second);
+                    it = moved_.erase(it);
+                }
+            }
+
+            void forget_(int wd)
+            {
+                wds.remove(wd);
+                if (snapshot_) snapshot_->forget(wd);
+            }
+
+            // Rescan everything we watch and make up events for whatever
+            // changed since we last knew
+            void resync_()
+            {
+                const auto start = Clock::now();
+
+                std::vector< std::pair<int, std::string> > dirs;
+                wds.for_each([&dirs](int wd, const std::string &path) {
+                        dirs.emplace_back(wd, path);
+                    });
+
+                std::vector<std::string> appeared;
+
+                Resync_Report report = snapshot_->resync(dirs,
+                        [&](int wd, uint32_t mask, const char *name) {
+                            synthesize_(wd, mask, name);
+
+                            if (RECURSE == Recursively
+                                    && (mask & On::Create)
+                                    && (mask & Reply::Is_Directory)) {
+                                appeared.push_back(
+                                        join_paths(wds.find(wd), name));
+                            }
+                        },
+                        [&](const std::vector<std::string> &listing,
+                            bool quiet) {
+                            quiet_(dirs, listing, quiet);
+                        });
+
+                // New directories need watching too
+                for (const auto &dir : appeared) {
+                    if (!ignored_dir_(dir)) adopt_(dir);
+                }
+
+                report.overflows = ++overflows_;
+                report.duration = std::chrono::duration_cast<
+                    std::chrono::microseconds>(Clock::now() - start);
+
+                if (WATCHDOG_DEBUG) {
+                    fprintf(stderr, "[DEBUG]: Queue overflowed, found %zu "
+                            "lost events in %zu directories\n",
+                            report.events_lost, report.directories);
+                }
+
+                if (on_resync_) on_resync_(report);
+            }
+
+            // Stop hearing about `listing` (and their parents) being
+            // opened and read, while resyncing lists them, or hear about
+            // it again. Otherwise, if anyone watches for that, listing a
+            // big tree can overflow the queue all over again.
+            void quiet_(const std::vector< std::pair<int, std::string> > &dirs,
+                        const std::vector<std::string> &listing, bool quiet)
+            {
+                if ((mask_ & Snapshot::listing) == 0) return;
+
+                // Replacing the mask, so no IN_MASK_ADD
+                FlagBearer mask = mask_ & ~IN_MASK_ADD;
+                if (quiet) mask &= ~Snapshot::listing;
+
+                std::map<std::string, int> watched;
+                for (const auto &dir : dirs) watched.emplace(dir.second,
+                                                             dir.first);
+
+                std::set<std::string> touched;
+                for (const auto &path : listing) {
+                    touched.insert(path);
+
+                    const std::size_t slash = path.find_last_of(path_sep);
+                    if (slash != std::string::npos && slash > 0) {
+                        touched.insert(path.substr(0, slash));
+                    }
+                }
+
+                for (const auto &path : touched) {
+                    auto it = watched.find(path);
+                    if (it == watched.end()) continue;
+
+                    // If something else is there now, it isn't ours to
+                    // watch
+                    const int wd = inotify_add_watch(fd, path.c_str(), mask);
+                    if (wd >= 0 && wd != it->second) {
+                        inotify_rm_watch(fd, wd);
+                    }
+                }
+            }
+
+            // Queue up an event of our own, to be delivered after the one
+            // we're currently handling
+            void synthesize_(int wd, uint32_t mask, const char *name)
+            {
+                const std::size_t name_length = strlen(name);
+                // Null terminated and padded, like the kernel does it
+                const std::size_t len = (name_length + 1 + 3)
+                                        & ~std::size_t(3);
+
+                const std::size_t at = synthetic_.size();
+                synthetic_.resize(at + sizeof(Event) + len, '\0');
+
+                Event *ev = (Event*) &synthetic_[at];
+                ev->wd = wd;
+                ev->mask = mask;
+                ev->cookie = 0;
+                ev->len = len;
+                memcpy(ev->name, name, name_length);
+            }
+
+            // Only made the first time we run ourselves, since a Reactor
+            // brings its own
+            Poller &poller_()
+            {
+                if (!own_poller_) {
+                    own_poller_.reset(new Poller());
+                    own_poller_->add(fd);
+
+                    // From here on stop() can wake us. If it came before
+                    // this, run_once() sees it before waiting.
+                    waiting_.store(own_poller_.get());
+                }
+
+                return *own_poller_;
+            }
+
+            // Read and dispatch until the kernel queue is empty (or someone
+            // wants us to stop)
+            std::size_t listen_()
+            {
+                if (WATCHDOG_DEBUG) {
+                    fprintf(stderr, "[DEBUG]: Draining changes to %s\n",
+                            root_.c_str());
+                }
+
+                // Only held while we're reading, so idle watchers don't
+                // hold any memory for it
+                Buffer_Pool::Lease buffer;
+
+                std::size_t dispatched = 0;
+
+                while (!stopping_.load()) {
+                    bool more;
+                    dispatched += read_some_(buffer, more);
+                    if (!more) break;
+                }
+
+                return dispatched;
+            }
+
+            // One read of however much is waiting, into `buffer` (leased
+            // or grown if need be), then dispatch it. `more` is whether
+            // there could be anything left in the kernel queue.
+            std::size_t read_some_(Buffer_Pool::Lease &buffer, bool &more)
+            {
+                more = false;
+
+                const std::size_t want = sizer_.want(fd);
+                if (want == 0) return 0;
+
+                if (buffer.size() < want) buffer = pool_->lease(want);
+
+                std::size_t bytes;
+                std::size_t got = read_events_(buffer.data(), buffer.size(),
+                                               bytes);
+                if (got == 0) return 0;
+
+                sizer_.observe(bytes);
+
+                // The kernel fits in as many events as it can, so if there
+                // was room for another, the queue is empty. No need to ask
+                // again.
+                more = bytes + sizeof(Event) + NAME_MAX + 1 > buffer.size();
+
+                return got;
+            }
+
+            // One read() into `buffer`, then dispatch what came back
+            std::size_t read_events_(char *buffer, std::size_t length,
+                                     std::size_t &bytes)
+            {
+                ssize_t got;
+                do {
+                    got = read(fd, buffer, length);
+                } while (got < 0 && errno == EINTR);
+
+                bytes = 0;
+                if (got < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+                    throw Exception("Failed to read events");
+                }
+
+                if (WATCHDOG_DEBUG) {
+                    fprintf(stderr, "[DEBUG]: Read %zd bytes of events\n",
+                            got);
+                }
+
+                bytes = got;
+                const std::size_t events = feed(buffer, got);
+
+                events_read_.add(events);
+                stats_.read(bytes, events);
+                stats_.watches(wds.size());
+
+                return events;
+            }
+
+            void dispatch(Event *ev)
+            {
+                // The kernel has already dropped this watch, so forget it.
+                // Nobody gets called for Ignored events.
+                if (ev->mask & Reply::Ignored) {
+                    if (WATCHDOG_DEBUG) {
+                        fprintf(stderr, "[DEBUG]: From %s -> ignored\n",
+                                ev->name);
+                    }
+                    stats_.ignored();
+                    forget_(ev->wd);
+                    return;
+                }
+
+                // Explode when the queue does, unless we know how to put
+                // ourselves back together
+                if (ev->mask & Reply::Overflow) {
+                    stats_.overflowed();
+                    if (!snapshot_) {
                         throw Exception("Inotify queue overflowed");
                     }
 
-                    cbp.second(ev, wds.find(ev->wd));
+                    resync_();
+                    deliver_synthetic_();
+                    return;
                 }
+
+                if (WATCHDOG_DEBUG) {
+                    fprintf(stderr, "[DEBUG]: Event Flags: 0x%x\n",
+                            ev->mask);
+                }
+
+                // This may watch more directories, so look up the path
+                // afterwards
+                if (RECURSE == Recursively) track_(ev);
+
+                if (snapshot_ && (ev->mask & Snapshot::tracked) && ev->len) {
+                    snapshot_->update(ev->wd, wds.find(ev->wd), ev->name,
+                                      ev->mask);
+                }
+
+                deliver_(ev);
+
+                // Catching up on what was in a new directory
+                deliver_synthetic_();
+
+                // The Ignored event that follows will do the same, but
+                // there's no reason to wait for it
+                if (ev->mask & On::Delete) forget_(ev->wd);
             }
 
-            std::vector< std::pair<FlagBearer, Callback> > _callbacks;
-            std::vector< std::string > paths_; // Hmm...
-            std::set< std::string > ignored_;
+            void deliver_synthetic_()
+            {
+                if (synthetic_.empty()) return;
+
+                std::vector<char> synthetic;
+                synthetic.swap(synthetic_);
+
+                Event *made = nullptr;
+                for (std::size_t i = 0; i < synthetic.size();
+                        i += sizeof(Event) + made->len) {
+                    made = (Event*) &synthetic[i];
+                    deliver_(made);
+                }
+            }
+
+            // Hand an event to everyone who wants it
+            void deliver_(Event *ev)
+            {
+                const std::string &path = wds.find(ev->wd);
 
-            // buffer_length is nonstatic
-            char buffer[ MAX_EVENTS * ( sizeof(Event) + MAX_LEN_NAME ) ];
-            std::size_t buffer_length = MAX_EVENTS
-                    * ( sizeof(Event) + MAX_LEN_NAME );
+                // A watch we've already dropped
+                if (path.empty()) return;
+
+                if (!rules_.empty() && ev->len
+                        && rules_.ignored(relative_(path),
+                                          std::string_view(ev->name,
+                                              strnlen(ev->name, ev->len)),
+                                          ev->mask & Reply::Is_Directory)) {
+                    return;
+                }
+
+                if (_batches.wants(ev->mask)) _batches.collect(ev, path);
+
+                if (ring_ && (ev->mask & ring_flags_)) ring_->push(ev, path);
+
+                if (executor_) {
+                    if (!_callbacks.empty() || !_view_callbacks.empty()
+                            || Handler_Set::mask != 0) {
+                        executor_->submit(ev, path);
+                    }
+                    return;
+                }
+
+                call_(ev, path);
+            }
+
+            // On a worker, with a copy of the event
+            void run_job_(const Executor::Job &job)
+            {
+                alignas(Event) char storage[sizeof(Event) + NAME_MAX + 4];
+                const std::size_t len = job.name.empty()
+                    ? 0 : (job.name.size() + 1 + 3) & ~std::size_t(3);
+
+                Event *ev = (Event*) storage;
+                ev->wd = job.wd;
+                ev->mask = job.mask;
+                ev->cookie = job.cookie;
+                ev->len = len;
+                memset(ev->name, 0, len);
+                memcpy(ev->name, job.name.data(), job.name.size());
+
+                call_(ev, job.path);
+            }
+
+            void call_(Event *ev, const std::string &path)
+            {
+                // Known when we were built, so these are inlined
+                handlers_(ev, path);
+
+                // Call each callback that matches
+                _callbacks.for_each_match(ev->mask,
+                        [ev, &path](const Callback &cb) {
+                            cb(ev, path);
+                        });
+
+                if (_view_callbacks.empty()) return;
+
+                const Event_View view = view_of(ev, path);
+
+                _view_callbacks.for_each_match(ev->mask,
+                        [&view](const View_Callback &cb) {
+                            cb(view);
+                        });
+            }
+
+            Dispatch_Table<Callback> _callbacks;
+            Dispatch_Table<View_Callback> _view_callbacks;
+            // Collects events for batch callbacks until the read is done
+            Batcher _batches;
+            std::string root_;
+            // Found, but not watched until the first callback shows up
+            std::vector< std::string > paths_;
+            Ignore_Rules rules_;
+            Handler_Set handlers_;
+
+            // What every watch is registered for, and what the kernel has
+            // been told so far
+            FlagBearer mask_ = 0;
+            FlagBearer attached_ = 0;
+            bool holding_ = false;
+            // Directories moved away, by cookie, until we see where to
+            std::map< uint32_t, std::string > moved_;
+            // Events we made up, waiting to be delivered
+            std::vector<char> synthetic_;
+
+            // Where to publish events, if anywhere
+            Event_Ring *ring_ = nullptr;
+            FlagBearer ring_flags_ = 0;
+
+            // Only there if some of the tree is being watched in the
+            // background
+            std::unique_ptr<Late_Attach> late_;
+
+            // Only there if we're coalescing events
+            std::unique_ptr<Coalescer> coalescer_;
+
+            // Only kept if WATCHDOG_STATS is (see stats.hpp)
+            Stats::Recorder<WATCHDOG_STATS> stats_;
+            Stats::Counter events_read_;
+
+            // Where to record what we read, if anywhere
+            Event_Log *log_ = nullptr;
+            // Built to replay a log, and what new directories in the batch
+            // being replayed brought with them
+            bool replaying_ = false;
+            std::deque<Log_Entry> adopted_;
+
+            // Only there if we're recovering from overflows
+            std::unique_ptr<Snapshot> snapshot_;
+            Resync_Callback on_resync_;
+            std::size_t overflows_ = 0;
+
+#if WATCHDOG_COROUTINES
+            struct Awaiting {
+                bool &flag;
+
+                ~Awaiting()
+                {
+                    flag = false;
+                }
+            };
+
+            // What `next_batch()` is waiting for, and has so far
+            bool collecting_ = false;
+            bool awaiting_ = false;
+            FlagBearer awaited_flags_ = 0;
+            Batch_Copy awaited_;
+#endif
+
+            // Our own reads borrow buffers, sized as they go
+            Buffer_Pool *pool_ = &Buffer_Pool::shared();
+            Read_Sizer sizer_{ Buffer_Pool::smallest,
+                               MAX_EVENTS * (sizeof(Event) + MAX_LEN_NAME) };
 
             int fd; // File descriptor
             Container wds;
 
+            std::unique_ptr<Poller> own_poller_;
+            // The Poller once there is one, for stop() on other threads
+            std::atomic<Poller*> waiting_{nullptr};
+            std::atomic<bool> stopping_{false};
+            // Whether the last run_once() was told to stop
+            bool stopped_ = false;
+
+            // Last, so the workers are gone before anything they use
+            std::unique_ptr<Executor> executor_;
+
     };
 
     using Dog = Sentry<Watch::Normally>;
-    using Pen = Sentry<Watch::Recursively>;
+    using Pen = Sentry<Watch::Recursively, Flags::Add, Flat>;
+
+    // A Sentry with a fixed set of handlers (see handlers.hpp)
+    template < Recurse RECURSE, class Handler_Set, class Container = Flat >
+    using Static_Sentry = Sentry<RECURSE, Flags::Add, Container,
+                                 WATCHDOG_MAX_EVENTS, WATCHDOG_MAX_LEN_NAME,
+                                 Handler_Set>;
 
 } // namespace Watch
 
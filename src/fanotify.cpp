@@ -0,0 +1,35 @@
+#include <fanotify.hpp>
+
+#include <cstdio>
+#include <string>
+
+void usage(const char *invokedAs)
+{
+    fprintf(stderr, "Usage: %s path\n", invokedAs);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        usage(argv[0]);
+        return 0;
+    }
+
+    std::string path(argv[1]);
+
+    // Needs root, or at least CAP_SYS_ADMIN and CAP_DAC_READ_SEARCH
+    Watch::Filesystem_Sentry watcher(path);
+
+    fprintf(stderr, "Watching %s\n", path.c_str());
+
+    watcher.add_callback([](const Watch::Event_View &ev) {
+            printf("%08x %.*s/%.*s\n", ev.mask,
+                   int(ev.path.size()), ev.path.data(),
+                   int(ev.name.size()), ev.name.data());
+            fflush(stdout);
+        }, Watch::On::All);
+
+    watcher.listen();
+
+    return 0;
+}
@@ -2,37 +2,45 @@
 #define WATCHDOG_DEBUG true
 #endif
 #include <watchdog.hpp>
-#include <iostream>
+#include <sink.hpp>
 
-void usage(const std::string &invokedAs)
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+
+void usage(const char *invokedAs)
 {
-    std::cerr << "Usage: " << invokedAs << " [path]\n";
+    fprintf(stderr, "Usage: %s [--tsv] [path]\n", invokedAs);
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc != 2) {
+    Watch::Sink_Options options;
+
+    int arg = 1;
+    if (arg < argc && strcmp(argv[arg], "--tsv") == 0) {
+        options.format = Watch::Sink_Format::TSV;
+        ++arg;
+    }
+
+    if (arg + 1 != argc) {
         usage(argv[0]);
         return 0;
     }
 
-    std::string path(argv[1]);
+    std::string path(argv[arg]);
 
     /* Watch::Dog watcher(path); // Watch nonrecursively */
     Watch::Pen watcher(path); // Watch recursively
 
-    std::cout << "Watching " << path << std::endl;
-
-    // Examine all filesystem events supported by inotify
-    watcher.add_callback([](Watch::Event *ev, std::string path) {
-            auto names = Watch::Flags::get_names(ev->mask,
-                    Watch::Flags::Names::All);
-            printf("From %s:\n", Watch::join_paths(path,
-                        std::string(ev->name, ev->len)).c_str());
-            for (const auto &name : names) {
-                std::cout << name << std::endl;
-            }
-        }, Watch::On::All);
+    // Events go to stdout, one line each, so tell everyone else on stderr
+    fprintf(stderr, "Watching %s\n", path.c_str());
+
+    // Examine all filesystem events supported by inotify, written out once
+    // per read
+    Watch::Event_Sink sink(STDOUT_FILENO, options);
+    watcher.add_batch_callback(sink.batch_callback(), Watch::On::All);
 
     watcher.listen();
 
@@ -0,0 +1,105 @@
+// Buffer_Pool handing buffers out and taking them back, and Read_Sizer
+// picking how much to read
+
+#include <buffer_pool.hpp>
+
+#include <unistd.h>
+
+#include <string>
+#include <utility>
+
+#include "check.hpp"
+
+namespace {
+
+    void pooling()
+    {
+        Watch::Buffer_Pool pool(2);
+
+        // Rounded up to a power of two, and never less than the smallest
+        Watch::Buffer_Pool::Lease first = pool.lease(100);
+        CHECK(first.size() == Watch::Buffer_Pool::smallest);
+        CHECK(pool.lease(5000).size() == 8192);
+        CHECK(pool.lease(std::size_t(1) << 30).size()
+                == Watch::Buffer_Pool::largest);
+
+        char *const data = first.data();
+        first.release();
+        CHECK(!first);
+
+        // Anything in the same class gets the same buffer back
+        Watch::Buffer_Pool::Lease again = pool.lease(4000);
+        CHECK(again.data() == data);
+        CHECK(pool.stats().reused == 1);
+
+        // Moving hands over the buffer, and assigning gives back what
+        // was there
+        Watch::Buffer_Pool::Lease moved(std::move(again));
+        CHECK(!again);
+        CHECK(moved.data() == data);
+
+        Watch::Buffer_Pool::Lease other = pool.lease(4000);
+        CHECK(pool.stats().outstanding == 2 * 4096);
+        other = std::move(moved);
+        CHECK(other.data() == data);
+        CHECK(pool.stats().outstanding == 4096);
+        other.release();
+
+        // Only `keep` of each size are kept
+        {
+            Watch::Buffer_Pool::Lease a = pool.lease(4096);
+            Watch::Buffer_Pool::Lease b = pool.lease(4096);
+            Watch::Buffer_Pool::Lease c = pool.lease(4096);
+        }
+
+        const Watch::Buffer_Pool_Stats stats = pool.stats();
+        CHECK(stats.outstanding == 0);
+        CHECK(stats.cached == 2 * 4096 + 8192
+                              + Watch::Buffer_Pool::largest);
+    }
+
+    void sizing()
+    {
+        const std::size_t one = sizeof(inotify_event) + NAME_MAX + 1;
+
+        int fds[2];
+        if (pipe(fds) < 0) {
+            CHECK(false);
+            return;
+        }
+
+        // Too small to hold an event gets bumped up
+        Watch::Read_Sizer sizer(16, 8192);
+        CHECK(sizer.want(fds[0]) == 0);
+
+        // What's waiting, between the limits
+        const std::string some(100, 'x');
+        CHECK(write(fds[1], some.data(), some.size()) == 100);
+        CHECK(sizer.want(fds[0]) == one);
+
+        const std::string lots(20000, 'x');
+        CHECK(write(fds[1], lots.data(), lots.size()) == 20000);
+        CHECK(sizer.want(fds[0]) == 8192);
+
+        // Busy lately, so room for twice the usual even with little there
+        sizer.limits(one, 1 << 20);
+        for (int i = 0; i < 100; ++i) sizer.observe(16384);
+        CHECK(sizer.average() > 15000 && sizer.average() <= 16384);
+        CHECK(sizer.want(fds[0]) == 2 * sizer.average());
+
+        // Couldn't ask, so go by the average
+        CHECK(sizer.want(-1) == 2 * sizer.average());
+
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+} // namespace
+
+int main()
+{
+    pooling();
+    sizing();
+
+    return Check::failures();
+}
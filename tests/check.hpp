@@ -0,0 +1,30 @@
+#ifndef WATCHDOG_TESTS_CHECK_H
+#define WATCHDOG_TESTS_CHECK_H
+
+// Just enough of a test harness: CHECK() reports what failed and where,
+// and `failures()` is what main() returns.
+
+#include <cstdio>
+
+namespace Check {
+
+    inline int &failures()
+    {
+        static int count = 0;
+        return count;
+    }
+
+    inline void failed(const char *what, const char *file, int line)
+    {
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, what);
+        ++failures();
+    }
+
+} // namespace Check
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) Check::failed(#condition, __FILE__, __LINE__); \
+    } while (false)
+
+#endif
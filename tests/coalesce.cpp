@@ -0,0 +1,237 @@
+// Coalescer: masks merging per file, deadlines coming due across the
+// timer wheel, and files coming and going from its table
+
+#include <coalesce.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+
+namespace {
+
+    using std::chrono::milliseconds;
+
+    struct Raw_Event {
+        alignas(inotify_event) char storage[sizeof(inotify_event)
+                                            + NAME_MAX + 1];
+
+        Raw_Event(int wd, uint32_t mask, const std::string &name)
+        {
+            inotify_event *ev = get();
+            ev->wd = wd;
+            ev->mask = mask;
+            ev->cookie = 0;
+            ev->len = uint32_t(name.size() + 1);
+            memcpy(ev->name, name.c_str(), name.size() + 1);
+        }
+
+        inotify_event *get()
+        {
+            return (inotify_event*) storage;
+        }
+    };
+
+    // What came out, in order
+    struct Emitted {
+        std::vector< std::pair<std::string, uint32_t> > events;
+
+        void operator()(inotify_event *ev)
+        {
+            events.emplace_back(std::string(ev->name), ev->mask);
+        }
+    };
+
+    Watch::Coalesce_Options options(milliseconds quiet,
+                                    milliseconds max_latency,
+                                    std::size_t capacity = 64)
+    {
+        Watch::Coalesce_Options options;
+        options.quiet = quiet;
+        options.max_latency = max_latency;
+        options.capacity = capacity;
+        return options;
+    }
+
+    void merging()
+    {
+        Watch::Coalescer coalescer(options(milliseconds(50),
+                                           milliseconds(500)));
+        const auto t0 = Watch::Clock::now();
+        Emitted out;
+
+        Raw_Event create(1, IN_CREATE, "a");
+        Raw_Event modify(1, IN_MODIFY, "a");
+        Raw_Event other(1, IN_MODIFY, "b");
+        Raw_Event close(1, IN_CLOSE_WRITE, "a");
+        Raw_Event remove(1, IN_DELETE, "b");
+
+        coalescer.push(create.get(), t0, std::ref(out));
+        coalescer.push(modify.get(), t0, std::ref(out));
+        coalescer.push(modify.get(), t0, std::ref(out));
+        coalescer.push(other.get(), t0, std::ref(out));
+        CHECK(out.events.empty());
+        CHECK(coalescer.held() == 2);
+        CHECK(coalescer.stats().collapsed == 2);
+
+        // Close_Write ends the burst right away
+        coalescer.push(close.get(), t0, std::ref(out));
+        CHECK(out.events.size() == 1);
+        CHECK(out.events[0].first == "a");
+        CHECK(out.events[0].second
+                == (IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE));
+
+        // Something that can't be merged goes after what's held for the
+        // same file
+        coalescer.push(remove.get(), t0, std::ref(out));
+        CHECK(out.events.size() == 3);
+        CHECK(out.events[1] == std::make_pair(std::string("b"),
+                                              uint32_t(IN_MODIFY)));
+        CHECK(out.events[2] == std::make_pair(std::string("b"),
+                                              uint32_t(IN_DELETE)));
+        CHECK(coalescer.held() == 0);
+        CHECK(coalescer.next_deadline() == Watch::Clock::time_point::max());
+
+        const Watch::Coalesce_Stats stats = coalescer.stats();
+        CHECK(stats.received == 6);
+        CHECK(stats.flushed == 2);
+        CHECK(stats.passed == 1);
+    }
+
+    void deadlines()
+    {
+        // Ticks of 1.25ms, so the wheel goes around every 320ms
+        Watch::Coalescer coalescer(options(milliseconds(10),
+                                           milliseconds(30)));
+        const auto t0 = Watch::Clock::now();
+        Emitted out;
+
+        Raw_Event a(1, IN_MODIFY, "a");
+        Raw_Event b(1, IN_MODIFY, "b");
+
+        coalescer.push(a.get(), t0, std::ref(out));
+        coalescer.push(b.get(), t0 + milliseconds(5), std::ref(out));
+        CHECK(coalescer.next_deadline() >= t0 + milliseconds(10));
+        CHECK(coalescer.next_deadline() < t0 + milliseconds(12));
+
+        coalescer.expire(t0 + milliseconds(8), std::ref(out));
+        CHECK(out.events.empty());
+
+        coalescer.expire(t0 + milliseconds(12), std::ref(out));
+        CHECK(out.events.size() == 1);
+        CHECK(!out.events.empty() && out.events[0].first == "a");
+
+        coalescer.expire(t0 + milliseconds(17), std::ref(out));
+        CHECK(out.events.size() == 2);
+
+        // Touched every 5ms, so only max_latency lets it go
+        out.events.clear();
+        const auto t1 = t0 + milliseconds(100);
+        for (int i = 0; i <= 8; ++i) {
+            const auto now = t1 + milliseconds(5 * i);
+            coalescer.push(a.get(), now, std::ref(out));
+            coalescer.expire(now, std::ref(out));
+        }
+        CHECK(out.events.size() == 1);
+        CHECK(coalescer.held() == 1);
+    }
+
+    void wheel_wraps()
+    {
+        Watch::Coalescer coalescer(options(milliseconds(10),
+                                           milliseconds(1000)));
+        const auto t0 = Watch::Clock::now();
+        Emitted out;
+
+        Raw_Event a(1, IN_MODIFY, "a");
+        Raw_Event b(1, IN_MODIFY, "b");
+
+        // A whole revolution apart, so both land in the same slot
+        coalescer.push(a.get(), t0, std::ref(out));
+        coalescer.push(b.get(), t0 + milliseconds(320), std::ref(out));
+
+        coalescer.expire(t0 + milliseconds(321), std::ref(out));
+        CHECK(out.events.size() == 1);
+        CHECK(!out.events.empty() && out.events[0].first == "a");
+
+        coalescer.expire(t0 + milliseconds(332), std::ref(out));
+        CHECK(out.events.size() == 2);
+
+        // Long after, with slots that were visited before
+        coalescer.push(a.get(), t0 + milliseconds(10000), std::ref(out));
+        coalescer.expire(t0 + milliseconds(10005), std::ref(out));
+        CHECK(out.events.size() == 2);
+        coalescer.expire(t0 + milliseconds(10012), std::ref(out));
+        CHECK(out.events.size() == 3);
+        CHECK(coalescer.held() == 0);
+    }
+
+    // Files held and let go at random, checked against a plain map. A small
+    // table, so plenty of them share slots and get shifted back.
+    void table_churn()
+    {
+        const std::size_t capacity = 8;
+        Watch::Coalescer coalescer(options(milliseconds(1000),
+                                           milliseconds(1000), capacity));
+        const auto t0 = Watch::Clock::now();
+
+        std::map<std::string, uint32_t> held;
+        std::mt19937 random(42);
+        const uint32_t masks[] = { IN_CREATE, IN_MODIFY, IN_ATTRIB };
+
+        for (int i = 0; i < 20000; ++i) {
+            const std::string name = "f" + std::to_string(random() % 24);
+            const bool remove = random() % 3 == 0;
+            const uint32_t mask = remove ? uint32_t(IN_DELETE)
+                                         : masks[random() % 3];
+
+            Emitted out;
+            Raw_Event ev(1, mask, name);
+            coalescer.push(ev.get(), t0, std::ref(out));
+
+            std::vector< std::pair<std::string, uint32_t> > expected;
+            auto found = held.find(name);
+            if (remove) {
+                if (found != held.end()) {
+                    expected.emplace_back(name, found->second);
+                    held.erase(found);
+                }
+                expected.emplace_back(name, mask);
+            } else if (found != held.end()) {
+                found->second |= mask;
+            } else if (held.size() < capacity) {
+                held[name] = mask;
+            } else {
+                expected.emplace_back(name, mask);
+            }
+
+            CHECK(out.events == expected);
+            CHECK(coalescer.held() == held.size());
+            if (Check::failures() != 0) return;
+        }
+
+        // And everything left comes out merged
+        Emitted out;
+        coalescer.flush_all(std::ref(out));
+        std::map<std::string, uint32_t> flushed(out.events.begin(),
+                                                out.events.end());
+        CHECK(flushed == held);
+    }
+
+} // namespace
+
+int main()
+{
+    merging();
+    deadlines();
+    wheel_wraps();
+    table_churn();
+
+    return Check::failures();
+}
@@ -0,0 +1,158 @@
+// Awaiting events from a coroutine, a batch at a time and one at a time,
+// and giving up on one while it waits. Needs C++20.
+
+#include <watchdog.hpp>
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+
+#if WATCHDOG_COROUTINES
+
+namespace {
+
+    using Pen = Watch::Pen;
+
+    void touch(const std::string &path)
+    {
+        const int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC,
+                            0644);
+        if (fd >= 0) close(fd);
+    }
+
+    Watch::Task<std::vector<std::string>> created(
+            Pen &pen, Watch::Poll_Scheduler &scheduler)
+    {
+        std::vector<std::string> names;
+
+        Watch::Event_Batch batch = co_await pen.next_batch(
+                scheduler, Watch::On::Create);
+        for (const auto &ev : batch) names.emplace_back(ev.name);
+
+        co_return names;
+    }
+
+    Watch::Task<std::vector<std::string>> first(
+            Pen &pen, Watch::Poll_Scheduler &scheduler, std::size_t count)
+    {
+        std::vector<std::string> names;
+
+        auto events = pen.events(scheduler, Watch::On::Create);
+        while (names.size() < count) {
+            const Watch::Event_View *ev = co_await events.next();
+            names.emplace_back(ev->name);
+        }
+
+        co_return names;
+    }
+
+    // Bytes allocated, big ones included
+    std::size_t in_use()
+    {
+        const struct mallinfo2 info = mallinfo2();
+        return info.uordblks + info.hblkhd;
+    }
+
+    // Until the task is done, or nobody is waiting for anything
+    template <class Task>
+    void finish(Task &task, Watch::Poll_Scheduler &scheduler)
+    {
+        while (!task.done() && scheduler.run_once(1000)) {}
+    }
+
+} // namespace
+
+int main()
+{
+    char dir[] = "/tmp/watchdog-test-coroutine-XXXXXX";
+    if (mkdtemp(dir) == nullptr) return 1;
+    const std::string root = dir;
+
+    {
+        Pen pen(root);
+        Watch::Poll_Scheduler scheduler;
+
+        // Nothing to read yet, so it waits on the scheduler
+        auto batch = created(pen, scheduler);
+        batch.start();
+        CHECK(!batch.done());
+
+        touch(root + "/one");
+        finish(batch, scheduler);
+        CHECK(batch.done());
+
+        const auto names = batch.get();
+        CHECK(names.size() == 1);
+        CHECK(!names.empty() && names[0] == "one");
+
+        // Already queued, and more while waiting
+        touch(root + "/two");
+        auto stream = first(pen, scheduler, 3);
+        stream.start();
+        touch(root + "/three");
+        touch(root + "/four");
+        finish(stream, scheduler);
+        CHECK(stream.done());
+
+        const auto streamed = stream.get();
+        CHECK(streamed == std::vector<std::string>({ "two", "three",
+                                                     "four" }));
+    }
+
+    {
+        Pen pen(root);
+
+        // Waiting when it's destroyed, and never resumed
+        {
+            Watch::Poll_Scheduler scheduler;
+            auto batch = created(pen, scheduler);
+            batch.start();
+            CHECK(!batch.done());
+        }
+
+        // So none of this is kept for it
+        const std::size_t before = in_use();
+        for (int round = 0; round < 20; ++round) {
+            for (int i = 0; i < 1000; ++i) {
+                const std::string path = root + "/churn-"
+                                       + std::to_string(i);
+                touch(path);
+                unlink(path.c_str());
+            }
+            while (pen.run_once(std::chrono::milliseconds(0)) > 0) {}
+        }
+        CHECK(in_use() < before + 512 * 1024);
+
+        // And the next one starts fresh
+        Watch::Poll_Scheduler scheduler;
+        auto batch = created(pen, scheduler);
+        batch.start();
+        touch(root + "/five");
+        finish(batch, scheduler);
+
+        const auto names = batch.get();
+        CHECK(names == std::vector<std::string>({ "five" }));
+    }
+
+    const std::string cleanup = "rm -rf " + root;
+    CHECK(system(cleanup.c_str()) == 0);
+
+    return Check::failures();
+}
+
+#else
+
+int main()
+{
+    fprintf(stderr, "Built without coroutines\n");
+    return 1;
+}
+
+#endif
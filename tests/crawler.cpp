@@ -0,0 +1,66 @@
+// Crawling: the root may be a symbolic link, but nothing under it is
+// followed, and the old signature still works
+
+#include <helpers.hpp>
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+
+namespace {
+
+    bool found(const std::vector<std::string> &dirs, const std::string &path)
+    {
+        return std::find(dirs.begin(), dirs.end(), path) != dirs.end();
+    }
+
+} // namespace
+
+int main()
+{
+    char dir[] = "/tmp/watchdog-test-crawler-XXXXXX";
+    if (mkdtemp(dir) == nullptr) return 1;
+    const std::string base = dir;
+
+    const std::string real = base + "/real";
+    mkdir(real.c_str(), 0755);
+    mkdir((real + "/a").c_str(), 0755);
+    mkdir((real + "/a/b").c_str(), 0755);
+    mkdir((base + "/elsewhere").c_str(), 0755);
+    mkdir((base + "/elsewhere/c").c_str(), 0755);
+
+    const std::string link = base + "/link";
+    CHECK(symlink(real.c_str(), link.c_str()) == 0);
+    CHECK(symlink((base + "/elsewhere").c_str(),
+                  (real + "/a/out").c_str()) == 0);
+
+    for (unsigned threads : { 1u, 4u }) {
+        const auto dirs = Watch::enumerateSubdirectories(link, nullptr,
+                                                         threads);
+        CHECK(dirs.size() == 3);
+        CHECK(!dirs.empty() && dirs[0] == link);
+        CHECK(found(dirs, link + "/a"));
+        CHECK(found(dirs, link + "/a/b"));
+        CHECK(!found(dirs, link + "/a/out"));
+        CHECK(!found(dirs, link + "/a/out/c"));
+    }
+
+    // The way it was called before it took a Prune
+    for (int max_open_fd : { 1, 256 }) {
+        const auto dirs = Watch::enumerateSubdirectories(link, max_open_fd);
+        CHECK(dirs.size() == 3);
+        CHECK(!dirs.empty() && dirs[0] == link);
+    }
+    CHECK(Watch::enumerateSubdirectories(link).size() == 3);
+
+    const std::string cleanup = "rm -rf " + base;
+    CHECK(system(cleanup.c_str()) == 0);
+
+    return Check::failures();
+}
@@ -0,0 +1,83 @@
+// Coalesced events carry more than one bit, and with workers those get
+// matched against the callbacks from several threads at once
+
+#include <watchdog.hpp>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include "check.hpp"
+
+namespace {
+
+    const int dirs = 16;
+    const int files = 8;
+
+    void write_to(const std::string &path)
+    {
+        const int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC,
+                            0644);
+        if (fd < 0) return;
+        if (write(fd, "x", 1) != 1) CHECK(false);
+        close(fd);
+    }
+
+} // namespace
+
+int main()
+{
+    char dir[] = "/tmp/watchdog-test-dispatch-XXXXXX";
+    if (mkdtemp(dir) == nullptr) return 1;
+    const std::string root = dir;
+
+    for (int i = 0; i < dirs; ++i) {
+        mkdir((root + "/" + std::to_string(i)).c_str(), 0755);
+    }
+
+    std::atomic<int> modified{0}, closed{0}, viewed{0};
+
+    {
+        Watch::Pen pen(root);
+
+        pen.add_callback([&modified](Watch::Event*, std::string) {
+                ++modified;
+            }, Watch::On::Modify);
+        pen.add_callback([&closed](Watch::Event*, std::string) {
+                ++closed;
+            }, Watch::On::Close_Write);
+        pen.add_callback([&viewed](const Watch::Event_View&) {
+                ++viewed;
+            }, Watch::On::Modify | Watch::On::Close_Write);
+
+        pen.coalesce();
+
+        Watch::Executor_Options options;
+        options.workers = 4;
+        pen.offload(options);
+
+        for (int i = 0; i < dirs; ++i) {
+            for (int j = 0; j < files; ++j) {
+                write_to(root + "/" + std::to_string(i) + "/"
+                         + std::to_string(j));
+            }
+        }
+
+        pen.run_until(Watch::Clock::now() + std::chrono::milliseconds(300));
+    }
+
+    // One merged event per file, each matching all three callbacks
+    CHECK(modified == dirs * files);
+    CHECK(closed == dirs * files);
+    CHECK(viewed == dirs * files);
+
+    const std::string cleanup = "rm -rf " + root;
+    CHECK(system(cleanup.c_str()) == 0);
+
+    return Check::failures();
+}
@@ -0,0 +1,176 @@
+// Reading event logs: records whose insides claim more than they hold
+// throw, instead of reading past the end of the mapping
+
+#include <watchdog.hpp>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+
+namespace {
+
+    // A log with a root, then one record of `kind` holding `data`, written
+    // by hand so that it can be wrong
+    void write_log(const std::string &path, Watch::Log_Kind kind,
+                   const std::vector<char> &data)
+    {
+        std::vector<char> out;
+        auto append = [&out](const void *bytes, std::size_t length) {
+            const char *at = static_cast<const char*>(bytes);
+            out.insert(out.end(), at, at + length);
+        };
+        auto record = [&](Watch::Log_Kind kind_, const void *bytes,
+                          std::size_t length) {
+            Watch::Log_Record header{ kind_, uint32_t(length), 0 };
+            append(&header, sizeof(header));
+            append(bytes, length);
+            out.resize(out.size()
+                       + Watch::Log_Format::padded(length, 8) - length);
+        };
+
+        Watch::Log_Format::Header header{};
+        memcpy(header.magic, Watch::Log_Format::magic, sizeof(header.magic));
+        header.version = Watch::Log_Format::version;
+        append(&header, sizeof(header));
+
+        const std::string root = "/nowhere";
+        record(Watch::Log_Kind::Root, root.data(), root.size());
+        record(kind, data.data(), data.size());
+
+        const int fd = open(path.c_str(),
+                            O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        CHECK(fd >= 0);
+        CHECK(write(fd, out.data(), out.size()) == ssize_t(out.size()));
+        close(fd);
+    }
+
+    template <class T>
+    void put(std::vector<char> &data, T value)
+    {
+        const char *at = reinterpret_cast<const char*>(&value);
+        data.insert(data.end(), at, at + sizeof(value));
+    }
+
+    // Whether walking the whole log throws
+    bool throws(const std::string &path)
+    {
+        try {
+            Watch::Event_Log_Reader log(path);
+            auto cursor = log.cursor();
+            Watch::Log_Entry entry;
+            while (cursor.next(entry)) {
+                if (entry.kind == Watch::Log_Kind::Adopt) {
+                    Watch::Event_Log_Reader::adopted(entry,
+                            [](int, std::string&&) {});
+                }
+            }
+        } catch (const Watch::Exception&) {
+            return true;
+        }
+        return false;
+    }
+
+} // namespace
+
+int main()
+{
+    char dir[] = "/tmp/watchdog-test-event-log-XXXXXX";
+    if (mkdtemp(dir) == nullptr) return 1;
+    const std::string path = std::string(dir) + "/log";
+
+    inotify_event ev{};
+    ev.wd = 1;
+    ev.mask = IN_CREATE;
+
+    // An event whose name runs off the end
+    {
+        std::vector<char> data;
+        ev.len = 1000;
+        put(data, ev);
+        write_log(path, Watch::Log_Kind::Batch, data);
+        CHECK(throws(path));
+    }
+
+    // Half an event
+    {
+        std::vector<char> data;
+        put(data, ev.wd);
+        write_log(path, Watch::Log_Kind::Made, data);
+        CHECK(throws(path));
+    }
+
+    // A watch without even a wd
+    {
+        write_log(path, Watch::Log_Kind::Watch, std::vector<char>(2));
+        CHECK(throws(path));
+    }
+
+    // More directories than there are
+    {
+        std::vector<char> data;
+        put(data, uint32_t(5));
+        put(data, int32_t(1));
+        put(data, uint32_t(4));
+        data.insert(data.end(), { 'a', 'b', 'c', 'd' });
+        write_log(path, Watch::Log_Kind::Adopt, data);
+        CHECK(throws(path));
+    }
+
+    // A path longer than the record
+    {
+        std::vector<char> data;
+        put(data, uint32_t(1));
+        put(data, int32_t(1));
+        put(data, uint32_t(1u << 30));
+        write_log(path, Watch::Log_Kind::Adopt, data);
+        CHECK(throws(path));
+    }
+
+    // And one that's fine
+    {
+        std::vector<char> data;
+        put(data, uint32_t(1));
+        put(data, int32_t(2));
+        put(data, uint32_t(4));
+        data.insert(data.end(), { 'a', 'b', 'c', 'd' });
+        ev.len = 16;
+        put(data, ev);
+        data.resize(data.size() + 16);
+        write_log(path, Watch::Log_Kind::Adopt, data);
+        CHECK(!throws(path));
+    }
+
+    // Replaying a bad one fails cleanly too
+    {
+        std::vector<char> data;
+        ev.len = 1000;
+        put(data, ev);
+        write_log(path, Watch::Log_Kind::Batch, data);
+
+        Watch::Event_Log_Reader log(path);
+        Watch::Pen pen(log);
+        pen.add_callback([](const Watch::Event_View&) {}, Watch::On::All);
+
+        bool threw = false;
+        try {
+            pen.replay(log);
+        } catch (const Watch::Exception&) {
+            threw = true;
+        }
+        CHECK(threw);
+    }
+
+    const std::string cleanup = "rm -rf " + std::string(dir);
+    CHECK(system(cleanup.c_str()) == 0);
+
+    return Check::failures();
+}
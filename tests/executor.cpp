@@ -0,0 +1,214 @@
+// What the Executor does once a worker falls behind, for each Saturation
+// policy, and how errors from workers come back out
+
+#include <executor.hpp>
+
+#include <limits.h>
+
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+
+namespace {
+
+    struct Raw_Event {
+        alignas(inotify_event) char storage[sizeof(inotify_event)
+                                            + NAME_MAX + 1];
+
+        Raw_Event(int wd, const std::string &name)
+        {
+            inotify_event *ev = get();
+            ev->wd = wd;
+            ev->mask = IN_MODIFY;
+            ev->cookie = 0;
+            ev->len = uint32_t(name.size() + 1);
+            memcpy(ev->name, name.c_str(), name.size() + 1);
+        }
+
+        inotify_event *get()
+        {
+            return (inotify_event*) storage;
+        }
+    };
+
+    // Jobs named "hold" wait until let go. Everything else is recorded,
+    // along with which thread ran it.
+    struct Gate {
+        std::mutex m;
+        std::condition_variable changed;
+        bool open = false;
+        bool holding = false;
+
+        std::vector<std::string> ran;
+        std::vector<std::thread::id> ran_on;
+
+        void run(const Watch::Executor::Job &job)
+        {
+            std::unique_lock<std::mutex> lock(m);
+            if (job.name == "hold") {
+                holding = true;
+                changed.notify_all();
+                changed.wait(lock, [this] { return open; });
+            }
+            ran.push_back(job.name);
+            ran_on.push_back(std::this_thread::get_id());
+        }
+
+        // Until the worker is stuck on a "hold"
+        void wait_holding()
+        {
+            std::unique_lock<std::mutex> lock(m);
+            changed.wait(lock, [this] { return holding; });
+        }
+
+        void let_go()
+        {
+            std::lock_guard<std::mutex> lock(m);
+            open = true;
+            changed.notify_all();
+        }
+    };
+
+    // One worker with room for two, stuck on its first job, with both
+    // spots taken
+    void saturate(Watch::Executor &executor, Gate &gate)
+    {
+        executor.submit(Raw_Event(1, "hold").get(), "/");
+        gate.wait_holding();
+        executor.submit(Raw_Event(1, "a").get(), "/");
+        executor.submit(Raw_Event(1, "b").get(), "/");
+    }
+
+    Watch::Executor_Options options(Watch::Saturation when_full)
+    {
+        Watch::Executor_Options options;
+        options.workers = 1;
+        options.queue_depth = 2;
+        options.when_full = when_full;
+        return options;
+    }
+
+    void dropping()
+    {
+        Gate gate;
+        Watch::Executor executor(options(Watch::Saturation::Drop),
+                [&gate](const Watch::Executor::Job &job) { gate.run(job); });
+
+        saturate(executor, gate);
+        executor.submit(Raw_Event(1, "c").get(), "/");
+
+        gate.let_go();
+        executor.drain();
+
+        CHECK(gate.ran == std::vector<std::string>({ "hold", "a", "b" }));
+
+        const Watch::Executor_Stats stats = executor.stats();
+        CHECK(stats.submitted == 4);
+        CHECK(stats.dropped == 1);
+        CHECK(stats.executed == 3);
+        CHECK(stats.high_water == 2);
+        CHECK(stats.queued == 0);
+    }
+
+    void running_inline()
+    {
+        Gate gate;
+        Watch::Executor executor(options(Watch::Saturation::Inline),
+                [&gate](const Watch::Executor::Job &job) { gate.run(job); });
+
+        saturate(executor, gate);
+
+        // Ahead of what's queued, and right here
+        executor.submit(Raw_Event(1, "c").get(), "/");
+        {
+            std::lock_guard<std::mutex> lock(gate.m);
+            CHECK(gate.ran == std::vector<std::string>({ "c" }));
+            CHECK(!gate.ran_on.empty()
+                    && gate.ran_on[0] == std::this_thread::get_id());
+        }
+
+        gate.let_go();
+        executor.drain();
+
+        CHECK(gate.ran == std::vector<std::string>({ "c", "hold", "a",
+                                                     "b" }));
+        CHECK(executor.stats().ran_inline == 1);
+        CHECK(executor.stats().executed == 4);
+    }
+
+    void blocking()
+    {
+        Gate gate;
+        Watch::Executor executor(options(Watch::Saturation::Block),
+                [&gate](const Watch::Executor::Job &job) { gate.run(job); });
+
+        saturate(executor, gate);
+
+        std::thread later([&gate] {
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                gate.let_go();
+            });
+
+        // Waits for room, then goes in order after the rest
+        executor.submit(Raw_Event(1, "c").get(), "/");
+        later.join();
+        executor.drain();
+
+        CHECK(gate.ran == std::vector<std::string>({ "hold", "a", "b",
+                                                     "c" }));
+
+        const Watch::Executor_Stats stats = executor.stats();
+        CHECK(stats.blocked == 1);
+        CHECK(stats.blocked_for >= std::chrono::milliseconds(40));
+        CHECK(stats.executed == 4);
+        CHECK(stats.dropped == 0);
+    }
+
+    void errors()
+    {
+        Watch::Executor_Options options;
+        options.workers = 2;
+
+        std::atomic<int> ran{0};
+        Watch::Executor executor(options,
+                [&ran](const Watch::Executor::Job &job) {
+                    ++ran;
+                    if (job.name == "bad") throw std::runtime_error("bad");
+                });
+
+        executor.submit(Raw_Event(1, "bad").get(), "/");
+        executor.submit(Raw_Event(2, "good").get(), "/");
+        executor.drain();
+
+        bool threw = false;
+        try {
+            executor.rethrow();
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        CHECK(threw);
+        CHECK(ran == 2);
+
+        // Only once
+        executor.rethrow();
+    }
+
+} // namespace
+
+int main()
+{
+    dropping();
+    running_inline();
+    blocking();
+    errors();
+
+    return Check::failures();
+}
@@ -0,0 +1,124 @@
+// Watching a whole filesystem with fanotify: only what's under the root
+// (and not ignored) gets through, under its path as of when it was read,
+// and a directory's number is never given to another.
+// Needs root, so it's skipped without it.
+
+#include <fanotify.hpp>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+
+namespace {
+
+    // What ctest takes to mean the test was skipped
+    const int skipped = 77;
+
+    void touch(const std::string &path)
+    {
+        const int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC,
+                            0644);
+        if (fd >= 0) close(fd);
+    }
+
+    bool allowed()
+    {
+        if (geteuid() != 0) return false;
+
+        const int fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME,
+                                     O_RDONLY);
+        if (fd < 0) return false;
+
+        close(fd);
+        return true;
+    }
+
+    void drain(Watch::Filesystem_Sentry &sentry)
+    {
+        while (sentry.run_once(std::chrono::milliseconds(100)) > 0) {}
+    }
+
+    bool saw(const std::vector<std::string> &seen, const std::string &path)
+    {
+        for (const auto &ev : seen) {
+            if (ev == path) return true;
+        }
+        return false;
+    }
+
+} // namespace
+
+int main()
+{
+    if (!allowed()) {
+        fprintf(stderr, "Skipped: fanotify needs root\n");
+        return skipped;
+    }
+
+    char dir[] = "/tmp/watchdog-test-fanotify-XXXXXX";
+    char other[] = "/tmp/watchdog-test-fanotify-other-XXXXXX";
+    if (mkdtemp(dir) == nullptr || mkdtemp(other) == nullptr) return 1;
+    const std::string root = dir;
+    const std::string elsewhere = other;
+
+    mkdir((root + "/a").c_str(), 0755);
+    mkdir((root + "/skip").c_str(), 0755);
+
+    std::vector<std::string> seen;
+    std::vector<int> wds;
+    {
+        Watch::Filesystem_Sentry sentry(root,
+                Watch::Ignore_Rules(std::vector<std::string>{ "skip" }));
+        sentry.add_callback([&seen, &wds](const Watch::Event_View &ev) {
+                seen.push_back(Watch::join_paths(std::string(ev.path),
+                                                 std::string(ev.name)));
+                wds.push_back(ev.wd);
+            }, Watch::On::Create);
+
+        touch(root + "/a/x");
+        touch(root + "/skip/x");
+        touch(elsewhere + "/x");
+        drain(sentry);
+
+        CHECK(saw(seen, root + "/a/x"));
+        CHECK(!saw(seen, root + "/skip/x"));
+        CHECK(!saw(seen, elsewhere + "/x"));
+
+        // Known by its handle, so it turns up under its new name
+        seen.clear();
+        CHECK(rename((root + "/a").c_str(), (root + "/b").c_str()) == 0);
+        touch(root + "/b/y");
+        drain(sentry);
+
+        CHECK(saw(seen, root + "/b/y"));
+        CHECK(!saw(seen, root + "/a/y"));
+
+        // Forgotten when it moved, so it has a new number now, and nobody
+        // else gets its old one
+        const int first = wds.front();
+        const int moved = wds.back();
+        CHECK(moved != first);
+
+        wds.clear();
+        mkdir((root + "/c").c_str(), 0755);
+        touch(root + "/c/z");
+        drain(sentry);
+
+        CHECK(!wds.empty());
+        for (const int wd : wds) CHECK(wd != first);
+    }
+
+    const std::string cleanup = "rm -rf " + root + " " + elsewhere;
+    CHECK(system(cleanup.c_str()) == 0);
+
+    return Check::failures();
+}
@@ -0,0 +1,137 @@
+// Compile-time handler sets: what they watch for, which handlers an event
+// reaches and in what order, and a Static_Sentry running them ahead of
+// its add_callback() ones
+
+#include <watchdog.hpp>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+
+namespace {
+
+    struct Raw_Event {
+        alignas(inotify_event) char storage[sizeof(inotify_event)
+                                            + NAME_MAX + 1];
+
+        Raw_Event(uint32_t mask, const std::string &name)
+        {
+            inotify_event *ev = get();
+            ev->wd = 1;
+            ev->mask = mask;
+            ev->cookie = 0;
+            ev->len = uint32_t(name.size() + 1);
+            memcpy(ev->name, name.c_str(), name.size() + 1);
+        }
+
+        inotify_event *get()
+        {
+            return (inotify_event*) storage;
+        }
+    };
+
+    void touch(const std::string &path)
+    {
+        const int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC,
+                            0644);
+        if (fd >= 0) close(fd);
+    }
+
+    void dispatch()
+    {
+        std::vector<std::string> calls;
+
+        auto handlers = Watch::make_handlers(
+                Watch::handle<Watch::On::Create>(
+                    [&calls](const Watch::Event_View &ev) {
+                        calls.push_back("view " + std::string(ev.path) + " "
+                                        + std::string(ev.name));
+                    }),
+                Watch::handle<Watch::On::Create | Watch::On::Modify>(
+                    [&calls](Watch::Event *ev, const std::string &path) {
+                        calls.push_back("raw " + path + " " + ev->name);
+                    }),
+                Watch::handle<Watch::On::Delete_Sub>(
+                    [&calls](const Watch::Event_View&) {
+                        calls.push_back("delete");
+                    }));
+
+        static_assert(decltype(handlers)::mask
+                == (IN_CREATE | IN_MODIFY | IN_DELETE),
+                "Watched for is everything any handler wants");
+        static_assert(Watch::No_Handlers::mask == 0,
+                "Nothing to watch for without handlers");
+
+        // In the order given, and only those that match
+        handlers(Raw_Event(IN_CREATE, "a").get(), "/d");
+        CHECK(calls == std::vector<std::string>({ "view /d a",
+                                                  "raw /d a" }));
+
+        calls.clear();
+        handlers(Raw_Event(IN_MODIFY, "b").get(), "/d");
+        CHECK(calls == std::vector<std::string>({ "raw /d b" }));
+
+        calls.clear();
+        handlers(Raw_Event(IN_ATTRIB, "c").get(), "/d");
+        CHECK(calls.empty());
+
+        calls.clear();
+        handlers(Raw_Event(IN_DELETE | IN_ISDIR, "e").get(), "/d");
+        CHECK(calls == std::vector<std::string>({ "delete" }));
+    }
+
+    void sentry()
+    {
+        char dir[] = "/tmp/watchdog-test-handlers-XXXXXX";
+        if (mkdtemp(dir) == nullptr) {
+            CHECK(false);
+            return;
+        }
+        const std::string root = dir;
+
+        std::vector<std::string> calls;
+        auto handlers = Watch::make_handlers(
+                Watch::handle<Watch::On::Create>(
+                    [&calls](const Watch::Event_View &ev) {
+                        calls.push_back("static " + std::string(ev.name));
+                    }));
+
+        {
+            // Watched for as soon as it's built
+            Watch::Static_Sentry<Watch::Normally, decltype(handlers)>
+                sentry(root, handlers);
+            touch(root + "/x");
+            while (sentry.run_once(std::chrono::milliseconds(100)) > 0) {}
+            CHECK(calls == std::vector<std::string>({ "static x" }));
+
+            calls.clear();
+            sentry.add_callback([&calls](const Watch::Event_View &ev) {
+                    calls.push_back("added " + std::string(ev.name));
+                }, Watch::On::Create);
+            touch(root + "/y");
+            while (sentry.run_once(std::chrono::milliseconds(100)) > 0) {}
+            CHECK(calls == std::vector<std::string>({ "static y",
+                                                      "added y" }));
+        }
+
+        const std::string cleanup = "rm -rf " + root;
+        CHECK(system(cleanup.c_str()) == 0);
+    }
+
+} // namespace
+
+int main()
+{
+    dispatch();
+    sentry();
+
+    return Check::failures();
+}
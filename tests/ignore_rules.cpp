@@ -0,0 +1,73 @@
+// Ignore_Rules keeps string_view keys into its own rules, so copies have to
+// stand on their own once the original is gone
+
+#include <ignore_rules.hpp>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+
+namespace {
+
+    std::unique_ptr<Watch::Ignore_Rules> made()
+    {
+        return std::unique_ptr<Watch::Ignore_Rules>(new Watch::Ignore_Rules(
+                std::vector<std::string>{ "node_modules", "/build/out/",
+                                          "*.tmp", "!keep.tmp" }));
+    }
+
+    void check_rules(const Watch::Ignore_Rules &rules)
+    {
+        CHECK(rules.size() == 4);
+        CHECK(rules.ignored("src/node_modules", true));
+        CHECK(rules.ignored("build/out", true));
+        CHECK(!rules.ignored("src/build/out", true));
+        CHECK(!rules.ignored("build/out", false));
+        CHECK(rules.ignored("a/b.tmp", false));
+        CHECK(!rules.ignored("a/keep.tmp", false));
+        CHECK(!rules.ignored("src/main.cpp", false));
+    }
+
+} // namespace
+
+int main()
+{
+    {
+        auto source = made();
+        Watch::Ignore_Rules copy(*source);
+        source.reset();
+        check_rules(copy);
+    }
+
+    {
+        auto source = made();
+        Watch::Ignore_Rules copy;
+        copy.add("something");
+        copy = *source;
+        source.reset();
+        check_rules(copy);
+    }
+
+    {
+        auto source = made();
+        Watch::Ignore_Rules moved(std::move(*source));
+        source.reset();
+        check_rules(moved);
+    }
+
+    {
+        // What's left after a move still works
+        Watch::Ignore_Rules source = *made();
+        Watch::Ignore_Rules moved;
+        moved = std::move(source);
+        source.add("/build/out/");
+        CHECK(source.ignored("build/out", true));
+        CHECK(!source.ignored("src/node_modules", true));
+        check_rules(moved);
+    }
+
+    return Check::failures();
+}
@@ -0,0 +1,82 @@
+// Watching in the background: everything under the cold subtrees ends up
+// watched, including what turned up after the constructor looked, and
+// `attached()` isn't ready until the reading thread has it all
+
+#include <watchdog.hpp>
+
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+
+namespace {
+
+    using Pen = Watch::Pen;
+
+    bool saw(const std::vector<std::string> &seen, const std::string &path)
+    {
+        for (const auto &ev : seen) {
+            if (ev == path) return true;
+        }
+        return false;
+    }
+
+} // namespace
+
+int main()
+{
+    char dir[] = "/tmp/watchdog-test-late-XXXXXX";
+    if (mkdtemp(dir) == nullptr) return 1;
+    const std::string root = dir;
+
+    mkdir((root + "/a").c_str(), 0755);
+    mkdir((root + "/a/b").c_str(), 0755);
+    mkdir((root + "/a/b/c").c_str(), 0755);
+
+    std::vector<std::string> seen;
+    {
+        Watch::Attach_Options options;
+        options.hot_depth = 0;
+        Pen pen(root, Watch::Ignore_Rules(), options);
+
+        // After the constructor, before the background starts
+        mkdir((root + "/a/b/c/d").c_str(), 0755);
+        mkdir((root + "/a/b/c/d/e").c_str(), 0755);
+
+        pen.add_callback([&seen](const Watch::Event_View &ev) {
+                seen.push_back(Watch::join_paths(std::string(ev.path),
+                                                 std::string(ev.name)));
+            }, Watch::On::Create);
+
+        auto attached = pen.attached();
+        const auto give_up = std::chrono::steady_clock::now()
+                           + std::chrono::seconds(10);
+        while (attached.wait_for(std::chrono::seconds(0))
+                   != std::future_status::ready
+               && std::chrono::steady_clock::now() < give_up) {
+            pen.run_once(std::chrono::milliseconds(10));
+        }
+        CHECK(attached.wait_for(std::chrono::seconds(0))
+              == std::future_status::ready);
+
+        // Everything's been handed over by the time it's ready
+        CHECK(attached.get().directories == 5);
+        CHECK(pen.directories() == 6);
+        CHECK(saw(seen, root + "/a/b/c/d"));
+
+        seen.clear();
+        mkdir((root + "/a/b/c/d/e/f").c_str(), 0755);
+        while (pen.run_once(std::chrono::milliseconds(50)) > 0) {}
+        CHECK(saw(seen, root + "/a/b/c/d/e/f"));
+    }
+
+    const std::string cleanup = "rm -rf " + root;
+    CHECK(system(cleanup.c_str()) == 0);
+
+    return Check::failures();
+}
@@ -0,0 +1,165 @@
+// Compact paths: renames to right under the root stay absolute, a rename
+// over something else lets go of what was there, a new watch on a
+// watched path replaces the old one, and names go once nothing uses them
+
+#include <watchdog.hpp>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+
+namespace {
+
+    using Compact_Pen = Watch::Sentry<Watch::Recursively, Watch::Flags::Add,
+                                      Watch::Compact>;
+
+    void touch(const std::string &path)
+    {
+        const int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC,
+                            0644);
+        if (fd >= 0) close(fd);
+    }
+
+} // namespace
+
+int main()
+{
+    {
+        Watch::Compact paths;
+        paths.add(1, "/watched/a");
+        paths.add(2, "/watched/a/b");
+
+        paths.repath("/watched/a", "/a");
+        CHECK(paths.find(1) == "/a");
+        CHECK(paths.find(2) == "/a/b");
+
+        // And back down again
+        paths.repath("/a", "/watched/c");
+        CHECK(paths.find(1) == "/watched/c");
+        CHECK(paths.find(2) == "/watched/c/b");
+
+        // Relative ones stay relative
+        paths.add(3, "x/y");
+        paths.repath("x/y", "y");
+        CHECK(paths.find(3) == "y");
+    }
+
+    {
+        Watch::Compact paths;
+        paths.add(1, "/r/from");
+        paths.add(2, "/r/to");
+        paths.add(3, "/r/to/stale");
+        paths.add(4, "/r/other");
+
+        paths.repath("/r/from", "/r/to");
+        CHECK(paths.find(1) == "/r/to");
+        CHECK(!paths.contains(2));
+        CHECK(!paths.contains(3));
+        CHECK(paths.find(4) == "/r/other");
+        CHECK(paths.size() == 2);
+
+        // Nothing is left holding on to anything
+        paths.remove(1);
+        paths.remove(4);
+        CHECK(paths.size() == 0);
+
+        const std::size_t footprint = paths.footprint();
+        for (int i = 0; i < 1000; ++i) {
+            paths.add(1, "/r/from");
+            paths.add(2, "/r/to");
+            paths.add(3, "/r/to/stale");
+            paths.repath("/r/from", "/r/to");
+            paths.remove(1);
+        }
+        CHECK(paths.size() == 0);
+        CHECK(paths.footprint() == footprint);
+    }
+
+    {
+        Watch::Compact paths;
+        paths.add(1, "/r/a");
+        paths.add(2, "/r/b");
+
+        // Recreated, so it's watched again under a new wd
+        paths.add(3, "/r/a");
+        CHECK(!paths.contains(1));
+        CHECK(paths.find(3) == "/r/a");
+        CHECK(paths.size() == 2);
+
+        paths.remove(3);
+        paths.remove(2);
+        CHECK(paths.size() == 0);
+    }
+
+    {
+        Watch::Compact paths;
+        paths.add(1, "/r/keep");
+        paths.add(2, "/r/moving");
+
+        auto churn = [&paths](int from, int to) {
+            for (int i = from; i < to; ++i) {
+                const std::string name = "/r/tmp-" + std::to_string(i);
+                paths.add(3, name + "/sub");
+                paths.repath("/r/moving", name + "/moved");
+                paths.repath(name + "/moved", "/r/moving");
+                paths.remove(3);
+
+                // Looking for things that were never there
+                paths.repath("/r/gone-" + std::to_string(i), "/r/x");
+            }
+        };
+
+        churn(0, 1000);
+        const std::size_t footprint = paths.footprint();
+
+        churn(1000, 20000);
+        CHECK(paths.footprint() <= footprint * 2);
+        CHECK(paths.size() == 2);
+        CHECK(paths.find(1) == "/r/keep");
+        CHECK(paths.find(2) == "/r/moving");
+
+        // Names that are still used come through compacting intact
+        paths.add(4, "/r/tmp-19999/sub");
+        CHECK(paths.find(4) == "/r/tmp-19999/sub");
+    }
+
+    // The same, as a Sentry sees it: a directory moved up to the top of
+    // the watched tree
+    char dir[] = "/tmp/watchdog-test-path-tree-XXXXXX";
+    if (mkdtemp(dir) == nullptr) return 1;
+    const std::string root = dir;
+
+    mkdir((root + "/a").c_str(), 0755);
+    mkdir((root + "/a/b").c_str(), 0755);
+
+    std::vector<std::string> seen;
+    {
+        Compact_Pen pen(root);
+        pen.add_callback([&seen](const Watch::Event_View &ev) {
+                seen.push_back(Watch::join_paths(std::string(ev.path),
+                                                 std::string(ev.name)));
+            }, Watch::On::Create | Watch::On::Moved_To);
+
+        CHECK(rename((root + "/a/b").c_str(), (root + "/b").c_str()) == 0);
+        while (pen.run_once(std::chrono::milliseconds(100)) > 0) {}
+
+        seen.clear();
+        touch(root + "/b/x");
+        while (pen.run_once(std::chrono::milliseconds(100)) > 0) {}
+
+        CHECK(seen.size() == 1);
+        CHECK(!seen.empty() && seen[0] == root + "/b/x");
+    }
+
+    const std::string cleanup = "rm -rf " + root;
+    CHECK(system(cleanup.c_str()) == 0);
+
+    return Check::failures();
+}
@@ -0,0 +1,100 @@
+// A Sentry holding its watches gets them attached by the Reactor driving
+// it, without anyone having to call attach_watches(), and Sentries driven
+// by a Reactor don't open anything for running themselves
+
+#include <watchdog.hpp>
+#include <reactor.hpp>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+
+namespace {
+
+    void touch(const std::string &path)
+    {
+        const int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC,
+                            0644);
+        if (fd >= 0) close(fd);
+    }
+
+    int open_descriptors()
+    {
+        DIR *fds = opendir("/proc/self/fd");
+        if (fds == nullptr) return -1;
+
+        int count = 0;
+        while (readdir(fds) != nullptr) ++count;
+        closedir(fds);
+
+        return count;
+    }
+
+} // namespace
+
+int main()
+{
+    char dir[] = "/tmp/watchdog-test-reactor-XXXXXX";
+    if (mkdtemp(dir) == nullptr) return 1;
+    const std::string root = dir;
+
+    {
+        Watch::Reactor reactor;
+        Watch::Pen pen(root);
+        pen.hold_watches();
+
+        reactor.attach(pen);
+
+        // Registered after attaching, and still held until the first round
+        int created = 0, deleted = 0;
+        pen.add_callback([&created](const Watch::Event_View&) {
+                ++created;
+            }, Watch::On::Create);
+        pen.add_callback([&deleted](const Watch::Event_View&) {
+                ++deleted;
+            }, Watch::On::Delete_Sub);
+
+        reactor.run_once(std::chrono::milliseconds(0));
+
+        touch(root + "/x");
+        unlink((root + "/x").c_str());
+        reactor.run_once(std::chrono::milliseconds(100));
+
+        CHECK(created == 1);
+        CHECK(deleted == 1);
+
+        reactor.detach(pen);
+    }
+
+    {
+        Watch::Reactor reactor;
+        const int before = open_descriptors();
+
+        std::vector< std::unique_ptr<Watch::Pen> > pens;
+        for (int i = 0; i < 32; ++i) {
+            pens.emplace_back(new Watch::Pen(root));
+            pens.back()->add_callback([](const Watch::Event_View&) {},
+                                      Watch::On::Create);
+            reactor.attach(*pens.back());
+        }
+        reactor.run_once(std::chrono::milliseconds(0));
+
+        // Just the inotify descriptor each
+        CHECK(open_descriptors() - before == 32);
+
+        for (auto &pen : pens) reactor.detach(*pen);
+    }
+
+    const std::string cleanup = "rm -rf " + root;
+    CHECK(system(cleanup.c_str()) == 0);
+
+    return Check::failures();
+}
@@ -0,0 +1,125 @@
+// Recovering from an overflowed queue: directories renamed meanwhile keep
+// their watch under the new name, and files written before the overflow
+// aren't reported as modified again
+
+#include <watchdog.hpp>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+
+namespace {
+
+    using Pen = Watch::Pen;
+
+    struct Seen {
+        uint32_t mask;
+        std::string path;
+    };
+
+    void touch(const std::string &path)
+    {
+        const int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC,
+                            0644);
+        if (fd >= 0) close(fd);
+    }
+
+    // More than the kernel will queue (16384 by default), with nobody
+    // reading
+    void flood(const std::string &dir)
+    {
+        for (int i = 0; i < 7000; ++i) {
+            touch(dir + "/f" + std::to_string(i));
+        }
+    }
+
+    void drain(Pen &pen)
+    {
+        while (pen.run_once(std::chrono::milliseconds(0)) > 0) {}
+    }
+
+    bool saw(const std::vector<Seen> &seen, uint32_t mask,
+             const std::string &path)
+    {
+        for (const auto &ev : seen) {
+            if ((ev.mask & mask) && ev.path == path) return true;
+        }
+        return false;
+    }
+
+} // namespace
+
+int main()
+{
+    char dir[] = "/tmp/watchdog-test-resync-XXXXXX";
+    if (mkdtemp(dir) == nullptr) return 1;
+    const std::string root = dir;
+
+    mkdir((root + "/a").c_str(), 0755);
+    mkdir((root + "/spam").c_str(), 0755);
+
+    std::vector<Seen> seen;
+    std::size_t overflows = 0;
+    Watch::Resync_Report last;
+    {
+        Pen pen(root);
+        pen.resync_on_overflow([&](const Watch::Resync_Report &report) {
+                ++overflows;
+                last = report;
+            });
+        pen.add_callback([&seen](const Watch::Event_View &ev) {
+                seen.push_back(Seen{ ev.mask, Watch::join_paths(
+                        std::string(ev.path), std::string(ev.name)) });
+            }, Watch::On::All);
+
+        const std::string held = root + "/held";
+        const int fd = open(held.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC,
+                            0644);
+        CHECK(fd >= 0);
+        drain(pen);
+        CHECK(write(fd, "some", 4) == 4);
+        drain(pen);
+        CHECK(saw(seen, Watch::On::Modify, held));
+
+        // Renamed after the queue is full, so only the rescan finds out
+        flood(root + "/spam");
+        CHECK(rename((root + "/a").c_str(), (root + "/b").c_str()) == 0);
+
+        seen.clear();
+        drain(pen);
+        CHECK(overflows == 1);
+        CHECK(saw(seen, Watch::On::Create, root + "/b"));
+        CHECK(!saw(seen, Watch::On::Modify, held));
+
+        // Only what had something come or go gets listed, without anyone
+        // hearing about it
+        CHECK(last.listed <= 3);
+        CHECK(!saw(seen, Watch::On::Open, root + "/spam"));
+        CHECK(!saw(seen, Watch::On::Open, root));
+
+        seen.clear();
+        touch(root + "/b/x");
+        drain(pen);
+        CHECK(saw(seen, Watch::On::Create, root + "/b/x"));
+        CHECK(!saw(seen, Watch::On::Create, root + "/a/x"));
+
+        // Listing what changed shouldn't overflow it all over again
+        seen.clear();
+        drain(pen);
+        CHECK(overflows == 1);
+
+        close(fd);
+    }
+
+    const std::string cleanup = "rm -rf " + root;
+    CHECK(system(cleanup.c_str()) == 0);
+
+    return Check::failures();
+}
@@ -0,0 +1,222 @@
+// The lock-free queue under several producers and consumers, wrapping
+// around many times, and the ring's spill slabs for long paths. Worth
+// running with -DWATCHDOG_TSAN=ON too.
+
+#include <ring.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+
+namespace {
+
+    const int producers = 4;
+    const int consumers = 4;
+    const uint64_t each = 50000;
+
+    // An event as read() would hand it over
+    struct Raw_Event {
+        alignas(inotify_event) char storage[sizeof(inotify_event)
+                                            + NAME_MAX + 1];
+
+        Raw_Event(int wd, const std::string &name)
+        {
+            inotify_event *ev = get();
+            ev->wd = wd;
+            ev->mask = IN_CREATE;
+            ev->cookie = 0;
+            ev->len = uint32_t(name.size() + 1);
+            memcpy(ev->name, name.c_str(), name.size() + 1);
+        }
+
+        inotify_event *get()
+        {
+            return (inotify_event*) storage;
+        }
+    };
+
+    // Every third one too long to go inline
+    std::string path_for(int wd)
+    {
+        const std::size_t length = (wd % 3 == 0) ? 200 : 20;
+        return "/" + std::string(length, char('a' + wd % 26));
+    }
+
+    void queue_fifo_and_bounds()
+    {
+        Watch::Bounded_Queue<int> queue(3);
+        CHECK(queue.capacity() == 4);
+
+        // Around and around, one slot at a time and then all of them
+        for (int round = 0; round < 10; ++round) {
+            for (int i = 0; i < 4; ++i) CHECK(queue.push(round * 4 + i));
+            CHECK(!queue.push(-1));
+
+            for (int i = 0; i < 4; ++i) {
+                int value = -1;
+                CHECK(queue.pop(value));
+                CHECK(value == round * 4 + i);
+            }
+
+            int value;
+            CHECK(!queue.pop(value));
+        }
+        CHECK(queue.pushed() == 40);
+        CHECK(queue.popped() == 40);
+    }
+
+    void queue_threads()
+    {
+        // Small, so everyone keeps running into everyone else
+        Watch::Bounded_Queue<uint64_t> queue(64);
+
+        std::atomic<uint64_t> taken{0};
+        std::vector< std::vector<uint64_t> > seen(consumers);
+
+        std::vector<std::thread> threads;
+        for (int p = 0; p < producers; ++p) {
+            threads.emplace_back([&queue, p] {
+                    for (uint64_t i = 0; i < each; ++i) {
+                        const uint64_t value = (uint64_t(p) << 32) | i;
+                        while (!queue.push(value)) std::this_thread::yield();
+                    }
+                });
+        }
+        for (int c = 0; c < consumers; ++c) {
+            threads.emplace_back([&queue, &taken, &seen, c] {
+                    while (taken.load() < producers * each) {
+                        uint64_t value;
+                        if (!queue.pop(value)) {
+                            std::this_thread::yield();
+                            continue;
+                        }
+                        seen[c].push_back(value);
+                        ++taken;
+                    }
+                });
+        }
+        for (auto &thread : threads) thread.join();
+
+        // Everything exactly once, and each consumer saw every producer's
+        // values in the order they were pushed
+        std::vector<uint64_t> count(producers * each, 0);
+        for (const auto &values : seen) {
+            std::vector<int64_t> last(producers, -1);
+            for (const uint64_t value : values) {
+                const int p = int(value >> 32);
+                const int64_t i = int64_t(value & UINT32_MAX);
+                CHECK(i > last[p]);
+                last[p] = i;
+                ++count[p * each + i];
+            }
+        }
+
+        bool once = true;
+        for (const uint64_t n : count) once = once && (n == 1);
+        CHECK(once);
+        CHECK(queue.size() == 0);
+    }
+
+    void ring_spill()
+    {
+        Watch::Event_Ring ring(8, 2);
+        Raw_Event ev(3, "name");
+        const std::string long_path = path_for(3);
+        const std::string short_path = path_for(1);
+
+        // Two slabs, so the third long one has nowhere to go
+        CHECK(ring.push(ev.get(), long_path));
+        CHECK(ring.push(ev.get(), long_path));
+        CHECK(!ring.push(ev.get(), long_path));
+        CHECK(ring.push(ev.get(), short_path));
+
+        // Longer than any slab
+        CHECK(!ring.push(ev.get(), std::string(PATH_MAX + 1, 'x')));
+
+        Watch::Ring_Stats stats = ring.stats();
+        CHECK(stats.spilled == 2);
+        CHECK(stats.dropped == 2);
+        CHECK(stats.occupancy == 3);
+
+        // Popping gives the slab back
+        bool matched = false;
+        CHECK(ring.pop([&](const Watch::Event_View &view) {
+                matched = view.wd == 3 && view.path == long_path
+                       && view.name == "name";
+            }));
+        CHECK(matched);
+        CHECK(ring.push(ev.get(), long_path));
+
+        CHECK(ring.pop_all([](const Watch::Event_View&) {}) == 3);
+        CHECK(ring.empty());
+
+        // Both slabs are free again
+        CHECK(ring.push(ev.get(), long_path));
+        CHECK(ring.push(ev.get(), long_path));
+    }
+
+    void ring_threads()
+    {
+        Watch::Event_Ring ring(32, 4);
+
+        std::atomic<uint64_t> taken{0};
+        std::atomic<uint64_t> wrong{0};
+
+        std::vector<std::thread> threads;
+        for (int p = 0; p < producers; ++p) {
+            threads.emplace_back([&ring, p] {
+                    for (uint64_t i = 0; i < each / 10; ++i) {
+                        const int wd = int(p * each + i);
+                        Raw_Event ev(wd, std::to_string(wd));
+                        const std::string path = path_for(wd);
+                        while (!ring.push(ev.get(), path)) {
+                            std::this_thread::yield();
+                        }
+                    }
+                });
+        }
+        for (int c = 0; c < consumers; ++c) {
+            threads.emplace_back([&ring, &taken, &wrong] {
+                    while (taken.load() < producers * (each / 10)) {
+                        const bool popped = ring.pop(
+                                [&wrong](const Watch::Event_View &view) {
+                                    if (view.path != path_for(view.wd)
+                                            || view.name != std::to_string(
+                                                view.wd)) {
+                                        ++wrong;
+                                    }
+                                });
+                        if (popped) {
+                            ++taken;
+                        } else {
+                            std::this_thread::yield();
+                        }
+                    }
+                });
+        }
+        for (auto &thread : threads) thread.join();
+
+        CHECK(wrong == 0);
+        CHECK(ring.empty());
+
+        const Watch::Ring_Stats stats = ring.stats();
+        CHECK(stats.popped == producers * (each / 10));
+        CHECK(stats.spilled > 0);
+    }
+
+} // namespace
+
+int main()
+{
+    queue_fifo_and_bounds();
+    queue_threads();
+    ring_spill();
+    ring_threads();
+
+    return Check::failures();
+}
@@ -0,0 +1,146 @@
+// Sharded watching: every subtree's events reach the callbacks, new top
+// level directories are picked up with whatever was already in them, and
+// the load counts each event read once, however many callbacks want it
+
+#include <shards.hpp>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "check.hpp"
+
+namespace {
+
+    void touch(const std::string &path)
+    {
+        const int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC,
+                            0644);
+        if (fd >= 0) close(fd);
+    }
+
+    struct Seen {
+        std::mutex m;
+        std::set<std::string> paths;
+        std::size_t calls = 0;
+
+        void add(const Watch::Event_View &ev)
+        {
+            std::lock_guard<std::mutex> lock(m);
+            paths.insert(Watch::join_paths(std::string(ev.path),
+                                           std::string(ev.name)));
+            ++calls;
+        }
+
+        bool has(const std::string &path)
+        {
+            std::lock_guard<std::mutex> lock(m);
+            return paths.count(path) != 0;
+        }
+    };
+
+    // Until `done` says so, or a few seconds pass
+    template <class Done>
+    bool wait_for(Done done)
+    {
+        const auto give_up = std::chrono::steady_clock::now()
+                           + std::chrono::seconds(5);
+        while (!done()) {
+            if (std::chrono::steady_clock::now() > give_up) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return true;
+    }
+
+} // namespace
+
+int main()
+{
+    char dir[] = "/tmp/watchdog-test-shards-XXXXXX";
+    if (mkdtemp(dir) == nullptr) return 1;
+    const std::string root = dir;
+
+    const char *subtrees[] = { "a", "b", "c", "d" };
+    for (const char *name : subtrees) {
+        mkdir((root + "/" + name).c_str(), 0755);
+        mkdir((root + "/" + name + "/deep").c_str(), 0755);
+    }
+
+    Seen seen, twice;
+    {
+        Watch::Shard_Options options;
+        options.shards = 2;
+        Watch::Sharded_Pen pen(root, options);
+        CHECK(pen.shards() == 2);
+
+        pen.add_callback([&seen](const Watch::Event_View &ev) {
+                seen.add(ev);
+            }, Watch::On::Create);
+        pen.add_callback([&twice](const Watch::Event_View &ev) {
+                twice.add(ev);
+            }, Watch::On::Create);
+
+        std::thread listening([&pen] { pen.listen(); });
+
+        // Give the shards a moment to start reading
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        std::size_t files = 0;
+        for (const char *name : subtrees) {
+            for (int i = 0; i < 10; ++i) {
+                touch(root + "/" + name + "/deep/f" + std::to_string(i));
+                ++files;
+            }
+        }
+
+        CHECK(wait_for([&] {
+                for (const char *name : subtrees) {
+                    if (!seen.has(root + "/" + name + "/deep/f9")) {
+                        return false;
+                    }
+                }
+                return true;
+            }));
+
+        // Already there by the time the new subtree is watched, or not
+        const std::string added = root + "/e";
+        mkdir(added.c_str(), 0755);
+        mkdir((added + "/deep").c_str(), 0755);
+        touch(added + "/deep/early");
+        CHECK(wait_for([&] { return seen.has(added + "/deep"); }));
+        CHECK(wait_for([&] { return seen.has(added + "/deep/early"); }));
+
+        touch(added + "/deep/late");
+        CHECK(wait_for([&] { return seen.has(added + "/deep/late"); }));
+
+        pen.stop();
+        listening.join();
+
+        const Watch::Shard_Stats stats = pen.stats();
+        CHECK(stats.shards.size() == 2);
+
+        std::size_t subtree_count = 0, events = 0;
+        for (const auto &load : stats.shards) {
+            subtree_count += load.subtrees;
+            events += load.events;
+        }
+        CHECK(subtree_count == 5);
+
+        // Both callbacks ran for every event, but each was only read once
+        CHECK(seen.calls == twice.calls);
+        CHECK(events >= files);
+        CHECK(events < 2 * files);
+    }
+
+    const std::string cleanup = "rm -rf " + root;
+    CHECK(system(cleanup.c_str()) == 0);
+
+    return Check::failures();
+}
@@ -0,0 +1,169 @@
+// Event_Sink: escaping in both formats, lines longer than a chunk, and
+// carrying on after writev() only gets part of the way
+
+#include <sink.hpp>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "check.hpp"
+
+namespace {
+
+    std::string line(Watch::Sink_Format format, const Watch::Event_View &ev)
+    {
+        std::string out(Watch::Format::bound(ev), '\0');
+        out.resize(Watch::Format::line(format, ev, &out[0]));
+        return out;
+    }
+
+    // Everything written to the pipe until the write end is closed
+    std::string drain(int fd)
+    {
+        std::string all;
+        char buffer[4096];
+        ssize_t got;
+        while ((got = read(fd, buffer, sizeof(buffer))) > 0) {
+            all.append(buffer, got);
+        }
+        return all;
+    }
+
+    void escaping()
+    {
+        using namespace std::string_view_literals;
+
+        const Watch::Event_View plain{ 1, IN_CREATE, 0, "b"sv, "/a"sv };
+        CHECK(line(Watch::Sink_Format::JSON_Lines, plain)
+                == "{\"wd\":1,\"mask\":[\"Create\"],\"cookie\":0,"
+                   "\"path\":\"/a/b\"}\n");
+        CHECK(line(Watch::Sink_Format::TSV, plain)
+                == "1\tCreate\t0\t/a/b\n");
+
+        // Quotes, backslashes, whitespace, control characters and UTF-8
+        const Watch::Event_View odd{ 2, IN_MODIFY, 7,
+                                     "q\"b\\n\nt\tr\r\x01\xc3\xa9"sv,
+                                     "/d/"sv };
+        CHECK(line(Watch::Sink_Format::JSON_Lines, odd)
+                == "{\"wd\":2,\"mask\":[\"Modify\"],\"cookie\":7,"
+                   "\"path\":\"/d/q\\\"b\\\\n\\nt\\tr\\r\\u0001"
+                   "\xc3\xa9\"}\n");
+        CHECK(line(Watch::Sink_Format::TSV, odd)
+                == "2\tModify\t7\t/d/q\"b\\\\n\\nt\\tr\\r\x01\xc3\xa9\n");
+    }
+
+    void long_lines()
+    {
+        int fds[2];
+        if (pipe(fds) < 0) {
+            CHECK(false);
+            return;
+        }
+
+        // Bigger than a chunk, and more than the pipe holds at once
+        const std::string name(200000, 'n');
+        const Watch::Event_View big{ 1, IN_CREATE, 0, name, "/a" };
+        const Watch::Event_View small{ 2, IN_CREATE, 0, "s", "/a" };
+
+        std::string got;
+        std::thread reader([&got, &fds] { got = drain(fds[0]); });
+
+        Watch::Sink_Options options;
+        options.chunk_size = 4096;
+        options.chunks = 2;
+        {
+            Watch::Event_Sink sink(fds[1], options);
+            sink.write(small);
+            sink.write(big);
+            for (int i = 0; i < 1000; ++i) sink.write(small);
+        }
+        close(fds[1]);
+        reader.join();
+        close(fds[0]);
+
+        const std::string small_line = line(options.format, small);
+        std::string expected = small_line + line(options.format, big);
+        for (int i = 0; i < 1000; ++i) expected += small_line;
+        CHECK(got == expected);
+    }
+
+    void on_signal(int) {}
+
+    // A pipe that only ever has a little room, and a writer that keeps
+    // getting interrupted, so writev() mostly comes back short
+    void partial_writes()
+    {
+        struct sigaction action = {};
+        action.sa_handler = on_signal;
+        sigaction(SIGUSR1, &action, nullptr);
+
+        int fds[2];
+        if (pipe(fds) < 0) {
+            CHECK(false);
+            return;
+        }
+        fcntl(fds[1], F_SETPIPE_SZ, 4096);
+
+        Watch::Sink_Options options;
+        options.chunk_size = 1 << 16;
+        options.chunks = 4;
+        options.flush_each_batch = false;
+
+        const Watch::Event_View ev{ 3, IN_MODIFY, 0, "file", "/dir" };
+        std::string expected;
+        for (int i = 0; i < 5000; ++i) expected += line(options.format, ev);
+
+        const pthread_t writer = pthread_self();
+        std::atomic<bool> done{false};
+        std::string got;
+        std::thread reader([&] {
+                char buffer[512];
+                ssize_t n;
+                while ((n = read(fds[0], buffer, sizeof(buffer))) > 0) {
+                    got.append(buffer, n);
+                    if (!done) pthread_kill(writer, SIGUSR1);
+                    std::this_thread::sleep_for(
+                            std::chrono::microseconds(20));
+                }
+            });
+
+        Watch::Sink_Stats stats;
+        {
+            Watch::Event_Sink sink(fds[1], options);
+            for (int i = 0; i < 5000; ++i) sink.write(ev);
+            sink.flush();
+            stats = sink.stats();
+        }
+        done = true;
+        close(fds[1]);
+        reader.join();
+        close(fds[0]);
+
+        CHECK(got == expected);
+        CHECK(stats.lines == 5000);
+        CHECK(stats.bytes == expected.size());
+        // Far more than one per flush, so the rest was picked up after
+        // each short one
+        CHECK(stats.writes > 4);
+
+        signal(SIGUSR1, SIG_DFL);
+    }
+
+} // namespace
+
+int main()
+{
+    escaping();
+    long_lines();
+    partial_writes();
+
+    return Check::failures();
+}
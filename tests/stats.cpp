@@ -0,0 +1,64 @@
+// Stats: Prometheus buckets say what they hold, and callbacks counted from
+// several threads at once add up
+
+#define WATCHDOG_STATS true
+#include <stats.hpp>
+
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+
+namespace {
+
+    bool has(const std::string &text, const std::string &line)
+    {
+        return text.find(line + "\n") != std::string::npos;
+    }
+
+} // namespace
+
+int main()
+{
+    {
+        Watch::Stats::Histogram histogram;
+        for (uint64_t value : { 0, 1, 2, 3, 4 }) histogram.record(value);
+
+        std::string out;
+        Watch::Stats::append_histogram(out, "h", "", histogram.snapshot());
+
+        // Everything in a bucket is at most its `le`
+        CHECK(has(out, "h_bucket{le=\"0\"} 1"));
+        CHECK(has(out, "h_bucket{le=\"1\"} 2"));
+        CHECK(has(out, "h_bucket{le=\"3\"} 4"));
+        CHECK(has(out, "h_bucket{le=\"7\"} 5"));
+        CHECK(has(out, "h_bucket{le=\"+Inf\"} 5"));
+        CHECK(has(out, "h_sum 10"));
+        CHECK(has(out, "h_count 5"));
+    }
+
+    {
+        Watch::Stats::Recorder<true> recorder;
+        std::function<void()> cb = recorder.timed(
+                std::function<void()>([] {}), "callback");
+
+        std::vector<std::thread> workers;
+        for (int i = 0; i < 12; ++i) {
+            workers.emplace_back([&cb] {
+                    for (int j = 0; j < 1000; ++j) cb();
+                });
+        }
+        for (auto &worker : workers) worker.join();
+
+        const Watch::Sentry_Stats stats = recorder.snapshot();
+        CHECK(stats.callbacks.size() == 1);
+        CHECK(!stats.callbacks.empty()
+              && stats.callbacks[0].calls == 12000);
+        CHECK(!stats.callbacks.empty()
+              && stats.callbacks[0].nanoseconds.count == 12000);
+    }
+
+    return Check::failures();
+}
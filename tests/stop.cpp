@@ -0,0 +1,102 @@
+// Stopping: a stop ends the run that sees it and nothing after, whether
+// that's listen(), run_until() or a lone run_once()
+
+#include <watchdog.hpp>
+#include <reactor.hpp>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+
+#include "check.hpp"
+
+namespace {
+
+    using Pen = Watch::Pen;
+
+    void touch(const std::string &path)
+    {
+        const int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC,
+                            0644);
+        if (fd >= 0) close(fd);
+    }
+
+    Watch::Clock::time_point soon()
+    {
+        return Watch::Clock::now() + std::chrono::milliseconds(300);
+    }
+
+} // namespace
+
+int main()
+{
+    char dir[] = "/tmp/watchdog-test-stop-XXXXXX";
+    if (mkdtemp(dir) == nullptr) return 1;
+    const std::string root = dir;
+
+    {
+        Pen pen(root);
+        int seen = 0;
+        bool stopping = true;
+        pen.add_callback([&](const Watch::Event_View&) {
+                ++seen;
+                if (stopping) pen.stop();
+            }, Watch::On::Create);
+
+        // Stopped from a callback, and then not stopped again
+        touch(root + "/one");
+        pen.listen();
+        CHECK(seen == 1);
+
+        stopping = false;
+        touch(root + "/two");
+        pen.run_until(soon());
+        CHECK(seen == 2);
+
+        // Stopped with only run_once() going, which shouldn't leave every
+        // call after it doing nothing
+        pen.stop();
+        touch(root + "/three");
+        pen.run_once(std::chrono::milliseconds(100));
+        pen.run_once(std::chrono::milliseconds(100));
+        CHECK(seen == 3);
+
+        // Stopped before the deadline passed, and not afterwards
+        pen.stop();
+        pen.run_until(soon());
+        touch(root + "/four");
+        pen.run_until(soon());
+        CHECK(seen == 4);
+    }
+
+    {
+        Pen pen(root);
+        Watch::Reactor reactor;
+        int seen = 0;
+        pen.add_callback([&](const Watch::Event_View&) {
+                ++seen;
+                reactor.stop();
+            }, Watch::On::Create);
+        reactor.attach(pen);
+
+        touch(root + "/five");
+        reactor.listen();
+        CHECK(seen == 1);
+
+        reactor.stop();
+        touch(root + "/six");
+        reactor.run_once(std::chrono::milliseconds(100));
+        reactor.run_once(std::chrono::milliseconds(100));
+        CHECK(seen == 2);
+
+        reactor.detach(pen);
+    }
+
+    const std::string cleanup = "rm -rf " + root;
+    CHECK(system(cleanup.c_str()) == 0);
+
+    return Check::failures();
+}
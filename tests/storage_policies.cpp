@@ -0,0 +1,86 @@
+// Flat against Small, which is too simple to get wrong: random adds,
+// removes and renames, with plenty of keys sharing home slots so that
+// removals have something to shift back
+
+#include <storage_policies.hpp>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+
+namespace {
+
+    template <class Container>
+    std::vector< std::pair<int, std::string> > entries(const Container &c)
+    {
+        std::vector< std::pair<int, std::string> > all;
+        c.for_each([&all](int wd, const std::string &path) {
+                all.emplace_back(wd, path);
+            });
+        std::sort(all.begin(), all.end());
+        return all;
+    }
+
+} // namespace
+
+int main()
+{
+    Watch::Flat flat;
+    Watch::Small small;
+
+    std::mt19937 random(7);
+    const char *dirs[] = { "/a", "/b", "/a/x", "/c" };
+
+    for (int i = 0; i < 100000; ++i) {
+        // Half of them multiples of 64, which pile up on the same few
+        // home slots whatever size the table is
+        const int key = (random() % 2)
+            ? int(random() % 16) * 64
+            : int(random() % 512);
+        const std::string path = std::string(dirs[random() % 4]) + "/"
+                               + std::to_string(key);
+
+        switch (random() % 8) {
+            case 0: case 1: case 2:
+                // Small keeps duplicates, while Flat replaces them
+                small.remove(key);
+                small.add(key, path);
+                flat.add(key, path);
+                break;
+            case 3: case 4: case 5:
+                small.remove(key);
+                flat.remove(key);
+                break;
+            case 6:
+                if (random() % 100 == 0) {
+                    small.repath("/a", "/d");
+                    flat.repath("/a", "/d");
+                }
+                break;
+            default:
+                break;
+        }
+
+        CHECK(flat.contains(key) == small.contains(key));
+        CHECK(flat.find(key) == small.find(key));
+        CHECK(flat.size() == small.size());
+
+        if (i % 1000 == 0) CHECK(entries(flat) == entries(small));
+        if (Check::failures() != 0) break;
+    }
+
+    CHECK(entries(flat) == entries(small));
+
+    // Emptied out, and still good after
+    for (const auto &entry : entries(small)) flat.remove(entry.first);
+    CHECK(flat.size() == 0);
+    flat.add(64, "/x");
+    CHECK(flat.find(64) == "/x");
+    CHECK(!flat.contains(0));
+
+    return Check::failures();
+}